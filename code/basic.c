@@ -190,9 +190,18 @@ int gotoline(int f, int n) {
 /* If a bogus argument was passed, then returns false. */
     if (n < 0) return FALSE;
 
-/* First, we go to the begin of the buffer. */
+/* First, we go to the begin of the buffer. Then we go straight to the
+ * line, rather than stepping forward to it, but otherwise act as
+ * forwline() would.
+ */
     gotobob(f, n);
-    return forwline(f, n - 1);
+    if (curwp->w_dotp == curbp->b_linep) return FALSE;
+    if ((lastflag & CFCPCN) == 0) curgoal = getccol(FALSE);
+    thisflag |= CFCPCN;
+    curwp->w_dotp = lindex_goto(curbp, n);
+    curwp->w_doto = getgoal(curwp->w_dotp);
+    curwp->w_flag |= WFMOVE;
+    return TRUE;
 }
 
 /* Goto the beginning of the buffer. Massive adjustment of dot. This is
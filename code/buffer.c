@@ -194,7 +194,8 @@ int zotbuf(struct buffer *bp) {
     }
     if ((s = bclear(bp)) != TRUE)   /* Blow text away.      */
         return s;
-    free((char *) bp->b_linep);     /* Release header line. */
+    lrelease(bp->b_linep);          /* Release header line. */
+    free(bp->b_arena);              /* bclear() emptied it  */
     bp1 = NULL;                     /* Find the header.     */
     bp2 = bheadp;
     while (bp2 != bp) {
@@ -267,14 +268,9 @@ static int addline(char *text) {
     int ntext;
 
     ntext = strlen(text);
-    if ((lp = lalloc(ntext)) == NULL) return FALSE;
+    if ((lp = lalloc(blistp, ntext)) == NULL) return FALSE;
     lfillchars(lp, ntext, text);
-    blistp->b_linep->l_bp->l_fp = lp;       /* Hook onto the end    */
-    lp->l_bp = blistp->b_linep->l_bp;
-    blistp->b_linep->l_bp = lp;
-    lp->l_fp = blistp->b_linep;
-    if (blistp->b_dotp == blistp->b_linep)  /* If "." is at the end */
-        blistp->b_dotp = lp;                /* move it to new line  */
+    lappend(blistp, lp);                    /* Hook onto the end    */
     return TRUE;
 }
 
@@ -410,30 +406,40 @@ static int makelist(int iflag) {
  */
 int listbuffers(int f, int n) {
     UNUSED(n);
-    struct window *wp;
-    struct buffer *bp;
     int s;
 
     if ((s = makelist(f)) != TRUE) return s;
+    return showbuffer(blistp);
+}
+
+/*
+ * Make sure that at least one window is displaying the (freshly built)
+ * buffer "bp", popping one up if need be, and put all of those
+ * windows back at its start.
+ * Used for the buffer list and the occur list.
+ */
+int showbuffer(struct buffer *bp) {
+    struct window *wp;
+    struct buffer *obp;             /* Buffer it was showing */
 
-    if (blistp->b_nwnd == 0) {      /* Not on screen yet.   */
+    if (bp->b_nwnd == 0) {      /* Not on screen yet.   */
         if ((wp = wpopup()) == NULL) return FALSE;
-        bp = wp->w_bufp;
-        if (--bp->b_nwnd == 0) {
-            bp->b_dotp = wp->w_dotp;
-            bp->b_doto = wp->w_doto;
-            bp->b_markp = wp->w_markp;
-            bp->b_marko = wp->w_marko;
-            bp->b_fcol = wp->w_fcol;
+        obp = wp->w_bufp;
+        if (--obp->b_nwnd == 0) {
+            obp->b_dotp = wp->w_dotp;
+            obp->b_doto = wp->w_doto;
+            obp->b_markp = wp->w_markp;
+            obp->b_marko = wp->w_marko;
+            obp->b_fcol = wp->w_fcol;
         }
-        wp->w_bufp = blistp;
-        ++blistp->b_nwnd;
+        wp->w_bufp = bp;
+        ++bp->b_nwnd;
     }
     wp = wheadp;
     while (wp != NULL) {
-        if (wp->w_bufp == blistp) {
-            wp->w_linep = lforw(blistp->b_linep);
-            wp->w_dotp = lforw(blistp->b_linep);
+        if (wp->w_bufp == bp) {
+            wp->w_linep = lforw(bp->b_linep);
+            wp->w_dotp = lforw(bp->b_linep);
             wp->w_doto = 0;
             wp->w_markp = NULL;
             wp->w_marko = 0;
@@ -496,7 +502,7 @@ struct buffer *bfind(const char *bname, int cflag, int bflag) {
     }
     if (cflag != FALSE) {
         bp = (struct buffer *)Xmalloc(sizeof(struct buffer));
-        if ((lp = lalloc(0)) == NULL) {
+        if ((lp = lalloc(NULL, 0)) == NULL) {
             free((char *) bp);
             return NULL;
         }
@@ -535,6 +541,11 @@ struct buffer *bfind(const char *bname, int cflag, int bflag) {
         bp->b_keylen = 0;
         bp->b_EOLmissing = 0;
         bp->ptt_headp = NULL;
+        bp->b_store = NULL;
+        bp->b_arena = larena_alloc();
+        bp->b_lindex = NULL;
+        bp->b_undo = NULL;
+        bp->b_prog = NULL;
         bp->b_type = BTNORM;
         bp->b_exec_level = 0;
         lp->l_fp = lp;
@@ -552,7 +563,7 @@ struct buffer *bfind(const char *bname, int cflag, int bflag) {
  * Return TRUE if everything looks good.
  */
 int bclear(struct buffer *bp) {
-    struct line *lp;
+    struct window *wp;
     int s;
 
     if ((bp->b_flag & BFINVS) == 0      /* Not scratch buffer.  */
@@ -560,6 +571,8 @@ int bclear(struct buffer *bp) {
         && (s = mlyesno("Discard changes")) != TRUE)
             return s;
     bp->b_flag &= ~BFCHG;               /* Not changed          */
+    undo_clear(bp);
+    proc_free(bp);
 
 /* If the buffer is narrowed we must widen it first to ensure we free
  * all lines - not just those from the narrowed region.
@@ -570,7 +583,25 @@ int bclear(struct buffer *bp) {
         bp = curwp->w_bufp;
     }
 
-    while ((lp = lforw(bp->b_linep)) != bp->b_linep) lfree(lp);
+/* All of the lines are in the buffer's arena, so we can just drop that
+ * in one go. But first move anything that might be pointing at them to
+ * the header line, as lfree() would have done.
+ */
+    for (wp = wheadp; wp != NULL; wp = wp->w_wndp) {
+        if (wp->w_bufp != bp) continue;
+        wp->w_linep = bp->b_linep;
+        wp->w_dotp = bp->b_linep;
+        wp->w_doto = 0;
+        if (wp->w_markp) {
+            wp->w_markp = bp->b_linep;
+            wp->w_marko = 0;
+        }
+    }
+    lindex_drop(bp);
+    larena_release(bp->b_arena);
+    lstore_free(bp);                    /* No lines point at it now */
+    bp->b_linep->l_fp = bp->b_linep;
+    bp->b_linep->l_bp = bp->b_linep;
 
     bp->b_dotp = bp->b_linep;           /* Fix "."              */
     bp->b_doto = 0;
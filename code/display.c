@@ -9,8 +9,11 @@
  */
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "estruct.h"
@@ -36,13 +39,14 @@ static int vtcol = 0;                  /* Column location of SW cursor */
 
 struct video {
     int v_flag;             /* Flags */
+    unsigned int v_hash;    /* Hash of v_text (pscreen, if VFHASH) */
 #if     COLOR
     int v_fcolor;           /* current forground color      */
     int v_bcolor;           /* current background color     */
     int v_rfcolor;          /* requested forground color    */
     int v_rbcolor;          /* requested background color   */
 #endif
-    struct grapheme v_text[0];  /* Screen data - dynamic    */
+    unicode_t v_text[0];    /* Screen cells - dynamic       */
 };
 
 #define VFCHG   0x0001          /* Changed flag                 */
@@ -50,6 +54,7 @@ struct video {
 #define VFREV   0x0004          /* reverse video status         */
 #define VFREQ   0x0008          /* reverse video request        */
 #define VFCOL   0x0010          /* color change requested       */
+#define VFHASH  0x0020          /* v_hash is valid (pscreen)    */
 
 static struct video **vscreen;          /* Virtual screen. */
 #if MEMMAP == 0
@@ -67,10 +72,9 @@ static int displaying = FALSE;
 static int reframe(struct window *wp);
 static void updone(struct window *wp);
 static void updall(struct window *wp);
-static int scrolls(int inserts);
+static int scrolls(void);
 static void scrscroll(int from, int to, int count);
-static int texttest(int vrow, int prow);
-static int endofline(struct grapheme *s, int n);
+static int endofline(unicode_t *s, int n);
 static void updext(void);
 static int updateline(int row, struct video *vp1, struct video *vp2);
 static void modeline(struct window *wp);
@@ -82,100 +86,110 @@ static void mlputf(int s);
 static void putline(int row, int col, char *buf);
 #endif
 
-/* GGR Some functions to handle struct grapheme usage */
-
-/* Set the entry to an ASCII character.
- * Checks for previous extended cdm usage and frees any such found
- * unless the no_free flag is set (which it is for a pscreen setting).
+/* Screen cells.
+ * Each cell of vscreen and pscreen is a unicode_t. A grapheme that is just
+ * one code point is held as that; one with further (zero-width) code
+ * points is interned, once, in gr_tab and the cell holds GR_INTERN plus
+ * its index there. So cells can be compared, copied and hashed as plain
+ * integers, and nothing is allocated or freed as rows are drawn.
+ * Interned graphemes are kept for the life of the session (there are
+ * never many).
  */
-static void set_grapheme(struct grapheme *gp, unicode_t uc, int no_free) {
-    gp->uc = uc;
-    gp->cdm = 0;
-    if (!no_free && gp->ex != NULL) {
-        free(gp->ex);
-        gp->ex = NULL;
-    }
-    return;
+#define GR_INTERN   0x80000000
+
+struct grent {
+    unicode_t *ge_uc;           /* The code points... */
+    int ge_len;                 /* ...and how many */
+};
+static struct grent *gr_tab;
+static int gr_count, gr_alloc;
+static int *gr_hash;            /* Open hash of gr_tab index + 1 */
+static int gr_hsize;            /* A power of 2 */
+
+static unsigned int gr_hashof(unicode_t *uc, int len) {
+    unsigned int h = 2166136261u;
+    while (len--) h = (h ^ *uc++) * 16777619u;
+    return h;
 }
 
-/* Add a unicode character as a cdm or dynamic ex entry
- */
-static void extend_grapheme(struct grapheme *gp, unicode_t uc) {
+/* The cell for the grapheme made of the "len" code points at "uc" */
+static unicode_t gr_intern(unicode_t *uc, int len) {
+    unsigned int hi;
+    int i;
 
-    if (gp->cdm == 0) {         /* None there yet - simple */
-        gp->cdm = (unicode_t)uc;
-        return;
+    if (len == 1) return uc[0];
+    if (2*gr_count >= gr_hsize) {       /* (Re)build the hash */
+        gr_hsize = gr_hsize? 2*gr_hsize: 64;
+        free(gr_hash);
+        gr_hash = Xmalloc(gr_hsize*sizeof(int));
+        memset(gr_hash, 0, gr_hsize*sizeof(int));
+        for (i = 0; i < gr_count; i++) {
+            hi = gr_hashof(gr_tab[i].ge_uc, gr_tab[i].ge_len);
+            while (gr_hash[hi & (gr_hsize - 1)]) hi++;
+            gr_hash[hi & (gr_hsize - 1)] = i + 1;
+        }
     }
-/* Need to create or extend an ex section */
-    int xc = 0;
-    if (gp->ex != NULL) {
-        while(gp->ex[xc] != UEM_NOCHAR) xc++;
+    for (hi = gr_hashof(uc, len); (i = gr_hash[hi & (gr_hsize - 1)]); hi++) {
+        struct grent *ge = gr_tab + i - 1;
+        if (ge->ge_len == len && !memcmp(ge->ge_uc, uc, len*sizeof(unicode_t)))
+            return GR_INTERN | (i - 1);
     }
-    gp->ex = Xrealloc(gp->ex, (xc+2)*sizeof(unicode_t));
-    gp->ex[xc] = uc;
-    gp->ex[xc+1] = UEM_NOCHAR;
-    return;
-}
-
-/* Copy grapheme data between structures.
- * HOWEVER, since this *always* copies from vscreen to pscreen we DO NOT
- * NEED to allocate any ex section in the target, as we never free
- * anything from pscreen - it will be freed (by set_grapheme) when the
- * vscreen is set! We just copy the pointer, so copy the whole structure.
- * Could just be defined as:
- *      #define clone_grapheme(to, from)   *to = *from
- * but we'll just inline it instead.
- */
-static inline void
-  clone_grapheme(struct grapheme *gtarget, struct grapheme *gsource) {
-    gtarget->uc = gsource->uc;
-    gtarget->cdm = gsource->cdm;
-    gtarget->ex = gsource->ex;
-    return;
+    if (gr_count == gr_alloc) {
+        gr_alloc = gr_alloc? 2*gr_alloc: 16;
+        gr_tab = Xrealloc(gr_tab, gr_alloc*sizeof(struct grent));
+    }
+    gr_tab[gr_count].ge_uc = Xmalloc(len*sizeof(unicode_t));
+    memcpy(gr_tab[gr_count].ge_uc, uc, len*sizeof(unicode_t));
+    gr_tab[gr_count].ge_len = len;
+    gr_hash[hi & (gr_hsize - 1)] = gr_count + 1;
+    return GR_INTERN | gr_count++;
 }
 
-/* Only interested in same/not same here
- */
-static int grapheme_same(struct grapheme *gp1, struct grapheme *gp2) {
-    if (gp1->uc != gp2->uc) return FALSE;
-    if (gp1->cdm != gp2->cdm) return FALSE;
-    if ((gp1->ex == NULL) && (gp2->ex == NULL)) return TRUE;
-    if ((gp1->ex == NULL) && (gp2->ex != NULL)) return FALSE;
-    if ((gp1->ex != NULL) && (gp2->ex == NULL)) return FALSE;
-/* Have to compare the ex lists!... */
-    unicode_t *ex1 = gp1->ex;
-    unicode_t *ex2 = gp2->ex;
-    while(1) {
-        if (*ex1 != *ex2) return FALSE;
-        if ((*ex1 == UEM_NOCHAR) || (*ex2 == UEM_NOCHAR)) break;
-        ex1++; ex2++;
-    }
-    return ((*ex1 == UEM_NOCHAR) && (*ex2 == UEM_NOCHAR));
+/* The "main" code point of a cell */
+static inline unicode_t cell_base(unicode_t cell) {
+    return (cell & GR_INTERN)? gr_tab[cell & ~GR_INTERN].ge_uc[0]: cell;
 }
 
-static int
-  grapheme_same_array(struct grapheme *gp1, struct grapheme *gp2, int nelem) {
-    for (int i = 0; i < nelem; i++) {
-        if (!grapheme_same(gp1+i, gp2+i)) return FALSE;
+/* Add a (zero-width) code point to the grapheme in a cell */
+static void extend_cell(unicode_t *cp, unicode_t uc) {
+    static unicode_t *buf;
+    static int bufsize;
+    int len;
+
+    if (*cp & GR_INTERN) {
+        struct grent *ge = gr_tab + (*cp & ~GR_INTERN);
+        len = ge->ge_len;
+        if (len + 1 > bufsize) {
+            bufsize = len + 8;
+            buf = Xrealloc(buf, bufsize*sizeof(unicode_t));
+        }
+        memcpy(buf, ge->ge_uc, len*sizeof(unicode_t));
     }
-    return TRUE;
-}
-
-static int is_space(struct grapheme *gp) {
-    return ((gp->uc == ' ') && (gp->cdm == 0));
+    else {
+        if (bufsize < 8) {
+            bufsize = 8;
+            buf = Xrealloc(buf, bufsize*sizeof(unicode_t));
+        }
+        buf[0] = *cp;
+        len = 1;
+    }
+    buf[len++] = uc;
+    *cp = gr_intern(buf, len);
 }
 
-/* Output a grapheme - which is in one column.
+/* Output a cell - which is in one column.
  * Handle remapping on the main character.
  */
-static inline int TTputgrapheme(struct grapheme *gp) {
-    int status = TTputc(display_for(gp->uc));
-    if (gp->cdm) TTputc(gp->cdm);   /* Might add display_for here too */
-    if (gp->ex != NULL) {
-        for(unicode_t *zw = gp->ex; *zw != UEM_NOCHAR; zw++) {
-            TTputc(*zw);            /* Might add display_for here too */
-        }
+static inline int TTputcell(unicode_t cell) {
+    int status;
+
+    if (cell & GR_INTERN) {
+        struct grent *ge = gr_tab + (cell & ~GR_INTERN);
+        status = TTputc(display_for(ge->ge_uc[0]));
+        for (int i = 1; i < ge->ge_len; i++)
+            TTputc(ge->ge_uc[i]);   /* Might add display_for here too */
     }
+    else status = TTputc(display_for(cell));
     ttcol++;
     return status;
 }
@@ -209,8 +223,7 @@ void vtinit(void) {
     pscreen = Xmalloc(term.t_mrow * sizeof(struct video *));
 
     for (i = 0; i < term.t_mrow; ++i) {
-        vp = Xmalloc(sizeof(struct video) +
-             term.t_mcol*sizeof(struct grapheme));
+        vp = Xmalloc(sizeof(struct video) + term.t_mcol*sizeof(unicode_t));
         vp->v_flag = 0;
 #if COLOR
 /* GGR - use defined colors */
@@ -219,20 +232,10 @@ void vtinit(void) {
 #endif
         vscreen[i] = vp;
 
-/* GGR - clear things out at the start.
- * We can't use set_grapheme() until after we have initialized
- * We only need to initialize vscreen, as we do all assigning
- * (including Xmalloc()/free()) there.
- * Need to clear it *all* out now! */
-
-        for (int j = 0; j < term.t_mcol; j++) {
-            vp->v_text[j].uc = ' ';
-            vp->v_text[j].cdm = 0;
-            vp->v_text[j].ex = NULL;
-        }
+/* GGR - clear things out at the start. */
+        for (int j = 0; j < term.t_mcol; j++) vp->v_text[j] = ' ';
 
-        vp = Xmalloc(sizeof(struct video) +
-             term.t_mcol*sizeof(struct grapheme));
+        vp = Xmalloc(sizeof(struct video) + term.t_mcol*sizeof(unicode_t));
         vp->v_flag = 0;
         pscreen[i] = vp;
     }
@@ -271,9 +274,11 @@ void vtmove(int row, int col) {
  *
  * This routine only puts printing characters into the virtual
  * terminal buffers. Only column overflow is checked.
+ * Returns FALSE once the "$" has been put there, after which nothing more
+ * written to this row can change it.
  */
 
-static void vtputc(unsigned int c) {
+static int vtputc(unsigned int c) {
     struct video *vp;       /* ptr to line being updated */
 
     if (c > MAX_UTF8_CHAR) c = display_for(c);
@@ -283,9 +288,9 @@ static void vtputc(unsigned int c) {
     if (zerowidth_type((unicode_t)c)) {
 /* Only extend a grapheme if we have a prev-char within screen width */
         if (vtcol > 0 && (vtcol <= term.t_ncol)) {
-            extend_grapheme(&(vp->v_text[vtcol-1]), c);
+            extend_cell(&(vp->v_text[vtcol-1]), c);
         }
-        return;     /* Nothing else do do... */
+        return TRUE;    /* Nothing else do do... */
     }
 
     if (vtcol >= term.t_ncol) {
@@ -294,21 +299,21 @@ static void vtputc(unsigned int c) {
  * back over any NUL graphemes.
  */
         for (int dcol = term.t_ncol - 1; dcol >= 0; dcol--) {
-            if (vp->v_text[dcol].uc == '$') break;  /* Quick repeat exit */
-            if (vp->v_text[dcol].uc != 0) {
-                set_grapheme(&(vp->v_text[dcol]), '$', 0);
+            if (vp->v_text[dcol] == '$') break;     /* Quick repeat exit */
+            if (vp->v_text[dcol] != 0) {
+                vp->v_text[dcol] = '$';
                 break;
             }
         }
-        set_grapheme(&(vp->v_text[term.t_ncol - 1]), '$', 0);
-        return;
+        vp->v_text[term.t_ncol - 1] = '$';
+        return FALSE;
     }
 
     if (c == '\t') {
         do {
-            vtputc(' ');
+            if (!vtputc(' ')) return FALSE;
         } while (((vtcol + taboff) & tabmask) != 0);
-        return;
+        return TRUE;
     }
 
 /* NOTE: Unicode has characters for displaying Control Characters
@@ -316,8 +321,7 @@ static void vtputc(unsigned int c) {
  */
     if (c < 0x20) {
         vtputc('^');
-        vtputc(c ^ 0x40);
-        return;
+        return vtputc(c ^ 0x40);
     }
 
 /* NOTE: Unicode has a character for displaying Delete.
@@ -325,26 +329,24 @@ static void vtputc(unsigned int c) {
  */
     if (c == 0x7f) {
         vtputc('^');
-        vtputc('?');
-        return;
+        return vtputc('?');
     }
 
     if (c >= 0x80 && c <= 0xa0) {
         static const char hex[] = "0123456789abcdef";
         vtputc('\\');
         vtputc(hex[c >> 4]);
-        vtputc(hex[c & 15]);
-        return;
+        return vtputc(hex[c & 15]);
     }
 
     int cw = utf8proc_charwidth(c);
     if (vtcol >= 0) {
-        set_grapheme(&(vp->v_text[vtcol]), c, 0);
+        vp->v_text[vtcol] = c;
 /* This code assumes that a NUL byte will not be displayed */
         int pvcol = vtcol;
         for (int nulpad = cw - 1; nulpad > 0; nulpad--) {
             pvcol++;
-            set_grapheme(&(vp->v_text[pvcol]), 0, 0);
+            vp->v_text[pvcol] = 0;
         }
     }
 /* If vtcol is -ve, but will be +ve after the cw increment we need to space
@@ -352,10 +354,119 @@ static void vtputc(unsigned int c) {
  */
     else {
         for (int pcol = vtcol + cw; pcol > 0; pcol--) {
-            set_grapheme(&(vp->v_text[pcol-1]), ' ', 0);
+            vp->v_text[pcol-1] = ' ';
         }
     }
     vtcol += cw;
+    return TRUE;
+}
+
+/*
+ * The column after vtputc() has put "c" at column "col" (counted from
+ * the start of the line, as tab stops are).
+ */
+static int vtnextcol(int col, unicode_t c) {
+    if (c > MAX_UTF8_CHAR) c = display_for(c);
+    if (zerowidth_type(c)) return col;
+    if (c == '\t') return (col | tabmask) + 1;
+    if (c < 0x20 || c == 0x7f) return col + 2;
+    if (c >= 0x80 && c <= 0xa0) return col + 3;
+    return col + utf8proc_charwidth(c);
+}
+
+/*
+ * Column checkpoints for long lines.
+ * To show a line starting some way along it (when scrolled sideways, or
+ * for an extended line) we would have to go through it from the start to
+ * find the byte that is at the left edge, and updpos() has to do the same
+ * to find the column of ".". For a long line that gets expensive, so
+ * every CP_STEP bytes we note the byte offset and the column there (both
+ * as vtputc() counts it and as updpos() does, which differ for a few odd
+ * characters), and can then start from the last one before where we want
+ * to be. They are made as far along a line as has been needed, and are
+ * kept for the last few lines used while their generation is unchanged.
+ */
+#define CP_MINLEN   4096        /* Only for lines longer than this */
+#define CP_STEP     1024        /* Bytes between checkpoints */
+#define CP_NLINES   4           /* Lines we keep them for */
+
+struct colmark {
+    int cm_byte;                /* Byte offset (at the start of a char) */
+    int cm_vcol;                /* Column there for vtputc()... */
+    int cm_pcol;                /* ...and for updpos() */
+};
+
+static struct colcache {
+    struct line *cc_lp;         /* The line... */
+    unsigned long cc_gen;       /* ...and its generation */
+    struct colmark *cc_mark;    /* Checkpoints, the first at byte 0 */
+    int cc_nmark;
+    int cc_alloc;
+    struct colmark cc_end;      /* How far we have looked */
+    unsigned int cc_used;       /* When last used (for replacement) */
+} colcache[CP_NLINES];
+static unsigned int colcache_clock;
+
+/*
+ * Return the last checkpoint in line "lp" which is at or before byte
+ * "byte" and vtputc() column "vcol", making more as needed.
+ */
+static struct colmark *colmark_find(struct line *lp, int byte, int vcol) {
+    struct colcache *cc, *ccp;
+    struct colmark *cm;
+    int len = llength(lp);
+    int lo, hi;
+
+    cc = colcache;
+    for (ccp = colcache; ccp < colcache + CP_NLINES; ccp++) {
+        if (ccp->cc_lp == lp && ccp->cc_gen == lp->l_gen) {
+            cc = ccp;
+            break;
+        }
+        if (ccp->cc_used < cc->cc_used) cc = ccp;
+    }
+    if (cc->cc_lp != lp || cc->cc_gen != lp->l_gen) {
+        if (cc->cc_alloc == 0) {
+            cc->cc_alloc = 16;
+            cc->cc_mark = Xmalloc(cc->cc_alloc*sizeof(struct colmark));
+        }
+        cc->cc_lp = lp;
+        cc->cc_gen = lp->l_gen;
+        cc->cc_mark[0].cm_byte = 0;
+        cc->cc_mark[0].cm_vcol = 0;
+        cc->cc_mark[0].cm_pcol = 0;
+        cc->cc_nmark = 1;
+        cc->cc_end = cc->cc_mark[0];
+    }
+    cc->cc_used = ++colcache_clock;
+
+/* Carry on along the line until we are past where we want to be */
+    cm = &cc->cc_end;
+    while (cm->cm_byte < len && cm->cm_byte <= byte && cm->cm_vcol <= vcol) {
+        unicode_t c;
+        cm->cm_byte += utf8_to_unicode(lp->l_text, cm->cm_byte, len, &c);
+        cm->cm_vcol = vtnextcol(cm->cm_vcol, c);
+        update_screenpos_for_char(cm->cm_pcol, c);
+        if (cm->cm_byte - cc->cc_mark[cc->cc_nmark - 1].cm_byte >= CP_STEP) {
+            if (cc->cc_nmark == cc->cc_alloc) {
+                cc->cc_alloc *= 2;
+                cc->cc_mark = Xrealloc(cc->cc_mark,
+                     cc->cc_alloc*sizeof(struct colmark));
+            }
+            cc->cc_mark[cc->cc_nmark++] = *cm;
+        }
+    }
+
+/* Binary chop for the last one not beyond either limit */
+    lo = 0;
+    hi = cc->cc_nmark - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1)/2;
+        cm = cc->cc_mark + mid;
+        if (cm->cm_byte <= byte && cm->cm_vcol <= vcol) lo = mid;
+        else                                            hi = mid - 1;
+    }
+    return cc->cc_mark + lo;
 }
 
 /*
@@ -363,9 +474,9 @@ static void vtputc(unsigned int c) {
  * the software cursor is located.
  */
 static void vteeol(void) {
-    struct grapheme *vcp = vscreen[vtrow]->v_text;
+    unicode_t *vcp = vscreen[vtrow]->v_text;
 
-    while (vtcol < term.t_ncol) set_grapheme(&(vcp[vtcol++]), ' ', 0);
+    while (vtcol < term.t_ncol) vcp[vtcol++] = ' ';
 }
 
 /*
@@ -385,7 +496,7 @@ int upscreen(int f, int n) {
  *      the virtual screen and force a full update
  */
 static void updgar(void) {
-    struct grapheme *txt;
+    unicode_t *txt;
     int i, j;
 
 /* GGR - include the last row, so <=, (for mini-buffer) */
@@ -401,11 +512,9 @@ static void updgar(void) {
         vscreen[i]->v_fcolor = gfcolor;
         vscreen[i]->v_bcolor = gbcolor;
 #endif
-/* We only ever free the extended parts from the virtual screen info, not the
- * physical one, so set the no_free flag here.
- */
         txt = pscreen[i]->v_text;
-        for (j = 0; j < term.t_ncol; ++j) set_grapheme(txt+j, ' ', 1);
+        for (j = 0; j < term.t_ncol; ++j) txt[j] = ' ';
+        pscreen[i]->v_flag &= ~VFHASH;
     }
 
     movecursor(0, 0);       /* Erase the screen. */
@@ -428,6 +537,29 @@ static int scrflags = 0;
  *
  * int force;           force update past type ahead?
  */
+/*
+ * Redisplay scheduling.
+ * The main loop asks update_due() whether to update the screen before
+ * reading each command. When there is already more input waiting (a
+ * paste, or key repeat running ahead of the display) there is little
+ * point in showing the state after every key, so the update is skipped
+ * until the input runs out or 1/$max_fps seconds have passed since the
+ * last one (so a long paste still shows progress).
+ * $max_fps of 0 updates after every command, as before.
+ */
+static struct timespec last_frame;  /* When update() last flushed */
+
+int update_due(void) {
+    struct timespec now;
+    long usecs;
+
+    if (max_fps <= 0 || kbdmode == PLAY || !typahead()) return TRUE;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    usecs = (now.tv_sec - last_frame.tv_sec) * 1000000L +
+         (now.tv_nsec - last_frame.tv_nsec) / 1000;
+    return usecs >= 1000000L / max_fps;
+}
+
 int update(int force) {
     struct window *wp;
 
@@ -508,6 +640,7 @@ int update(int force) {
     movecursor(currow, curcol - lbound);
 
     TTflush();
+    clock_gettime(CLOCK_MONOTONIC, &last_frame);
     displaying = was_displaying;
 
 #if SIGWINCH
@@ -595,13 +728,75 @@ static int reframe(struct window *wp) {
     return TRUE;
 }
 
+/*
+ * Rendered rows.
+ * A row as show_line() leaves it depends only on the line's text, the
+ * column at the left edge (taboff), the screen width and the tab width.
+ * So we keep the last row rendered for each of a number of such keys
+ * (the line's generation, see ltouch(), standing for its text) and copy
+ * that into the virtual screen when it's wanted again, as it is whenever
+ * a window is redrawn (WFHARD) after scrolling or splitting.
+ * The cache is direct-mapped, so a clash just loses the older row.
+ */
+#define RC_NROWS    256
+
+struct rowcache {
+    struct line *rc_lp;         /* The line... */
+    unsigned long rc_gen;       /* ...its generation... */
+    int rc_taboff;              /* ...the column at the left edge... */
+    int rc_ncol;                /* ...the width... */
+    int rc_tabmask;             /* ...and tab setting it was done for */
+    unicode_t *rc_text;         /* The row */
+};
+static struct rowcache *rowcache;
+
+/* Put line "lp" onto the virtual screen, starting at vtcol (which is
+ * -ve if it starts off to the left - it must be -taboff) and filling the
+ * row. We stop once we reach the right edge and, for a long line, start
+ * at the last checkpoint before the left one. If we have the row already
+ * we just copy that.
+ */
 static void show_line(struct line *lp) {
     int i = 0, len = llength(lp);
+    struct rowcache *rc;
+    unicode_t *vcp = vscreen[vtrow]->v_text;
+
+    if (rowcache == NULL) {
+        rowcache = Xmalloc(RC_NROWS*sizeof(struct rowcache));
+        memset(rowcache, 0, RC_NROWS*sizeof(struct rowcache));
+    }
+    rc = rowcache +
+         (((unsigned long)lp >> 4) ^ lp->l_gen ^ (taboff << 3)) % RC_NROWS;
+    if (rc->rc_lp == lp && rc->rc_gen == lp->l_gen &&
+         rc->rc_taboff == taboff && rc->rc_ncol == term.t_ncol &&
+         rc->rc_tabmask == tabmask) {
+        memcpy(vcp, rc->rc_text, term.t_ncol*sizeof(unicode_t));
+        vtcol = term.t_ncol;
+        return;
+    }
+
+    if (vtcol < 0 && len > CP_MINLEN) {
+        struct colmark *cm = colmark_find(lp, INT_MAX, -vtcol);
+        i = cm->cm_byte;
+        vtcol += cm->cm_vcol;
+    }
     while (i < len) {
         unicode_t c;
         i += utf8_to_unicode(lp->l_text, i, len, &c);
-        vtputc(c);
+        if (!vtputc(c)) break;
     }
+    if (vtcol < 0) vtcol = 0;   /* Ended before the left edge */
+    vteeol();
+
+/* Keep it */
+    if (rc->rc_text == NULL)
+        rc->rc_text = Xmalloc(term.t_mcol*sizeof(unicode_t));
+    memcpy(rc->rc_text, vcp, term.t_ncol*sizeof(unicode_t));
+    rc->rc_lp = lp;
+    rc->rc_gen = lp->l_gen;
+    rc->rc_taboff = taboff;
+    rc->rc_ncol = term.t_ncol;
+    rc->rc_tabmask = tabmask;
 }
 
 /* Map a char string with (possibly) utf8 sequences in it to unicode
@@ -704,9 +899,16 @@ void updpos(void) {
         lp = lforw(lp);
     }
 
-/* Find the current column */
+/* Find the current column (from the last checkpoint before "." in a long
+ * line).
+ */
     curcol = 0;
     i = 0;
+    if (llength(lp) > CP_MINLEN && curwp->w_doto > CP_STEP) {
+        struct colmark *cm = colmark_find(lp, curwp->w_doto, INT_MAX);
+        i = cm->cm_byte;
+        curcol = cm->cm_pcol;
+    }
     while (i < curwp->w_doto) {
         unicode_t c;
         int bytes = utf8_to_unicode(lp->l_text, i, curwp->w_doto, &c);
@@ -806,10 +1008,7 @@ int updupd(int force) {
     UNUSED(force);
     struct video *vp1;
     int i;
-    if (scrflags & WFKILLS)
-        scrolls(FALSE);
-    if (scrflags & WFINS)
-        scrolls(TRUE);
+    if (scrflags & (WFKILLS | WFINS)) scrolls();
     scrflags = 0;
 
 /* GGR - include the last row, so <=, (for mini-buffer) */
@@ -828,124 +1027,238 @@ int updupd(int force) {
 }
 
 /*
- * optimize out scrolls (line breaks, and newlines)
- * arg. chooses between looking for inserts or deletes
- */
-static int scrolls(int inserts) {   /* returns true if it does something */
-    struct video *vpv;              /* virtual screen image */
-    struct video *vpp;              /* physical screen image */
-    int i, j, k;
-    int rows, cols;
-    int first, match, count, target, end;
-    int longmatch, longcount;
-    int from, to;
+ * Scrolling.
+ * When lines have been inserted or deleted (or a window paged) much of
+ * what we want on the screen may already be there, just in the wrong
+ * rows, and it's cheaper to have the terminal scroll it into place than to
+ * redraw it. We decide which rows to keep with a least-cost matching of
+ * the rows wanted (vscreen) to the rows there (pscreen) that keeps them
+ * in order - an edit distance, as in Gosling's redisplay. Each row wanted
+ * that isn't kept costs about what it takes to draw it, and each run of
+ * rows kept costs a scroll (its set-up, and each row it moves) unless it
+ * stays where it is. Rows are compared by a hash of what's in them (a
+ * wrong match just means more for updateline() to do).
+ */
+#define SC_RUNCOST  16          /* Bytes to set up a scroll... */
+#define SC_ROWCOST  3           /* ...and per row it moves */
+
+/* A hash of a row's text and the video attributes it has (physical) or
+ * wants (virtual).
+ */
+static unsigned int row_hash(struct video *vp, int rev, int fcol, int bcol) {
+    unsigned int h = 2166136261u;
+    unicode_t *cp = vp->v_text;
+
+    for (int i = 0; i < term.t_ncol; i++) h = (h ^ *cp++) * 16777619u;
+    h = (h ^ rev) * 16777619u;
+    h = (h ^ fcol) * 16777619u;
+    return (h ^ bcol) * 16777619u;
+}
+
+/* Move our record of the physical screen in line with a scrscroll().
+ * The "count" rows at "from" go to "to", and the rest of the rows between
+ * are left blank. The video attributes a row has (which are kept in
+ * vscreen) go with it.
+ */
+static void scrmove(int from, int to, int count) {
+    int top, nrow, i, j;
+    struct video **save;
+    int *flag;
+#if COLOR
+    int *fcol, *bcol;
+#endif
+
+    top = (from < to)? from: to;
+    nrow = abs(from - to) + count;
+    save = Xmalloc(nrow*sizeof(struct video *));
+    flag = Xmalloc(nrow*sizeof(int));
+#if COLOR
+    fcol = Xmalloc(nrow*sizeof(int));
+    bcol = Xmalloc(nrow*sizeof(int));
+#endif
+    for (i = 0; i < nrow; i++) {
+        save[i] = pscreen[top + i];
+        flag[i] = vscreen[top + i]->v_flag;
+#if COLOR
+        fcol[i] = vscreen[top + i]->v_fcolor;
+        bcol[i] = vscreen[top + i]->v_bcolor;
+#endif
+    }
+
+/* The moved rows, then the left-over ones (blanked) for the rest */
+    for (i = 0; i < count; i++) {
+        j = from - top + i;
+        pscreen[to + i] = save[j];
+        vscreen[to + i]->v_flag &= ~VFREV;
+        vscreen[to + i]->v_flag |= flag[j] & VFREV;
+#if COLOR
+        vscreen[to + i]->v_fcolor = fcol[j];
+        vscreen[to + i]->v_bcolor = bcol[j];
+#endif
+        save[j] = NULL;
+    }
+    for (i = 0, j = 0; i < nrow; i++) {
+        struct video *vp = vscreen[top + i];
+        vp->v_flag |= VFCHG;
+        if (top + i >= to && top + i < to + count) continue;
+        while (save[j] == NULL) j++;
+        pscreen[top + i] = save[j++];
+        for (int k = 0; k < term.t_ncol; k++)
+            pscreen[top + i]->v_text[k] = ' ';
+        pscreen[top + i]->v_flag &= ~VFHASH;
+        vp->v_flag &= ~VFREV;
+#if COLOR
+        vp->v_fcolor = gfcolor;
+        vp->v_bcolor = gbcolor;
+#endif
+    }
+    free(save);
+    free(flag);
+#if COLOR
+    free(fcol);
+    free(bcol);
+#endif
+}
+
+static int scrolls(void) {  /* returns true if it does something */
+    int rows, cols, n1, i, j, d, did;
+    unsigned int *vh, *ph;
+    int *mcost, *xcost, *match;
+    char *mfrom, *xfrom;
+    struct video *vp;
 
     if (!term.t_scroll) return FALSE;       /* No way to scroll */
 
     rows = term.t_nrow;
     cols = term.t_ncol;
 
-    first = -1;
-    for (i = 0; i < rows; i++) {    /* Find first wrong line */
-        if (!texttest(i, i)) {
-            first = i;
-            break;
+/* The hashes of what's wanted and what's there. A row that hasn't changed
+ * is what's there.
+ */
+    vh = Xmalloc(rows*sizeof(unsigned int));
+    ph = Xmalloc(rows*sizeof(unsigned int));
+    for (i = 0; i < rows; i++) {
+        vp = pscreen[i];
+        if (!(vp->v_flag & VFHASH)) {
+            vp->v_hash = row_hash(vp, !!(vscreen[i]->v_flag & VFREV),
+#if COLOR
+                 vscreen[i]->v_fcolor, vscreen[i]->v_bcolor);
+#else
+                 0, 0);
+#endif
+            vp->v_flag |= VFHASH;
         }
+        ph[i] = vp->v_hash;
+        vp = vscreen[i];
+        if (vp->v_flag & VFCHG)
+            vh[i] = row_hash(vp, !!(vp->v_flag & VFREQ),
+#if COLOR
+                 vp->v_rfcolor, vp->v_rbcolor);
+#else
+                 0, 0);
+#endif
+        else
+            vh[i] = ph[i];
     }
 
-    if (first < 0) return FALSE;    /* No text changes */
-
-    vpv = vscreen[first];
-    vpp = pscreen[first];
-
-    if (inserts) {          /* determine types of potential scrolls */
-        end = endofline(vpv->v_text, cols);
-        if (end == 0)
-            target = first;         /* newlines */
-        else if (grapheme_same_array(vpp->v_text, vpv->v_text, end))
-            target = first + 1;     /* broken line newlines */
-        else
-            target = first;
-    }
-    else target = first + 1;
-
-/* Find the matching shifted area */
-    match = -1;
-    longmatch = -1;
-    longcount = 0;
-    from = target;
-    for (i = from + 1; i < rows - longcount /* P.K. */ ; i++) {
-        if (inserts ? texttest(i, from) : texttest(from, i)) {
-            match = i;
-            count = 1;
-            for (j = match + 1, k = from + 1;
-                  j < rows && k < rows; j++, k++) {
-                if (inserts? texttest(j, k): texttest(k, j)) count++;
-                else break;
+/* mcost[i][j] is the least cost of getting the first i rows wanted from
+ * the first j there, with row i-1 being row j-1 kept, xcost[] that for
+ * any other way. mfrom[] and xfrom[] note how we got there.
+ */
+    n1 = rows + 1;
+    mcost = Xmalloc(n1*n1*sizeof(int));
+    xcost = Xmalloc(n1*n1*sizeof(int));
+    mfrom = Xmalloc(n1*n1);
+    xfrom = Xmalloc(n1*n1);
+#define SC_IX(i, j) ((i)*n1 + (j))
+#define SC_BEST(i, j) \
+    (mcost[SC_IX(i, j)] < xcost[SC_IX(i, j)]? mcost[SC_IX(i, j)]: xcost[SC_IX(i, j)])
+    for (i = 0; i <= rows; i++) {
+        for (j = 0; j <= rows; j++) {
+            int ix = SC_IX(i, j);
+            int c;
+            mcost[ix] = INT_MAX/2;
+            if (i > 0 && j > 0 && vh[i-1] == ph[j-1]) {
+                d = abs(i - j);
+                mcost[ix] = mcost[SC_IX(i-1, j-1)];
+                mfrom[ix] = 'm';
+                c = xcost[SC_IX(i-1, j-1)] + (d? SC_RUNCOST + d*SC_ROWCOST: 0);
+                if (c < mcost[ix]) {
+                    mcost[ix] = c;
+                    mfrom[ix] = 'x';
+                }
+            }
+            if (i == 0 && j == 0) {
+                xcost[ix] = 0;
+                continue;
             }
-            if (longcount < count) {
-                longcount = count;
-                longmatch = match;
+            xcost[ix] = INT_MAX/2;
+            if (i > 0) {            /* Draw row i-1 */
+                xcost[ix] = SC_BEST(i-1, j) +
+                     endofline(vscreen[i-1]->v_text, cols) + 1;
+                xfrom[ix] = 'v';
+            }
+            if (j > 0 && SC_BEST(i, j-1) < xcost[ix]) { /* Lose row j-1 */
+                xcost[ix] = SC_BEST(i, j-1);
+                xfrom[ix] = 'p';
             }
         }
     }
-    match = longmatch;
-    count = longcount;
 
-    if (!inserts) {         /* Full kill case? */
-        if (match > 0 && texttest(first, match - 1)) {
-            target--;
-            match--;
-            count++;
+/* Go back through that to see which rows we keep */
+    match = Xmalloc(rows*sizeof(int));
+    i = j = rows;
+    int inm = mcost[SC_IX(i, j)] <= xcost[SC_IX(i, j)];
+    while (i > 0) {
+        int ix = SC_IX(i, j);
+        if (inm) {
+            match[--i] = --j;
+            inm = mfrom[ix] == 'm';
+            continue;
         }
+        if (xfrom[ix] == 'v') match[--i] = -1;
+        else                  --j;
+        inm = mcost[SC_IX(i, j)] <= xcost[SC_IX(i, j)];
     }
+#undef SC_BEST
+#undef SC_IX
 
-/* Do the scroll */
-    if (match > 0 && count > 2) {   /* got a scroll */
-/* Move the count lines starting at target to match */
-        if (inserts) {
-            from = target;
-            to = match;
-        }
-        else {
-            from = match;
-            to = target;
-        }
-        if (2 * count < abs(from - to)) return FALSE;
-        scrscroll(from, to, count);
-        for (i = 0; i < count; i++) {
-            vpp = pscreen[to + i];
-            vpv = vscreen[to + i];
-            memcpy(vpp->v_text, vpv->v_text, sizeof(struct grapheme)*cols);
-            vpp->v_flag = vpv->v_flag;      /* XXX */
-            if (vpp->v_flag & VFREV) {
-                vpp->v_flag &= ~VFREV;
-                vpp->v_flag |= ~VFREQ;
+/* Now do the scrolls. Those moving rows up are done from the top down,
+ * then those moving rows down from the bottom up, so that no scroll
+ * disturbs the rows of one yet to be done (or the result of one done).
+ */
+    did = FALSE;
+    for (int pass = 0; pass < 2; pass++) {
+        i = (pass == 0)? 0: rows - 1;
+        while (i >= 0 && i < rows) {
+            int first = i, last = i;
+            if (match[i] >= 0) {        /* Find the run in that direction */
+                if (pass == 0)
+                    while (last + 1 < rows && match[last + 1] == match[last] + 1)
+                        last++;
+                else
+                    while (first > 0 && match[first] > 0 &&
+                         match[first - 1] == match[first] - 1)
+                        first--;
+                d = first - match[first];
+                if ((pass == 0 && d < 0) || (pass == 1 && d > 0)) {
+                    scrscroll(match[first], first, last - first + 1);
+                    scrmove(match[first], first, last - first + 1);
+                    did = TRUE;
+                }
             }
-#if MEMMAP
-            vscreen[to + i]->v_flag &= ~VFCHG;
-#endif
-        }
-        if (inserts) {
-            from = target;
-            to = match;
-        }
-        else {
-            from = target + count;
-            to = match + count;
-        }
-#if MEMMAP == 0
-        for (i = from; i < to; i++) {
-            struct grapheme *txt;
-            txt = pscreen[i]->v_text;
-/* This is a pscreen, so set the no_free flag */
-            for (j = 0; j < term.t_ncol; ++j) set_grapheme(txt+j, ' ', 1);
-            vscreen[i]->v_flag |= VFCHG;
+            i = (pass == 0)? last + 1: first - 1;
         }
-#endif
-        return TRUE;
     }
-    return FALSE;
+
+    free(vh);
+    free(ph);
+    free(mcost);
+    free(xcost);
+    free(mfrom);
+    free(xfrom);
+    free(match);
+    return did;
 }
 
 /* Move the "count" lines starting at "from" to "to" */
@@ -954,25 +1267,13 @@ static void scrscroll(int from, int to, int count) {
     (*term.t_scroll) (from, to, count);
 }
 
-/*
- * return TRUE on text match
- *
- * int vrow, prow;              virtual, physical rows
- */
-static int texttest(int vrow, int prow) {
-    struct video *vpv = vscreen[vrow];      /* virtual screen image */
-    struct video *vpp = pscreen[prow];      /* physical screen image */
-
-    return grapheme_same_array(vpv->v_text, vpp->v_text, term.t_ncol);
-}
-
 /*
  * return the index of the first blank of trailing whitespace
  */
-static int endofline(struct grapheme *s, int n) {
+static int endofline(unicode_t *s, int n) {
     int i;
     for (i = n - 1; i >= 0; i--)
-        if (!is_space(s+i)) return i + 1;
+        if (s[i] != ' ') return i + 1;
     return 0;
 }
 
@@ -1006,10 +1307,10 @@ static void updext(void) {
 /* And put a '$' in column 1. but if this is a multi-width character we also
  * need to change any following NULs to spaces
  */
-    int cw = utf8proc_charwidth(vscreen[currow]->v_text[0].uc);
-    set_grapheme(&(vscreen[currow]->v_text[0]), '$', 0);
+    int cw = utf8proc_charwidth(cell_base(vscreen[currow]->v_text[0]));
+    vscreen[currow]->v_text[0] = '$';
     for (int pcol = cw - 1; pcol > 0; pcol--) {
-        set_grapheme(&(vscreen[currow]->v_text[pcol]), ' ', 0);
+        vscreen[currow]->v_text[pcol] = ' ';
     }
 }
 
@@ -1023,18 +1324,8 @@ static void updext(void) {
 /*      UPDATELINE specific code for the IBM-PC and other compatibles */
 
 static int updateline(int row, struct video *vp1, struct video *vp2) {
-    struct grapheme *cp1;
-    struct grapheme *cp2;
-    int nch;
-
-    cp1 = &vp1->v_text[0];
-    cp2 = &vp2->v_text[0];
-    nch = term.t_ncol;
-    do {
-        clone_grapheme(cp2, cp1);
-        ++cp2;
-        ++cp1;
-    } while (--nch);
+    vp2->v_flag &= ~VFHASH;
+    memcpy(vp2->v_text, vp1->v_text, term.t_ncol*sizeof(unicode_t));
 #if COLOR
     scwrite(row, vp1->v_text, vp1->v_rfcolor, vp1->v_rbcolor);
     vp1->v_fcolor = vp1->v_rfcolor;
@@ -1057,11 +1348,12 @@ static int updateline(int row, struct video *vp1, struct video *vp2) {
  * struct video *vp2;   physical screen image
  */
 static int updateline(int row, struct video *vp1, struct video *vp2) {
+    vp2->v_flag &= ~VFHASH;         /* We're about to change it */
 #if RAINBOW
 /* UPDATELINE specific code for the DEC rainbow 100 micro  */
 
-    struct grapheme *cp1;
-    struct grapheme *cp2;
+    unicode_t *cp1;
+    unicode_t *cp2;
     int nch;
 
 /* Since we don't know how to make the rainbow do this, turn it off */
@@ -1081,11 +1373,11 @@ static int updateline(int row, struct video *vp1, struct video *vp2) {
 #else
 /* UPDATELINE code for all other versions          */
 
-    struct grapheme *cp1;
-    struct grapheme *cp2;
-    struct grapheme *cp3;
-    struct grapheme *cp4;
-    struct grapheme *cp5;
+    unicode_t *cp1;
+    unicode_t *cp2;
+    unicode_t *cp3;
+    unicode_t *cp4;
+    unicode_t *cp5;
     int nbflag;             /* non-blanks to the right flag? */
     int rev;                /* reverse video flag */
     int req;                /* reverse video request flag */
@@ -1121,8 +1413,8 @@ static int updateline(int row, struct video *vp1, struct video *vp2) {
  */
         cp3 = &vp1->v_text[term.t_ncol];
         while (cp1 < cp3) {
-            TTputgrapheme(cp1);
-            clone_grapheme(cp2++, cp1++);
+            TTputcell(*cp1);
+            *cp2++ = *cp1++;
         }
         if (rev != req)     /* turn rev video off */
             (*term.t_rev) (FALSE);
@@ -1139,12 +1431,6 @@ static int updateline(int row, struct video *vp1, struct video *vp2) {
     }
 #endif
 
-/* Advance past any common chars at the left */
-    while (cp1 != &vp1->v_text[term.t_ncol] && grapheme_same(cp1, cp2)) {
-        ++cp1;
-        ++cp2;
-    }
-
 /* This can still happen, even though we only call this routine on changed
  * lines. A hard update is always done when a line splits, a massive
  * change is done, or a buffer is displayed twice. This optimizes out most
@@ -1152,20 +1438,26 @@ static int updateline(int row, struct video *vp1, struct video *vp2) {
  * be hard operations that do a lot of update, so I don't really care.
  */
 /* If both lines are the same, no update needs to be done */
-    if (cp1 == &vp1->v_text[term.t_ncol]) {
+    if (!memcmp(cp1, cp2, term.t_ncol*sizeof(unicode_t))) {
         vp1->v_flag &= ~VFCHG;      /* Flag this line is changed */
         return TRUE;
     }
 
+/* Advance past any common chars at the left */
+    while (*cp1 == *cp2) {
+        ++cp1;
+        ++cp2;
+    }
+
 /* Find out if there is a match on the right */
     nbflag = FALSE;
     cp3 = &vp1->v_text[term.t_ncol];
     cp4 = &vp2->v_text[term.t_ncol];
 
-    while (grapheme_same(&(cp3[-1]), &(cp4[-1]))) {
+    while (cp3[-1] == cp4[-1]) {
         --cp3;
         --cp4;
-        if (!is_space(&(cp3[0])))   /* Note if any nonblank */
+        if (cp3[0] != ' ')          /* Note if any nonblank */
             nbflag = TRUE;          /* in right match. */
     }
 
@@ -1173,7 +1465,7 @@ static int updateline(int row, struct video *vp1, struct video *vp2) {
 
 /* Erase to EOL ? */
     if (nbflag == FALSE && eolexist == TRUE && (req != TRUE)) {
-        while (cp5 != cp1 && is_space(&(cp5[-1]))) --cp5;
+        while (cp5 != cp1 && cp5[-1] == ' ') --cp5;
 
         if (cp3 - cp5 <= 3)         /* Use only if erase is */
             cp5 = cp3;              /* fewer characters. */
@@ -1185,14 +1477,13 @@ static int updateline(int row, struct video *vp1, struct video *vp2) {
 #endif
 
     while (cp1 != cp5) {    /* Ordinary. */
-        TTputgrapheme(cp1);
-        clone_grapheme(cp2++, cp1++);
+        TTputcell(*cp1);
+        *cp2++ = *cp1++;
     }
 
     if (cp5 != cp3) {       /* Erase. */
         TTeeol();
-        while (cp1 != cp3)
-            clone_grapheme(cp2++, cp1++);
+        while (cp1 != cp3) *cp2++ = *cp1++;
     }
 #if REVSTA
     TTrev(FALSE);
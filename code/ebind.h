@@ -107,8 +107,10 @@ struct key_tab_init init_keytab[] = {
     {CTLX|'Q',          quote           }, /* alternative */
     {CTLX|'R',          risearch        },
     {CTLX|'S',          fisearch        },
+    {CTLX|'U',          undo            },
     {CTLX|'W',          resize          },
     {CTLX|'X',          nextbuffer      },
+    {CTLX|'Y',          redo            },
     {CTLX|'Z',          enlargewind     },
     {META|CONTROL|'C',  wordcount       },
     {META|CONTROL|'E',  execproc        },
@@ -170,6 +172,7 @@ struct key_tab_init init_keytab[] = {
     {SPEC|'f',          gotobob         },
     {SPEC|'h',          help            },
     {SPEC|'i',          cex             },
+    {PASTEKEY,          bracketed_paste },
 #endif
 
     {0x7F,              backdel         },
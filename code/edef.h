@@ -53,11 +53,8 @@ extern int abortc;              /* current abort command char   */
 
 extern int tabmask;
 extern char *cname[];           /* names of colors              */
-extern struct kill *kbufp;      /* current kill buffer chunk pointer */
 #define KRING_SIZE 10
-extern struct kill *kbufh[KRING_SIZE];
-                                /* kill buffer header pointers  */
-extern int kused[KRING_SIZE];   /* # of bytes used in KB        */
+extern struct kill kbuf[KRING_SIZE];    /* the kill ring        */
 extern struct window *swindow;  /* saved window pointer         */
 extern int cryptflag;           /* currently encrypting?        */
 extern int *kbdptr;             /* current position in keyboard buf */
@@ -142,6 +139,11 @@ extern int hscroll;             /* TRUE when we are scrolling horizontally */
 extern int hjump;               /* How much to jump on horizontal scroll */
 extern int autodos;             /* Auto-detect DOS file on read if set */
 extern int showdir_tokskip;     /* Tokens to skip in showdir parsing */
+extern int magic_dfa;           /* MAGIC search uses regex.c, not amatch() */
+extern int search_threads;      /* Threads for a parallel search (psearch.c) */
+extern int max_fps;             /* Most screen updates/sec with typeahead */
+extern int undo_budget;         /* Bytes of undo records kept per buffer */
+extern int macro_profile;       /* Profiling macros (profile.c) */
 
 extern const char kbdmacro_buffer[];    /* Name of the keyboard macro buffer */
 extern struct buffer *kbdmac_bp;    /* keyboard macro buffer */
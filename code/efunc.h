@@ -27,6 +27,7 @@ extern int fillpara(int f, int n);
 extern int justpara(int f, int n);
 extern int killpara(int f, int n);
 extern int wordcount(int f, int n);
+extern long count_words(struct line *, int, int);
 extern int makelist_region(int, int);
 extern int numberlist_region(int, int);
 
@@ -147,6 +148,7 @@ extern void vtfree(void);
 extern void vttidy(void);
 extern void vtmove(int row, int col);
 extern int upscreen(int f, int n);
+extern int update_due(void);
 extern int update(int force);
 extern void updpos(void);
 extern void upddex(void);
@@ -184,6 +186,7 @@ extern void ttclose(void);
 extern int ttputc(int c);
 extern void ttflush(void);
 extern int ttgetc(void);
+extern char *ttgetpaste(int *lenp);
 extern int typahead(void);
 
 /* input.c */
@@ -194,6 +197,7 @@ extern struct name_bind *getname(char *);
 extern int tgetc(void);
 extern int get1key(void);
 extern int getcmd(void);
+extern int bracketed_paste(int f, int n);
 extern int getstring(char *, char *, int , enum cmplt_type);
 
 /* bind.c */
@@ -221,6 +225,7 @@ extern int killbuffer(int f, int n);
 extern int zotbuf(struct buffer *bp);
 extern int namebuffer(int f, int n);
 extern int listbuffers(int f, int n);
+extern int showbuffer(struct buffer *);
 extern int anycb(void);
 extern int bclear(struct buffer *bp);
 extern int unmark(int f, int n);
@@ -256,9 +261,11 @@ extern int namedcmd(int f, int n);
 extern int execcmd(int f, int n);
 extern char *token(char *src, char *tok, int size);
 extern int macarg(char *tok);
+extern int macarg_val(struct value *);
 extern int nextarg(char *, char *, int, enum cmplt_type);
 extern int storemac(int f, int n);
 extern void ptt_free(struct buffer *);
+extern void proc_free(struct buffer *);
 extern int storepttable(int, int);
 extern int set_pttable(int, int);
 extern int next_pttable(int, int);
@@ -342,11 +349,53 @@ extern int qreplace(int f, int n);
 extern int expandp(char *srcstr, char *deststr, int maxlength);
 extern int boundry(struct line *curline, int curoff, int dir);
 extern void mcclear(void);
+extern int occur(int f, int n);
+extern int occur_goto(int f, int n);
+extern void litprep(struct litpat *, const char *, int);
+extern int litfwd(const struct litpat *, const char *, int, int);
+extern int litback(const struct litpat *, const char *, int);
+extern void litfound(struct line *, int, int, int, int);
+
+/* regex.c */
+struct regex;
+extern struct regex *rx_compile(char *, int);
+extern void rx_free(struct regex *);
+extern int rx_same(struct regex *, char *, int);
+extern int rx_search(struct regex *, int, struct line **, int *,
+     struct line **, int *, int *);
+
+/* profile.c */
+extern unsigned int prof_generation;
+extern long long prof_now(void);
+extern void prof_reset(void);
+extern int prof_entry(char *, int, char *);
+extern void prof_add(int, unsigned int, long long);
+extern int prof_call(struct name_bind *, int, int);
+extern int listprofile(int f, int n);
+
+/* psearch.c */
+extern int parsearch(const char *, int, int, int *);
+
+/* undo.c */
+extern void undo_boundary(void);
+extern void undo_typed(void);
+extern void undo_ins_start(void);
+extern void undo_ins_end(void);
+extern void undo_del_start(void);
+extern void undo_delete(const char *, int);
+extern void undo_del_end(void);
+extern void undo_replace(struct line *, int, int, int);
+extern void undo_replace_start(struct buffer *);
+extern void undo_replace_end(struct buffer *);
+extern void undo_clear(struct buffer *);
+extern int undo(int f, int n);
+extern int redo(int f, int n);
 
 /* isearch.c */
 extern int risearch(int f, int n);
 extern int fisearch(int f, int n);
 extern int isearch(int f, int n);
+extern void reeat(int c);
 
 /* eval.c */
 extern void varinit(void);
@@ -354,11 +403,19 @@ extern void init_envvar_index(void);
 extern int nxti_envvar(int);
 extern void sort_user_var(void);
 extern int nxti_usrvar(int);
+extern int uv_local(char *, char **);
+extern void uv_unlocal(int, char *);
 extern int stol(char *);
 extern int setvar(int, int);
 extern char *ue_itoa(int);
 extern int gettyp(char *);
 extern char *getval(char *);
+extern struct value *getvalue(char *, int *, struct value *);
+extern void val_free(struct value *);
+extern void val_own(struct value *);
+extern char *val_str(struct value *);
+extern int val_int(struct value *);
+extern int val_log(struct value *);
 
 /* crypt.c */
 extern int set_encryption_key(int f, int n);
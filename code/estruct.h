@@ -10,6 +10,8 @@
 #ifndef ESTRUCT_H_
 #define ESTRUCT_H_
 
+#include <stddef.h>
+#include <sys/types.h>
 #include "utf8.h"
 
 #define MAXCOL  500
@@ -178,12 +180,13 @@
 #define HUGE    1000            /* Huge number                  */
 #define NLOCKS  100             /* max # of file locks active   */
 #define NCOLORS 8               /* number of supported colors   */
-#define KBLOCK  250             /* sizeof kill buffer chunks    */
+#define KBLOCK  256             /* first size of a kill buffer  */
 
 #define CONTROL 0x10000000      /* Control flag, or'ed in       */
 #define META    0x20000000      /* Meta flag, or'ed in          */
 #define CTLX    0x40000000      /* ^X flag, or'ed in            */
 #define SPEC    0x80000000      /* special key (function keys)  */
+#define PASTEKEY (SPEC|'~')    /* start of a bracketed paste   */
 
 #ifdef  FALSE
 #undef  FALSE
@@ -224,8 +227,9 @@ enum cmplt_type {
 #define DBREAK          8
 #define DFORCE          9
 #define DFINISH        10       /* GGR */
+#define DLOCAL         11
 
-#define NUMDIRS         11      /* GGR */
+#define NUMDIRS         12
 
 /*
  * PTBEG, PTEND, FORWARD, and REVERSE are all toggle-able values for
@@ -379,6 +383,23 @@ struct ptt_ent {
     char display_code[32];      /* Only 2 graphemes, though */
 };
 
+/* Blocks of text which lines in a buffer may point into, rather than
+ * holding their own copy of their text. A file is read into one of these
+ * in a single read (or mmap()ed as one) and the lines then just reference
+ * it, so there is no per-line copy or allocation of the text. They are
+ * only released when the buffer is cleared.
+ * For a mapped block we remember which file it is, so that we can take
+ * a copy before that file is overwritten.
+ */
+struct text_block {
+    struct text_block *tb_next;
+    char *tb_text;          /* The text                     */
+    size_t tb_len;          /* Its length                   */
+    int tb_mapped;          /* mmap()ed, not Xmalloc()ed    */
+    dev_t tb_dev;           /* File it is mapped from       */
+    ino_t tb_ino;
+};
+
 /* Structure for function/buffer-proc options */
 struct func_opts {
      unsigned int skip_in_macro :1;
@@ -393,6 +414,11 @@ struct buffer {
     struct line *b_topline; /* Link to narrowed top text    */
     struct line *b_botline; /* Link to narrowed bottom text */
     struct ptt_ent *ptt_headp;
+    struct text_block *b_store; /* Shared text for lines */
+    struct line_arena *b_arena; /* Where its lines live */
+    struct lindex *b_lindex;    /* Line number index */
+    struct undo_log *b_undo;    /* Undo/redo records (undo.c) */
+    struct mac_prog *b_prog;    /* Compiled procedure (exec.c) */
     int b_type;             /* Type of buffer */
     struct func_opts btp_opt;   /* Only for b_type = BTPROC */
     int b_exec_level;       /* Recursion level */
@@ -529,15 +555,16 @@ struct name_bind {
     struct func_opts opt;
 };
 
-/* The editor holds deleted text chunks in the struct kill buffer. The
- * kill buffer is logically a stream of ascii characters, however
- * due to its unpredictable size, it gets implemented as a linked
- * list of chunks. (The d_ prefix is for "deleted" text, as k_
- * was taken up by the keycode structure).
+/* The editor holds deleted text in the struct kill buffers of the kill
+ * ring. Each is one contiguous block of text, which is doubled in size
+ * whenever it needs to grow, so killed text can be appended to it (and
+ * yanked back from it) with a memcpy. (The d_ prefix is for "deleted"
+ * text, as k_ was taken up by the keycode structure).
  */
 struct kill {
-    struct kill *d_next;   /* Link to next chunk, NULL if last. */
-    char d_chunk[KBLOCK];  /* Deleted text. */
+    char *d_text;          /* Deleted text (NULL if none yet) */
+    int d_used;            /* Bytes of it in use */
+    int d_size;            /* Bytes allocated */
 };
 
 /* When emacs' command interpreter needs to get a variable's name,
@@ -549,18 +576,32 @@ struct variable_description {
     int v_num;   /* Ordinal pointer to variable in list. */
 };
 
-/* The !WHILE directive in the execution language needs to
- * stack references to pending whiles. These are stored linked
- * to each currently open procedure via a linked list of
- * the following structure.
-*/
-struct while_block {
-    struct line *w_begin;        /* ptr to !while statement */
-    struct line *w_end;          /* ptr to the !endwhile statement */
-    int w_type;                  /* block type */
-    struct while_block *w_next;  /* next while */
+/* The expression evaluator (eval.c) passes values around in a value
+ * structure, so numbers and logicals don't have to go to text and back
+ * between one function and the next, and strings can be any length.
+ * A string is either in v_buf, which belongs to the value, or borrowed
+ * from wherever it came from (a variable, the macro line...), so is
+ * only good until that changes. val_str() gives any value as text.
+ */
+#define VT_INT  0       /* v_int is a number */
+#define VT_LOG  1       /* v_int is TRUE or FALSE */
+#define VT_STR  2       /* v_str is a string of v_len bytes (+ NUL) */
+
+struct value {
+    int v_type;
+    int v_int;
+    char *v_str;
+    int v_len;
+    char *v_buf;        /* Space belonging to this value... */
+    int v_size;         /* ...and its size */
 };
+#define VALUE_INIT { VT_STR, 0, "", 0, NULL, 0 }
 
+/* The !WHILE directive in the execution language needs each !while,
+ * and any !break within it, paired with its !endwhile. This is done
+ * once, when dobuf() compiles the buffer (see struct mac_prog in exec.c),
+ * which uses these block types while doing so.
+*/
 #define BTWHILE         1
 #define BTBREAK         2
 
@@ -665,6 +706,18 @@ struct magic_replacement {
     char *rstr;
 };
 
+/* A literal search pattern with no newline in it, set up by litprep()
+ * for a Boyer-Moore-Horspool search within a line's text.
+ */
+struct litpat {
+    unsigned char lp_pat[NPAT];     /* Pattern, forwards and case-folded */
+    int lp_len;
+    int lp_exact;                   /* No case-folding */
+    unsigned char lp_fold[256];     /* Case-folding of each byte */
+    int lp_fskip[256];              /* Skips for a forward search... */
+    int lp_bskip[256];              /* ...and for a reverse one */
+};
+
 /* Max #chars in a var name. */
 #define NVSIZE  32
 
@@ -681,7 +734,8 @@ enum ev_val {
     EVSCROLL,   EVINMB,     EVFCOL,     EVHJUMP,    EVHSCROLL,
 /* GGR */
     EVYANKMODE, EVAUTOCLEAN, EVREGLTEXT, EVREGLNUM, EVAUTODOS,
-    EVSDTKSKIP,
+    EVSDTKSKIP, EVLMEMLIVE, EVLMEMWASTE, EVLMEMSLABS, EVMAGICDFA,
+    EVSRCHTHREADS, EVMAXFPS, EVUNDOBUDGET, EVCLOCK, EVPROFILE,
 };
 struct evlist {
     char *var;
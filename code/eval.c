@@ -7,6 +7,7 @@
  */
 
 #include <stdio.h>
+#include <time.h>
 
 #include "estruct.h"
 #include "edef.h"
@@ -19,35 +20,304 @@
 #include <stddef.h>
 #include "idxsorter.h"
 
-#define MAXVARS 255
+/* Convert a string to a numeric logical
+ * Used by exec.c
+ *
+ * char *val;           value to check for stol
+ */
+int stol(char *val) {
+/* check for logical values */
+    if (val[0] == 'F') return FALSE;
+    if (val[0] == 'T') return TRUE;
+
+/* check for numeric truth (!= 0) */
+    return (atoi(val) != 0);
+}
 
-/* Return some of the contents of the kill buffer
+/* Numeric logical to string logical
+ *
+ * int val;             value to translate
  */
-static char *getkill(void) {
-    int size;                       /* max number of chars to return */
-    static char value[NSTRING];     /* fixed buffer for value */
+static char *ltos(int val) {
+    if (val) return truem;
+    else     return falsem;
+}
 
-    if (kbufh[0] == NULL)
-                /* no kill buffer....just a null string */
-        value[0] = 0;
-    else {      /* copy in the contents...allow for a trailing NUL */
-        if (kused[0] < NSTRING) size = kused[0];
-        else                    size = NSTRING - 1;
-        memcpy(value, kbufh[0]->d_chunk, size);
-        *(value+size) = '\0';
+/* Values (see struct value in estruct.h).
+ * The setters return the value, so gtenv() etc. can just return them.
+ */
+
+/* Make sure the space belonging to a value can hold size bytes, and
+ * return it. Anything in it is lost.
+ */
+static char *val_room(struct value *vp, int size) {
+    if (size > vp->v_size) {
+        free(vp->v_buf);
+        vp->v_buf = Xmalloc(size);
+        vp->v_size = size;
+    }
+    return vp->v_buf;
+}
+
+static struct value *set_int(struct value *vp, int i) {
+    vp->v_type = VT_INT;
+    vp->v_int = i;
+    return vp;
+}
+
+static struct value *set_log(struct value *vp, int b) {
+    vp->v_type = VT_LOG;
+    vp->v_int = b? TRUE: FALSE;
+    return vp;
+}
+
+/* Borrow a string */
+static struct value *set_str(struct value *vp, char *str) {
+    vp->v_type = VT_STR;
+    vp->v_str = str;
+    vp->v_len = strlen(str);
+    return vp;
+}
+
+/* The first len bytes in the value's own space are its string */
+static struct value *set_own(struct value *vp, int len) {
+    vp->v_type = VT_STR;
+    vp->v_str = vp->v_buf;
+    vp->v_len = len;
+    vp->v_buf[len] = '\0';
+    return vp;
+}
+
+/* Copy len bytes of str as the value's string.
+ * str may be in the value's own space already.
+ */
+static struct value *set_mem(struct value *vp, char *str, int len) {
+    memmove(val_room(vp, len + 1), str, len);
+    return set_own(vp, len);
+}
+
+/* Free the space belonging to a value */
+void val_free(struct value *vp) {
+    free(vp->v_buf);
+    vp->v_buf = NULL;
+    vp->v_size = 0;
+    set_str(vp, "");
+}
+
+/* Copy a borrowed string into the value's own space */
+void val_own(struct value *vp) {
+    if (vp->v_type == VT_STR && vp->v_str != vp->v_buf)
+        set_mem(vp, vp->v_str, vp->v_len);
+}
+
+/* A value as text */
+char *val_str(struct value *vp) {
+    switch (vp->v_type) {
+    case VT_INT:
+        return strcpy(val_room(vp, INTWIDTH + 1), ue_itoa(vp->v_int));
+    case VT_LOG:
+        return ltos(vp->v_int);
+    }
+    return vp->v_str;
+}
+
+/* A value as a number.
+ * As text, TRUE and FALSE have always read as 0, so still do.
+ */
+int val_int(struct value *vp) {
+    switch (vp->v_type) {
+    case VT_INT:
+        return vp->v_int;
+    case VT_LOG:
+        return 0;
     }
-    return value;       /* Return the constructed value */
+    return atoi(vp->v_str);
 }
 
+/* A value as a logical */
+int val_log(struct value *vp) {
+    switch (vp->v_type) {
+    case VT_INT:
+        return vp->v_int != 0;
+    case VT_LOG:
+        return vp->v_int;
+    }
+    return stol(vp->v_str);
+}
+
+/* The length of a value as text */
+static int val_len(struct value *vp) {
+    if (vp->v_type == VT_STR) return vp->v_len;
+    return strlen(val_str(vp));
+}
+
+
+/* User variables.
+ * The table grows as needed and names are found through an open hash
+ * (as for gr_intern() in display.c). There is no way to remove a
+ * variable, so its index in uv[] (its "slot") stays valid.
+ */
+
+static struct user_variable *uv;
+static int uv_count, uv_alloc;
+static int *uv_hash;            /* Open hash of uv index + 1 */
+static int uv_hsize;            /* A power of 2 */
 
-/* User variables. External as used by completion code in input.c */
+/* The environment variables are fixed, but are found the same way */
+static int *ev_hash;            /* Open hash of evl index + 1 */
+static int ev_hsize;
 
-struct user_variable uv[MAXVARS + 1];
+static unsigned int var_hashof(char *name) {
+    unsigned int h = 2166136261u;
+    while (*name) h = (h ^ (unsigned char)*name++) * 16777619u;
+    return h;
+}
 
 /* Initialize the user variable list. */
 void varinit(void) {
+    uv_count = 0;
+}
+
+/* Look up a user var's slot in uv[].
+ * Returns -1 if there is no such variable (yet).
+ *
+ * char *vname;                 name of user variable to find
+ */
+static int usr_slot(char *vname) {
+    unsigned int hi;
+    int i;
+
+    if (uv_hsize == 0) return -1;
+    for (hi = var_hashof(vname); (i = uv_hash[hi & (uv_hsize - 1)]); hi++)
+        if (strcmp(vname, uv[i - 1].u_name) == 0) return i - 1;
+    return -1;
+}
+
+/* Look up a user var's slot in uv[], creating it (with an empty value)
+ * if it doesn't exist.
+ *
+ * char *vname;                 name of user variable (at most NVSIZE)
+ */
+static int usr_create(char *vname) {
+    unsigned int hi;
     int i;
-    for (i = 0; i < MAXVARS; i++) uv[i].u_name[0] = 0;
+
+    if ((i = usr_slot(vname)) >= 0) return i;
+    if (2*(uv_count + 1) >= uv_hsize) {         /* (Re)build the hash */
+        uv_hsize = uv_hsize? 2*uv_hsize: 64;
+        free(uv_hash);
+        uv_hash = Xmalloc(uv_hsize*sizeof(int));
+        memset(uv_hash, 0, uv_hsize*sizeof(int));
+        for (i = 0; i < uv_count; i++) {
+            hi = var_hashof(uv[i].u_name);
+            while (uv_hash[hi & (uv_hsize - 1)]) hi++;
+            uv_hash[hi & (uv_hsize - 1)] = i + 1;
+        }
+    }
+    if (uv_count == uv_alloc) {
+        uv_alloc = uv_alloc? 2*uv_alloc: 64;
+        uv = Xrealloc(uv, uv_alloc*sizeof(struct user_variable));
+    }
+    strcpy(uv[uv_count].u_name, vname);
+    uv[uv_count].u_type = VT_STR;
+    uv[uv_count].u_value = Xmalloc(1);
+    uv[uv_count].u_value[0] = '\0';
+    uv[uv_count].u_len = 0;
+    uv[uv_count].u_size = 1;
+    hi = var_hashof(vname);
+    while (uv_hash[hi & (uv_hsize - 1)]) hi++;
+    uv_hash[hi & (uv_hsize - 1)] = uv_count + 1;
+    return uv_count++;
+}
+
+/* Set a user variable's value.
+ * Numbers and logicals are kept as they are, and only turned into text
+ * if that is needed (by uv_local()). Strings re-use the variable's space
+ * if it is big enough - which it is if the string is (part of) what the
+ * variable already held.
+ *
+ * int vnum;                    slot of user variable
+ * struct value *val;           value to set
+ */
+static void usr_set(int vnum, struct value *val) {
+    struct user_variable *vp = uv + vnum;
+
+    vp->u_type = val->v_type;
+    if (val->v_type != VT_STR) {
+        vp->u_int = val->v_int;
+        vp->u_len = -1;
+        return;
+    }
+    if (val->v_len >= vp->u_size) {
+        free(vp->u_value);
+        vp->u_size = val->v_len + 1;
+        vp->u_value = Xmalloc(vp->u_size);
+    }
+    memmove(vp->u_value, val->v_str, val->v_len);
+    vp->u_value[val->v_len] = '\0';
+    vp->u_len = val->v_len;
+}
+
+/* Get a user variable's value.
+ * A string is borrowed from the variable.
+ *
+ * int vnum;                    slot of user variable
+ * struct value *val;           where to put it
+ */
+static struct value *usr_get(int vnum, struct value *val) {
+    struct user_variable *vp = uv + vnum;
+
+    switch (vp->u_type) {
+    case VT_INT:
+        return set_int(val, vp->u_int);
+    case VT_LOG:
+        return set_log(val, vp->u_int);
+    }
+    val->v_type = VT_STR;
+    val->v_str = vp->u_value;
+    val->v_len = vp->u_len;
+    return val;
+}
+
+/* Make a user variable local to a running procedure (see !local in
+ * dobuf()). It is created if need be and emptied, and its current value
+ * handed back, to be put back by uv_unlocal() when the procedure ends.
+ * Returns the variable's slot.
+ *
+ * char *vname;                 name of user variable, without the %
+ * char **saved;                where to put its current value
+ */
+int uv_local(char *vname, char **saved) {
+    int vnum = usr_create(vname);
+    struct user_variable *vp = uv + vnum;
+
+    if (vp->u_len < 0) {        /* Number or logical - make its text */
+        char *tp = (vp->u_type == VT_INT)? ue_itoa(vp->u_int): ltos(vp->u_int);
+        free(vp->u_value);
+        vp->u_value = strdup(tp);
+    }
+    *saved = vp->u_value;
+    vp->u_type = VT_STR;
+    vp->u_value = Xmalloc(1);
+    vp->u_value[0] = '\0';
+    vp->u_len = 0;
+    vp->u_size = 1;
+    return vnum;
+}
+
+/* Put back the value a user variable had before uv_local().
+ *
+ * int vnum;                    slot from uv_local()
+ * char *saved;                 value it handed back
+ */
+void uv_unlocal(int vnum, char *saved) {
+    struct user_variable *vp = uv + vnum;
+
+    free(vp->u_value);
+    vp->u_type = VT_STR;
+    vp->u_value = saved;
+    vp->u_len = strlen(saved);
+    vp->u_size = vp->u_len + 1;
 }
 
 
@@ -95,36 +365,23 @@ int nxti_envvar(int ci) {
 /* User var (%...) sorting. Different - just build a sorted name array
  * of the names which exist.
  * We don't actually need the values for getf/nvar() in input.c
+ * The names point into uv[], so this must be rebuilt after any variable
+ * is created.
  */
 
-char *uvnames[MAXVARS + 1];
+char **uvnames = NULL;
 static int n_uvn;
 
-void sort_user_var(void) {
-    n_uvn = 0;
-    for (int i = 0; i < MAXVARS; i++) {
-
-/* There is currently no mechanism for removing a user variable
- * once it has been created, so as soon as we reach an empty entry
- * we've found all active ones.
- * If a "del_user_var" functionality ever existed the break below would
- * (probably) need to be a continue.
- */
-        if (uv[i].u_name[0] == '\0') break;
+static int uvname_cmp(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
 
-/* Need to add this one into uvnames in alphabetic order and push any
- * followers down.
- */
-        char *toadd = uv[i].u_name;
-        for (int j = 0; j < n_uvn; j++) {
-            if (strcmp(toadd, uvnames[j]) >= 0) continue;
-            char *xp = uvnames[j];
-            uvnames[j] = toadd;
-            toadd = xp;
-        }
-        uvnames[n_uvn] = toadd;
-        uvnames[++n_uvn] = NULL;
-    }
+void sort_user_var(void) {
+    uvnames = Xrealloc(uvnames, (uv_count + 1)*sizeof(char *));
+    for (n_uvn = 0; n_uvn < uv_count; n_uvn++)
+        uvnames[n_uvn] = uv[n_uvn].u_name;
+    uvnames[n_uvn] = NULL;
+    qsort(uvnames, n_uvn, sizeof(char *), uvname_cmp);
     return;
 }
 
@@ -137,29 +394,6 @@ int nxti_usrvar(int ci) {
     return -1;
 }
 
-/* Convert a string to a numeric logical
- * Used by exec.c
- *
- * char *val;           value to check for stol
- */
-int stol(char *val) {
-/* check for logical values */
-    if (val[0] == 'F') return FALSE;
-    if (val[0] == 'T') return TRUE;
-
-/* check for numeric truth (!= 0) */
-    return (atoi(val) != 0);
-}
-
-/* Numeric logical to string logical
- *
- * int val;             value to translate
- */
-static char *ltos(int val) {
-    if (val) return truem;
-    else     return falsem;
-}
-
 /* Make a string lower case
  * Internal to this routine - only needs to handle ASCII as it is only
  * used for the function names defined for this code.
@@ -219,12 +453,12 @@ static int sindex(char *source, char *pattern) {
  * char *source;        string to filter
  * char *lookup;        characters to translate
  * char *trans;         resulting translated characters
+ * char *result;        where to put it (at least as big as source)
  */
-static char *xlat(char *source, char *lookup, char *trans) {
+static char *xlat(char *source, char *lookup, char *trans, char *result) {
     char *sp;       /* pointer into source table */
     char *lp;       /* pointer into lookup table */
     char *rp;       /* pointer into result */
-    static char result[NSTRING];    /* temporary result */
 
 /* Scan source string */
     sp = source;
@@ -248,91 +482,133 @@ static char *xlat(char *source, char *lookup, char *trans) {
     return result;
 }
 
+/* Look a function up in the function table.
+ * Only the first 3 chars are significant, and it may be upper or
+ * lower case.
+ * Returns its index, or -1 if there is no such function.
+ *
+ * @fname: name of function to find.
+ */
+static int fun_slot(char *fname) {
+    char fn[4];
+    int i;
+
+    for (i = 0; i < 3 && fname[i]; i++) fn[i] = fname[i];
+    fn[i] = 0;
+    mklower(fn);
+    for (i = 0; i < (int)ARRAY_SIZE(funcs); i++)
+        if (strcmp(fn, funcs[i].f_name) == 0) return i;
+    return -1;
+}
+
 /* Evaluate a function.
+ * The arguments are fetched as values, so arithmetic on numbers never
+ * goes through text, and strings have no size limit.
  *
- * @fname: name of function to evaluate.
+ * @fnum: index of function to evaluate (from fun_slot()).
+ * @vp: where to put the result.
  */
-static char *gtfun(char *fname) {
-    unsigned int fnum;      /* index to function to eval */
-    int status;             /* return status */
+static struct value *gtfun(unsigned int fnum, struct value *vp) {
+    struct value arg[3] = { VALUE_INIT, VALUE_INIT, VALUE_INIT };
+    int nargs;              /* Number of arguments it takes */
+    int i;
+    char *a1 = NULL;        /* First argument as text... */
+    int len = 0;            /* ...and its length */
+    int ia, ib;             /* Integer workings */
     char *tsp;              /* temporary string pointer */
-    char arg1[NSTRING];     /* value of first argument */
-    char arg2[NSTRING];     /* value of second argument */
-    char arg3[NSTRING];     /* value of third argument */
-    static char result[2 * NSTRING];        /* string result */
     int nb;                 /* Number of bytes in string */
     struct mstr csinfo;     /* Casing info structure */
 
-/* Look the function up in the function table */
-    fname[3] = 0;           /* only first 3 chars significant */
-    mklower(fname);         /* and let it be upper or lower case */
-    for (fnum = 0; fnum < ARRAY_SIZE(funcs); fnum++)
-        if (strcmp(fname, funcs[fnum].f_name) == 0) break;
-
-/* Return errorm on a bad reference */
-    if (fnum == ARRAY_SIZE(funcs)) return errorm;
-
-/* If needed, retrieve the first argument */
-    if (funcs[fnum].f_type >= MONAMIC) {
-        if ((status = macarg(arg1)) != TRUE) return errorm;
-
-/* If needed, retrieve the second argument */
-        if (funcs[fnum].f_type >= DYNAMIC) {
-            if ((status = macarg(arg2)) != TRUE) return errorm;
-
-/* If needed, retrieve the third argument */
-            if (funcs[fnum].f_type >= TRINAMIC)
-                if ((status = macarg(arg3)) != TRUE) return errorm;
+/* Retrieve the arguments it needs */
+    nargs = funcs[fnum].f_type;
+    for (i = 0; i < nargs; i++) {
+        if (macarg_val(arg + i) != TRUE) {
+            set_str(vp, errorm);
+            goto done;
         }
     }
 
+/* Those wanting the text of the first argument need its length too */
+    switch (funcs[fnum].tag) {
+    case UFCAT:     case UFLEFT:    case UFRIGHT:   case UFMID:
+    case UFUPPER:   case UFLOWER:   case UFESCAPE:  case UFLENGTH:
+    case UFXLATE:
+        a1 = val_str(arg);
+        len = val_len(arg);
+    default:
+        break;
+    }
 
 /* And now evaluate it! */
     switch (funcs[fnum].tag) {
-    case UFADD:         return ue_itoa(atoi(arg1) + atoi(arg2));
-    case UFSUB:         return ue_itoa(atoi(arg1) - atoi(arg2));
-    case UFTIMES:       return ue_itoa(atoi(arg1) * atoi(arg2));
-    case UFDIV:         return ue_itoa(atoi(arg1) / atoi(arg2));
-    case UFMOD:         return ue_itoa(atoi(arg1) % atoi(arg2));
-    case UFNEG:         return ue_itoa(-atoi(arg1));
+    case UFADD:     set_int(vp, val_int(arg) + val_int(arg+1)); break;
+    case UFSUB:     set_int(vp, val_int(arg) - val_int(arg+1)); break;
+    case UFTIMES:   set_int(vp, val_int(arg) * val_int(arg+1)); break;
+    case UFDIV:     set_int(vp, val_int(arg) / val_int(arg+1)); break;
+    case UFMOD:     set_int(vp, val_int(arg) % val_int(arg+1)); break;
+    case UFNEG:     set_int(vp, -val_int(arg)); break;
     case UFCAT:
-        strcpy(result, arg1);
-        return strcat(result, arg2);
+        ia = val_len(arg+1);
+        tsp = val_room(vp, len + ia + 1);
+        memcpy(tsp, a1, len);
+        memcpy(tsp + len, val_str(arg+1), ia);
+        set_own(vp, len + ia);
+        break;
+/* The substring functions keep within the string they are given */
     case UFLEFT:
-                       {int reslen = atoi(arg2);
-                        strncpy(result, arg1, reslen);
-                        result[reslen] = '\0';
-                        return result;
-                       }
+        ia = val_int(arg+1);
+        if (ia > len) ia = len;
+        if (ia < 0) ia = 0;
+        set_mem(vp, a1, ia);
+        break;
     case UFRIGHT:
-        return (strcpy(result, &arg1[(strlen(arg1) - atoi(arg2))]));
+        ia = val_int(arg+1);
+        if (ia > len) ia = len;
+        if (ia < 0) ia = 0;
+        set_mem(vp, a1 + len - ia, ia);
+        break;
     case UFMID:
-                       {int reslen = atoi(arg3);
-                        strncpy(result, &arg1[atoi(arg2) - 1], atoi(arg3));
-                        result[reslen] = '\0';
-                        return result;
-                       }
-    case UFNOT:         return ltos(stol(arg1) == FALSE);
-    case UFEQUAL:       return ltos(atoi(arg1) == atoi(arg2));
-    case UFLESS:        return ltos(atoi(arg1) < atoi(arg2));
-    case UFGREATER:     return ltos(atoi(arg1) > atoi(arg2));
-    case UFSEQUAL:      return ltos(strcmp(arg1, arg2) == 0);
-    case UFSLESS:       return ltos(strcmp(arg1, arg2) < 0);
-    case UFSGREAT:      return ltos(strcmp(arg1, arg2) > 0);
-    case UFIND:         return strcpy(result, getval(arg1));
-    case UFAND:         return ltos(stol(arg1) && stol(arg2));
-    case UFOR:          return ltos(stol(arg1) || stol(arg2));
-    case UFLENGTH:      return ue_itoa(strlen(arg1));
+        ia = val_int(arg+1) - 1;
+        ib = val_int(arg+2);
+        if (ia > len) ia = len;
+        if (ia < 0) ia = 0;
+        if (ib > len - ia) ib = len - ia;
+        if (ib < 0) ib = 0;
+        set_mem(vp, a1 + ia, ib);
+        break;
+    case UFNOT:     set_log(vp, val_log(arg) == FALSE); break;
+    case UFEQUAL:   set_log(vp, val_int(arg) == val_int(arg+1)); break;
+    case UFLESS:    set_log(vp, val_int(arg) < val_int(arg+1)); break;
+    case UFGREATER: set_log(vp, val_int(arg) > val_int(arg+1)); break;
+    case UFSEQUAL:
+        set_log(vp, strcmp(val_str(arg), val_str(arg+1)) == 0);
+        break;
+    case UFSLESS:
+        set_log(vp, strcmp(val_str(arg), val_str(arg+1)) < 0);
+        break;
+    case UFSGREAT:
+        set_log(vp, strcmp(val_str(arg), val_str(arg+1)) > 0);
+        break;
+    case UFIND:
+        i = -1;
+        getvalue(val_str(arg), &i, vp);
+        val_own(vp);    /* It may be the text of arg, freed below */
+        break;
+    case UFAND:     set_log(vp, val_log(arg) && val_log(arg+1)); break;
+    case UFOR:      set_log(vp, val_log(arg) || val_log(arg+1)); break;
+    case UFLENGTH:  set_int(vp, len); break;
     case UFUPPER:
     case UFLOWER:
         utf8_recase(funcs[fnum].tag == UFUPPER? UTF8_UPPER: UTF8_LOWER,
-             arg1, -1, &csinfo);
-        strcpy(result, csinfo.str);
-        free(csinfo.str);
-        return(result);
+             a1, -1, &csinfo);
+        free(vp->v_buf);            /* Take over the result */
+        vp->v_buf = csinfo.str;
+        vp->v_size = csinfo.alloc;
+        set_own(vp, csinfo.utf8c);
+        break;
     case UFESCAPE:              /* Only need to escape ASCII chars */
-       {char *ip = arg1;        /* This is SHELL escaping... */
-        char *op = result;
+       {char *ip = a1;          /* This is SHELL escaping... */
+        char *op = val_room(vp, 2*len + 1);
         while (*ip) {
             if (*ip == '\t') {  /* tab - word separator */
                 *op++ = '\\';
@@ -367,174 +643,219 @@ static char *gtfun(char *fname) {
             }
             *op++ = *ip++;
         }
-        *op = '\0';
-        return result;
+        set_own(vp, op - vp->v_buf);
+        break;
        }
-    case UFTRUTH:       return ltos(atoi(arg1) == 42);
-    case UFASCII:       return ue_itoa((int) arg1[0]);
+    case UFTRUTH:   set_log(vp, val_int(arg) == 42); break;
+    case UFASCII:   set_int(vp, (int) val_str(arg)[0]); break;
 /* Allow for unicode as:
  *      decimal codepoint
  *      hex codepoint   (0x...)
  *      U+hex           [0x must be chars 1 and 2]
  */
     case UFCHR:
-        if (arg1[0] == 'U' && arg1[1] == '+') {
+        tsp = val_str(arg);
+        if (tsp[0] == 'U' && tsp[1] == '+') {
             static char targ[20] = "0x";    /* Fudge to 0x instead */
-            strcpy(targ+2, arg1+2);         /* strtol then handles it */
-            tsp = targ;
+            snprintf(targ+2, sizeof(targ)-2, "%s", tsp+2);
+            tsp = targ;                     /* strtol then handles it */
         }
-        else {
-            tsp = arg1;
-        }
-        nb = unicode_to_utf8(strtol(tsp, NULL, 0), result);
-        result[nb] = 0;
-        return result;
+        nb = unicode_to_utf8(strtol(tsp, NULL, 0), val_room(vp, 8));
+        set_own(vp, nb);
+        break;
     case UFGTKEY:       /* Allow for unicode input. -> utf-8 */
-        nb = unicode_to_utf8(tgetc(), result);
-        result[nb] = 0;
-        return result;
-    case UFRND:         return ue_itoa((ernd() % abs(atoi(arg1))) + 1);
-    case UFABS:         return ue_itoa(abs(atoi(arg1)));
-    case UFSINDEX:      return ue_itoa(sindex(arg1, arg2));
+        nb = unicode_to_utf8(tgetc(), val_room(vp, 8));
+        set_own(vp, nb);
+        break;
+    case UFRND:     set_int(vp, (ernd() % abs(val_int(arg))) + 1); break;
+    case UFABS:     set_int(vp, abs(val_int(arg))); break;
+    case UFSINDEX:  set_int(vp, sindex(val_str(arg), val_str(arg+1))); break;
     case UFENV:
 #if     ENVFUNC
-        tsp = getenv(arg1);
-        return tsp == NULL ? "" : tsp;
+        tsp = getenv(val_str(arg));
+        set_str(vp, tsp == NULL ? "" : tsp);
 #else
-        return "";
+        set_str(vp, "");
 #endif
-    case UFBIND:        return transbind(arg1);
-    case UFEXIST:       return ltos(fexist(arg1));
+        break;
+    case UFBIND:    set_str(vp, transbind(val_str(arg))); break;
+    case UFEXIST:   set_log(vp, fexist(val_str(arg))); break;
     case UFFIND:
-        tsp = flook(arg1, TRUE, ONPATH);
-        return tsp == NULL ? "" : tsp;
-    case UFBAND:        return ue_itoa(atoi(arg1) & atoi(arg2));
-    case UFBOR:         return ue_itoa(atoi(arg1) | atoi(arg2));
-    case UFBXOR:        return ue_itoa(atoi(arg1) ^ atoi(arg2));
-    case UFBNOT:        return ue_itoa(~atoi(arg1));
-    case UFXLATE:       return xlat(arg1, arg2, arg3);
+        tsp = flook(val_str(arg), TRUE, ONPATH);
+        set_str(vp, tsp == NULL ? "" : tsp);
+        break;
+    case UFBAND:    set_int(vp, val_int(arg) & val_int(arg+1)); break;
+    case UFBOR:     set_int(vp, val_int(arg) | val_int(arg+1)); break;
+    case UFBXOR:    set_int(vp, val_int(arg) ^ val_int(arg+1)); break;
+    case UFBNOT:    set_int(vp, ~val_int(arg)); break;
+    case UFXLATE:
+        xlat(a1, val_str(arg+1), val_str(arg+2), val_room(vp, len + 1));
+        set_own(vp, strlen(vp->v_buf));
+        break;
     case UFPROCARG:
-        if (userproc_arg) return userproc_arg;
+        if (userproc_arg) {
+            set_str(vp, userproc_arg);
+            break;
+        }
         int distmp = discmd;    /* echo it always! */
         discmd = TRUE;
-        int status = getstring(arg1, result, NSTRING, CMPLT_NONE);
+        int status = getstring(val_str(arg), val_room(vp, NSTRING), NSTRING,
+             CMPLT_NONE);
         discmd = distmp;
-        if (status == ABORT) return errorm;
-        return result;
+        if (status == ABORT) set_str(vp, errorm);
+        else                 set_own(vp, strlen(vp->v_buf));
+        break;
+    default:
+        exit(-11);          /* never should get here */
     }
 
-    exit(-11);              /* never should get here */
+done:
+    for (i = 0; i < nargs; i++) val_free(arg + i);
+    return vp;
+}
+
+
+/*
+ * Milliseconds since $clock was first read - for timing macros.
+ */
+static int ms_clock(void) {
+    static struct timespec start;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (start.tv_sec == 0 && start.tv_nsec == 0) start = now;
+    return (now.tv_sec - start.tv_sec) * 1000 +
+         (now.tv_nsec - start.tv_nsec) / 1000000;
 }
 
-/* Look up a user var's value
+/*
+ * Set a value to a size, as a string - for values which may not fit in
+ * an int.
+ * It is written into the value, as set_str() would only borrow a static
+ * buffer, which the next one would overwrite.
+ */
+static struct value *set_size(struct value *vp, size_t z) {
+    int room = sizeof(size_t) * 3 + 1;
+
+    return set_own(vp, snprintf(val_room(vp, room), room, "%zu", z));
+}
+
+/* Look up an environment variable's slot in evl[].
+ * Returns -1 if it isn't one of ours.
  *
- * char *vname;                 name of user variable to fetch
+ * char *vname;                 name of environment variable to find
  */
-static char *gtusr(char *vname) {
-    int vnum;       /* Ordinal number of user var */
+static int env_slot(char *vname) {
+    unsigned int hi;
+    int i;
 
-/* Scan the list looking for the user var name */
-    for (vnum = 0; vnum < MAXVARS; vnum++) {
-        if (uv[vnum].u_name[0] == 0) return errorm;
-        if (strcmp(vname, uv[vnum].u_name) == 0) return uv[vnum].u_value;
+    if (ev_hash == NULL) {      /* Build the hash on first use */
+        for (ev_hsize = 64; ev_hsize < 2*(int)ARRAY_SIZE(evl); ev_hsize *= 2);
+        ev_hash = Xmalloc(ev_hsize*sizeof(int));
+        memset(ev_hash, 0, ev_hsize*sizeof(int));
+        for (i = 0; i < (int)ARRAY_SIZE(evl); i++) {
+            hi = var_hashof(evl[i].var);
+            while (ev_hash[hi & (ev_hsize - 1)]) hi++;
+            ev_hash[hi & (ev_hsize - 1)] = i + 1;
+        }
     }
+    for (hi = var_hashof(vname); (i = ev_hash[hi & (ev_hsize - 1)]); hi++)
+        if (strcmp(vname, evl[i - 1].var) == 0) return i - 1;
+    return -1;
+}
 
-/* Return errorm if we run off the end */
-    return errorm;
+/* Return the contents of the kill buffer
+ */
+static struct value *getkill(struct value *vp) {
+    if (kbuf[0].d_used == 0)
+                /* no kill buffer....just a null string */
+        return set_str(vp, "");
+    return set_mem(vp, kbuf[0].d_text, kbuf[0].d_used);
 }
 
 /*
  * gtenv()
  *
- * char *vname;                 name of environment variable to retrieve
+ * unsigned int vnum;           slot of environment variable to retrieve
+ * struct value *vp;            where to put it
  */
-static char *gtenv(char *vname) {
-    unsigned int vnum;  /* ordinal number of var referenced */
-
-/* Scan the list, looking for the referenced name */
-    for (vnum = 0; vnum < ARRAY_SIZE(evl); vnum++)
-        if (strcmp(vname, evl[vnum].var) == 0) break;
-
-/* Return errorm on a bad reference */
-    if (vnum == ARRAY_SIZE(evl))
-#if     ENVFUNC
-    {
-        char *ename = getenv(vname);
-        if (ename != NULL)
-            return ename;
-        else
-            return errorm;
-    }
-#else
-    return errorm;
-#endif
+static struct value *gtenv(unsigned int vnum, struct value *vp) {
 
-/* Otherwise, fetch the appropriate value */
+/* Fetch the appropriate value */
     switch (evl[vnum].tag) {
-    case EVFILLCOL:         return ue_itoa(fillcol);
-    case EVPAGELEN:         return ue_itoa(term.t_nrow + 1);
-    case EVCURCOL:          return ue_itoa(getccol(FALSE));
-    case EVCURLINE:         return ue_itoa(getcline());
-    case EVFLICKER:         return ltos(flickcode);
-    case EVCURWIDTH:        return ue_itoa(term.t_ncol);
-    case EVCBUFNAME:        return curbp->b_bname;
-    case EVCFNAME:          return curbp->b_fname;
-    case EVSRES:            return sres;
-    case EVDEBUG:           return ltos(macbug);
-    case EVSTATUS:          return ltos(cmdstatus);
-    case EVPALETTE:         return palstr;
-    case EVASAVE:           return ue_itoa(gasave);
-    case EVACOUNT:          return ue_itoa(gacount);
-    case EVLASTKEY:         return ue_itoa(lastkey);
+    case EVFILLCOL:         return set_int(vp, fillcol);
+    case EVPAGELEN:         return set_int(vp, term.t_nrow + 1);
+    case EVCURCOL:          return set_int(vp, getccol(FALSE));
+    case EVCURLINE:         return set_int(vp, getcline());
+    case EVFLICKER:         return set_log(vp, flickcode);
+    case EVCURWIDTH:        return set_int(vp, term.t_ncol);
+    case EVCBUFNAME:        return set_str(vp, curbp->b_bname);
+    case EVCFNAME:          return set_str(vp, curbp->b_fname);
+    case EVSRES:            return set_str(vp, sres);
+    case EVDEBUG:           return set_log(vp, macbug);
+    case EVSTATUS:          return set_log(vp, cmdstatus);
+    case EVPALETTE:         return set_str(vp, palstr);
+    case EVASAVE:           return set_int(vp, gasave);
+    case EVACOUNT:          return set_int(vp, gacount);
+    case EVLASTKEY:         return set_int(vp, lastkey);
     case EVCURCHAR:
-        return (curwp->w_dotp->l_used == curwp->w_doto ?
-            ue_itoa('\n') :
-            ue_itoa(lgetc(curwp->w_dotp, curwp->w_doto)));
-    case EVDISCMD:          return ltos(discmd);
-    case EVVERSION:         return VERSION;
-    case EVPROGNAME:        return PROGRAM_NAME_LONG;
-    case EVSEED:            return ue_itoa(seed);
-    case EVDISINP:          return ltos(disinp);
-    case EVWLINE:           return ue_itoa(curwp->w_ntrows);
-    case EVCWLINE:          return ue_itoa(getwpos());
+        return set_int(vp, curwp->w_dotp->l_used == curwp->w_doto ?
+            '\n' : lgetc(curwp->w_dotp, curwp->w_doto));
+    case EVDISCMD:          return set_log(vp, discmd);
+    case EVVERSION:         return set_str(vp, VERSION);
+    case EVPROGNAME:        return set_str(vp, PROGRAM_NAME_LONG);
+    case EVSEED:            return set_int(vp, seed);
+    case EVDISINP:          return set_log(vp, disinp);
+    case EVWLINE:           return set_int(vp, curwp->w_ntrows);
+    case EVCWLINE:          return set_int(vp, getwpos());
     case EVTARGET:
         saveflag = lastflag;
-        return ue_itoa(curgoal);
-    case EVSEARCH:          return pat;
-    case EVREPLACE:         return rpat;
-    case EVMATCH:           return (patmatch == NULL) ? "" : patmatch;
-    case EVKILL:            return getkill();
-    case EVCMODE:           return ue_itoa(curbp->b_mode);
-    case EVGMODE:           return ue_itoa(gmode);
-    case EVTPAUSE:          return ue_itoa(term.t_pause);
-    case EVPENDING:         return ltos(typahead());
-    case EVLWIDTH:          return ue_itoa(llength(curwp->w_dotp));
-    case EVLINE:            return getctext();
-    case EVGFLAGS:          return ue_itoa(gflags);
-    case EVRVAL:            return ue_itoa(rval);
-    case EVTAB:             return ue_itoa(tabmask + 1);
-    case EVOVERLAP:         return ue_itoa(overlap);
-    case EVSCROLLJUMP:      return ue_itoa(scrolljump);
-    case EVSCROLL:          return ltos(term.t_scroll != NULL);
-    case EVINMB:            return ue_itoa(inmb);
-    case EVFCOL:            return(ue_itoa(curwp->w_fcol));
-    case EVHSCROLL:         return(ltos(hscroll));
-    case EVHJUMP:           return(ue_itoa(hjump));
+        return set_int(vp, curgoal);
+    case EVSEARCH:          return set_str(vp, pat);
+    case EVREPLACE:         return set_str(vp, rpat);
+    case EVMATCH:           return set_str(vp, patmatch? patmatch: "");
+    case EVKILL:            return getkill(vp);
+    case EVCMODE:           return set_int(vp, curbp->b_mode);
+    case EVGMODE:           return set_int(vp, gmode);
+    case EVTPAUSE:          return set_int(vp, term.t_pause);
+    case EVPENDING:         return set_log(vp, typahead());
+    case EVLWIDTH:          return set_int(vp, llength(curwp->w_dotp));
+    case EVLINE:            return set_mem(vp, curwp->w_dotp->l_text,
+                                 curwp->w_dotp->l_used);
+    case EVGFLAGS:          return set_int(vp, gflags);
+    case EVRVAL:            return set_int(vp, rval);
+    case EVTAB:             return set_int(vp, tabmask + 1);
+    case EVOVERLAP:         return set_int(vp, overlap);
+    case EVSCROLLJUMP:      return set_int(vp, scrolljump);
+    case EVSCROLL:          return set_log(vp, term.t_scroll != NULL);
+    case EVINMB:            return set_int(vp, inmb);
+    case EVFCOL:            return set_int(vp, curwp->w_fcol);
+    case EVHSCROLL:         return set_log(vp, hscroll);
+    case EVHJUMP:           return set_int(vp, hjump);
     case EVYANKMODE:        switch (yank_mode) {
                             case Old:
-                                return "old";
+                                return set_str(vp, "old");
                                 break;
                             case GNU:
-                                return "gnu";
+                                return set_str(vp, "gnu");
                                 break;
                             }
-                            return "";
+                            return set_str(vp, "");
                             break;
-    case EVAUTOCLEAN:       return ue_itoa(autoclean);
-    case EVREGLTEXT:        return regionlist_text;
-    case EVREGLNUM:         return regionlist_number;
-    case EVAUTODOS:         return ltos(autodos);
-    case EVSDTKSKIP:        return ue_itoa(showdir_tokskip);
+    case EVAUTOCLEAN:       return set_int(vp, autoclean);
+    case EVREGLTEXT:        return set_str(vp, regionlist_text);
+    case EVREGLNUM:         return set_str(vp, regionlist_number);
+    case EVAUTODOS:         return set_log(vp, autodos);
+    case EVSDTKSKIP:        return set_int(vp, showdir_tokskip);
+    case EVLMEMLIVE:        return set_size(vp, lmem_live());
+    case EVLMEMWASTE:       return set_size(vp, lmem_waste());
+    case EVLMEMSLABS:       return set_int(vp, lmem_slabs());
+    case EVMAGICDFA:        return set_log(vp, magic_dfa);
+    case EVSRCHTHREADS:     return set_int(vp, search_threads);
+    case EVMAXFPS:          return set_int(vp, max_fps);
+    case EVUNDOBUDGET:      return set_int(vp, undo_budget);
+    case EVCLOCK:           return set_int(vp, ms_clock());
+    case EVPROFILE:         return set_log(vp, macro_profile);
     }
     exit(-12);              /* again, we should never get here */
 }
@@ -546,7 +867,7 @@ static char *gtenv(char *vname) {
  * @size: size of variable array.
  */
 static void findvar(char *var, struct variable_description *vd, int size) {
-    unsigned int vnum;  /* subscript in variable arrays */
+    int vnum;           /* subscript in variable arrays */
     int vtype;          /* type to return */
 
     vnum = -1;
@@ -555,33 +876,24 @@ fvar:
     switch (var[0]) {
 
     case '$':               /* Check for legal enviromnent var */
-        for (vnum = 0; vnum < ARRAY_SIZE(evl); vnum++)
-            if (strcmp(var+1, evl[vnum].var) == 0) {
-                vtype = TKENV;
-                break;
-            }
+        if ((vnum = env_slot(var+1)) != -1) vtype = TKENV;
         break;
 
-    case '%':               /* Check for existing legal user variable */
-        for (vnum = 0; vnum < MAXVARS; vnum++)
-            if (strcmp(var+1, uv[vnum].u_name) == 0) {
-                vtype = TKVAR;
-                break;
-            }
-        if (vnum < MAXVARS) break;
-        for (vnum = 0; vnum < MAXVARS; vnum++)  /* Create a new one??? */
-            if (uv[vnum].u_name[0] == 0) {
-                vtype = TKVAR;
-                strcpy(uv[vnum].u_name, var+1);
-                break;
-            }
+    case '%':               /* Find (or create) the user variable */
+        if (strlen(var+1) > NVSIZE) var[NVSIZE+1] = '\0';
+        vnum = usr_create(var+1);
+        vtype = TKVAR;
         break;
 
     case '&':               /* Indirect operator? */
         var[4] = 0;
         if (strcmp(var+1, "ind") == 0) {  /* Grab token, and eval it */
             execstr = token(execstr, var, size);
-            strcpy(var, getval(var));
+            char *name = getval(var);   /* May be within var */
+            int len = strlen(name);
+            if (len >= size) len = size - 1;
+            memmove(var, name, len);
+            var[len] = '\0';
             goto fvar;
         }
     }
@@ -597,11 +909,13 @@ fvar:
  * @var: variable to set.
  * @value: value to set to.
  */
-static int svar(struct variable_description *var, char *value) {
+static int svar(struct variable_description *var, struct value *value) {
     int vnum;       /* ordinal number of var referenced */
     int vtype;      /* type of variable to set */
     int status;     /* status return */
     int c;          /* translated character */
+    char *sv;       /* value as text, for the string variables */
+    char tval[NSTRING];
 
 /* simplify the vd structure (we are gonna look at it a lot) */
     vnum = var->v_num;
@@ -611,183 +925,223 @@ static int svar(struct variable_description *var, char *value) {
     status = TRUE;
     switch (vtype) {
     case TKVAR:             /* set a user variable */
-        uv[vnum].u_value = Xrealloc(uv[vnum].u_value, strlen(value) + 1);
-        strcpy(uv[vnum].u_value, value);
+        usr_set(vnum, value);
         break;
 
     case TKENV:             /* set an environment variable */
         status = TRUE;  /* by default */
+
+/* The string ones (other than $line) are set from a copy, as the value
+ * may be what they hold already. Some are held in fixed-size arrays, so
+ * a value too long for where it is going is an error.
+ */
+        sv = val_str(value);
+        if (vnum != EVLINE) {
+            int max = NSTRING;
+            if (vnum == EVCBUFNAME) max = NBUFN;
+            else if (vnum == EVSEARCH || vnum == EVREPLACE) max = NPAT;
+            c = strlen(sv);
+            if (c >= max) {
+                mlwrite("%%String too long (%d bytes) - max %d", c, max - 1);
+                return FALSE;
+            }
+            memcpy(tval, sv, c + 1);
+            sv = tval;
+        }
         switch (vnum) {
         case EVFILLCOL:
-            fillcol = atoi(value);
+            fillcol = val_int(value);
             break;
         case EVPAGELEN:
-            status = newsize(TRUE, atoi(value));
+            status = newsize(TRUE, val_int(value));
             break;
         case EVCURCOL:
-            status = setccol(atoi(value));
+            status = setccol(val_int(value));
             break;
         case EVCURLINE:
-            status = gotoline(TRUE, atoi(value));
+            status = gotoline(TRUE, val_int(value));
             break;
         case EVFLICKER:
-            flickcode = stol(value);
+            flickcode = val_log(value);
             break;
         case EVCURWIDTH:
-            status = newwidth(TRUE, atoi(value));
+            status = newwidth(TRUE, val_int(value));
             break;
         case EVCBUFNAME:
-            strcpy(curbp->b_bname, value);
+            strcpy(curbp->b_bname, sv);
             curwp->w_flag |= WFMODE;
             break;
         case EVCFNAME:
-            strcpy(curbp->b_fname, value);
+            strcpy(curbp->b_fname, sv);
             curwp->w_flag |= WFMODE;
             break;
         case EVSRES:
-            status = TTrez(value);
+            status = TTrez(sv);
             break;
         case EVDEBUG:
-            macbug = stol(value);
+            macbug = val_log(value);
             break;
         case EVSTATUS:
-            cmdstatus = stol(value);
+            cmdstatus = val_log(value);
             break;
         case EVASAVE:
-            gasave = atoi(value);
+            gasave = val_int(value);
             break;
         case EVACOUNT:
-            gacount = atoi(value);
+            gacount = val_int(value);
             break;
         case EVLASTKEY:
-            lastkey = atoi(value);
+            lastkey = val_int(value);
             break;
         case EVCURCHAR:
             ldelgrapheme(1, FALSE);     /* delete 1 char-place */
-            c = atoi(value);
+            c = val_int(value);
             if (c == '\n') lnewline();
             else           linsert_uc(1, c);
             back_grapheme(1);
             break;
         case EVDISCMD:
-            discmd = stol(value);
+            discmd = val_log(value);
             break;
         case EVVERSION:
             break;
         case EVPROGNAME:
             break;
         case EVSEED:
-            seed = atoi(value);
+            seed = val_int(value);
             break;
         case EVDISINP:
-            disinp = stol(value);
+            disinp = val_log(value);
             break;
         case EVWLINE:
-            status = resize(TRUE, atoi(value));
+            status = resize(TRUE, val_int(value));
             break;
         case EVCWLINE:
-            status = forwline(TRUE, atoi(value) - getwpos());
+            status = forwline(TRUE, val_int(value) - getwpos());
             break;
         case EVTARGET:
-            curgoal = atoi(value);
+            curgoal = val_int(value);
             thisflag = saveflag;
             break;
         case EVSEARCH:
-            strcpy(pat, value);
+            strcpy(pat, sv);
             rvstrcpy(tap, pat);
 #if     MAGIC
             mcclear();
 #endif
-            new_prompt(value);  /* Let gestring() know, via the search code */
+            new_prompt(sv);  /* Let gestring() know, via the search code */
             break;
         case EVREPLACE:
-            strcpy(rpat, value);
-            new_prompt(value);  /* Let gestring() know, via the search code */
+            strcpy(rpat, sv);
+            new_prompt(sv);  /* Let gestring() know, via the search code */
             break;
         case EVMATCH:
             break;
         case EVKILL:
             break;
         case EVCMODE:
-            curbp->b_mode = atoi(value);
+            curbp->b_mode = val_int(value);
             curwp->w_flag |= WFMODE;
             break;
         case EVGMODE:
-            gmode = atoi(value);
+            gmode = val_int(value);
             break;
         case EVTPAUSE:
-            term.t_pause = atoi(value);
+            term.t_pause = val_int(value);
             break;
         case EVPENDING:
             break;
         case EVLWIDTH:
             break;
         case EVLINE:
-            putctext(value);
+            putctext(sv);
             break;
         case EVGFLAGS:
-            gflags = atoi(value);
+            gflags = val_int(value);
             break;
         case EVRVAL:
             break;
         case EVTAB:
-            tabmask = atoi(value) - 1;
+            tabmask = val_int(value) - 1;
             if (tabmask != 0x07 && tabmask != 0x03)
             tabmask = 0x07;
             curwp->w_flag |= WFHARD;
             break;
         case EVOVERLAP:
-            overlap = atoi(value);
+            overlap = val_int(value);
             break;
         case EVSCROLLJUMP:
-            scrolljump = atoi(value);
+            scrolljump = val_int(value);
             break;
         case EVSCROLL:
-            if (!stol(value)) term.t_scroll = NULL;
+            if (!val_log(value)) term.t_scroll = NULL;
             break;
         case EVINMB:
             break;
         case EVFCOL:
-            curwp->w_fcol = atoi(value);
+            curwp->w_fcol = val_int(value);
             if (curwp->w_fcol < 0) curwp->w_fcol = 0;
             curwp->w_flag |= WFHARD | WFMODE;
             break;
         case EVHSCROLL:
-            hscroll = stol(value);
+            hscroll = val_log(value);
             lbound = 0;
             break;
         case EVHJUMP:
-            hjump = atoi(value);
+            hjump = val_int(value);
             if (hjump < 1) hjump = 1;
             if (hjump > term.t_ncol - 1) hjump = term.t_ncol - 1;
             break;
         case EVYANKMODE:
-            if (strcmp("old", value) == 0)
+            if (strcmp("old", sv) == 0)
                 yank_mode = Old;
-            else if (strcmp("gnu", value) == 0)
+            else if (strcmp("gnu", sv) == 0)
                 yank_mode = GNU;
             break;      /* For anything else, leave unset */
         case EVAUTOCLEAN:
            {int old_autoclean = autoclean;
-            autoclean = atoi(value);
+            autoclean = val_int(value);
             if (autoclean >= 0 && autoclean < old_autoclean) dumpdir_tidy();
            }
             break;
         case EVREGLTEXT:    /* These two are... */
         case EVREGLNUM:     /* ...very similar */
-            if (strlen(value) >= MAX_REGL_LEN) {
+            if (strlen(sv) >= MAX_REGL_LEN) {
                 mlforce("String too long - max %d", MAX_REGL_LEN - 1);
                 status = FALSE;
                 break;
             }
             strcpy((vnum == EVREGLTEXT)? regionlist_text: regionlist_number,
-                  value);
+                  sv);
             break;
         case EVAUTODOS:
-            autodos = stol(value);
+            autodos = val_log(value);
             break;
         case EVSDTKSKIP:
-            showdir_tokskip = atoi(value);
+            showdir_tokskip = val_int(value);
+            break;
+        case EVLMEMLIVE:
+        case EVLMEMWASTE:
+        case EVLMEMSLABS:
+            break;
+        case EVMAGICDFA:
+            magic_dfa = val_log(value);
+            break;
+        case EVSRCHTHREADS:
+            search_threads = val_int(value);
+            break;
+        case EVMAXFPS:
+            max_fps = val_int(value);
+            break;
+        case EVUNDOBUDGET:
+            undo_budget = val_int(value);
+            break;
+        case EVCLOCK:
+            break;
+        case EVPROFILE:
+            c = val_log(value);
+            if (c && !macro_profile) prof_reset();  /* Start afresh */
+            macro_profile = c;
             break;
         }
         break;
@@ -810,7 +1164,8 @@ int setvar(int f, int n) {
 #endif
     struct variable_description vd; /* variable num/type */
     char var[NVSIZE + 1];           /* name of variable to fetch */
-    char value[NSTRING];            /* value to set variable to */
+    char tbuf[NSTRING];             /* typed-in value */
+    struct value value = VALUE_INIT;    /* value to set variable to */
 
 /* First get the variable to set.. */
     if (clexec == FALSE) {
@@ -830,15 +1185,21 @@ int setvar(int f, int n) {
         return FALSE;
     }
 
-/* Get the value for that variable */
-    if (f == TRUE) strcpy(value, ue_itoa(n));
+/* Get the value for that variable.
+ * From a macro line this is taken as it comes, with no limit on its size.
+ */
+    if (f == TRUE) set_int(&value, n);
+    else if (clexec) {
+        if ((status = macarg_val(&value)) != TRUE) goto done;
+    }
     else {
-        status = mlreply("Value: ", value, NSTRING, CMPLT_NONE);
+        status = mlreply("Value: ", tbuf, NSTRING, CMPLT_NONE);
         if (status != TRUE) return status;
+        set_str(&value, tbuf);
     }
 
 /* And set the appropriate value */
-    status = svar(&vd, value);
+    status = svar(&vd, &value);
 
 #if DEBUGM
 /* If $debug == TRUE, every assignment will echo a statement to
@@ -855,8 +1216,10 @@ int setvar(int f, int n) {
         strcat(outline, var);
         strcat(outline, ":");
 
-/* And lastly the value we tried to assign */
-        strcat(outline, value);
+/* And lastly the value we tried to assign (as much as will fit, with
+ * room to double any %s)
+ */
+        strncat(outline, val_str(&value), NSTRING/2 - strlen(outline));
         strcat(outline, ")))");
 
 /* Expand '%' to "%%" so mlwrite wont bitch */
@@ -884,6 +1247,8 @@ int setvar(int f, int n) {
 #endif
 
 /* And return it */
+done:
+    val_free(&value);
     return status;
 }
 
@@ -958,46 +1323,58 @@ int gettyp(char *token) {
 }
 
 /*
- * find the value of a token
+ * find the value of a token, as text
  *
  * char *token;         token to evaluate
  */
 char *getval(char *token) {
+    static struct value val = VALUE_INIT;
+    int slot = -1;
+
+    return val_str(getvalue(token, &slot, &val));
+}
+
+/*
+ * find the value of a token, remembering where a variable or function
+ * was found.
+ * *slot should start as -1 and be passed back with the same token on
+ * later calls (which is what compiled procedures do - see exec.c).
+ * The token itself is left untouched.
+ *
+ * char *token;         token to evaluate
+ * int *slot;           cached uv[], evl[] or funcs[] index
+ * struct value *vp;    where to put the value
+ */
+struct value *getvalue(char *token, int *slot, struct value *vp) {
     int status;                 /* error return */
     struct buffer *bp;          /* temp buffer pointer */
     int blen;                   /* length of buffer argument */
     int distmp;                 /* temporary discmd flag */
-    static char buf[NSTRING];   /* string buffer for some returns */
+    struct value name = VALUE_INIT; /* of a prompt or buffer */
+    int nslot = -1;
     char tbuf[NSTRING];         /* string buffer for some workings */
 
     switch (gettyp(token)) {
     case TKNUL:
-        return "";
+        return set_str(vp, "");
 
     case TKARG:                 /* interactive argument */
-/* GGR - There is the possibility of an illegal overlap of args here.
- *       So it must be done via a temporary buffer.
- *              strcpy(token, getval(token+1));
- */
-        strcpy(tbuf, getval(token+1));
-        strcpy(token, tbuf);
+        getvalue(token+1, &nslot, &name);
+        snprintf(tbuf, NSTRING, "%s", val_str(&name));
+        val_free(&name);
         distmp = discmd;    /* echo it always! */
         discmd = TRUE;
-        status = getstring(token, buf, NSTRING, CMPLT_NONE);
+        status = getstring(tbuf, val_room(vp, NSTRING), NSTRING, CMPLT_NONE);
         discmd = distmp;
-        if (status == ABORT) return errorm;
-        return buf;
+        if (status == ABORT) return set_str(vp, errorm);
+        return set_own(vp, strlen(vp->v_buf));
 
     case TKBUF:             /* buffer contents fetch */
-/* Grab the right buffer
- * GGR - There is the possibility of an illegal overlap of args here.
- *       So it must be done via a temporary buffer.
- *              strcpy(token, getval(token+1));
- */
-        strcpy(tbuf, getval(token+1));
-        strcpy(token, tbuf);
-        bp = bfind(token, FALSE, 0);
-        if (bp == NULL) return errorm;
+/* Grab the right buffer */
+        getvalue(token+1, &nslot, &name);
+        bp = bfind(val_str(&name), FALSE, 0);
+        val_free(&name);
+        if (bp == NULL) return set_str(vp, errorm);
 
 /* If the buffer is displayed, get the window vars instead of the buffer vars */
         if (bp->b_nwnd > 0) {
@@ -1006,14 +1383,11 @@ char *getval(char *token) {
         }
 
 /* Make sure we are not at the end */
-        if (bp->b_linep == bp->b_dotp) return errorm;
+        if (bp->b_linep == bp->b_dotp) return set_str(vp, errorm);
 
 /* Grab the line as an argument */
         blen = bp->b_dotp->l_used - bp->b_doto;
-        if (blen >= NSTRING)        /* GGR >= to allow for NUL */
-            blen = NSTRING - 1;
-        memcpy(buf, bp->b_dotp->l_text + bp->b_doto, blen);
-        buf[blen] = 0;
+        set_mem(vp, bp->b_dotp->l_text + bp->b_doto, blen);
 
 /* And step the buffer's line ptr ahead a line */
         bp->b_dotp = bp->b_dotp->l_fp;
@@ -1027,24 +1401,36 @@ char *getval(char *token) {
         }
 
 /* And return the spoils */
-        return buf;
+        return vp;
 
     case TKVAR:
-        return gtusr(token + 1);
+        if (*slot < 0) *slot = usr_slot(token + 1);
+        if (*slot < 0) return set_str(vp, errorm);
+        return usr_get(*slot, vp);
     case TKENV:
-        return gtenv(token + 1);
+        if (*slot < 0) *slot = env_slot(token + 1);
+        if (*slot < 0) {
+#if     ENVFUNC
+            char *ename = getenv(token + 1);
+            if (ename != NULL) return set_str(vp, ename);
+#endif
+            return set_str(vp, errorm);
+        }
+        return gtenv(*slot, vp);
     case TKFUN:
-        return gtfun(token + 1);
+        if (*slot < 0) *slot = fun_slot(token + 1);
+        if (*slot < 0) return set_str(vp, errorm);
+        return gtfun(*slot, vp);
     case TKDIR:
-        return errorm;
+        return set_str(vp, errorm);
     case TKLBL:
-        return errorm;
+        return set_str(vp, errorm);
     case TKLIT:
-        return token;
+        return set_str(vp, token);
     case TKSTR:
-        return token + 1;
+        return set_str(vp, token + 1);
     case TKCMD:
-        return token;
+        return set_str(vp, token);
     }
-    return errorm;
+    return set_str(vp, errorm);
 }
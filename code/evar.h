@@ -11,7 +11,11 @@
 /* Structure to hold user variables and their definitions. */
 struct user_variable {
         char u_name[NVSIZE + 1]; /* name of user variable */
+        int u_type;              /* VT_INT, VT_LOG or VT_STR */
+        int u_int;               /* value, if VT_INT or VT_LOG */
         char *u_value;           /* value (string) */
+        int u_len;               /* its length (-1 if not made yet) */
+        int u_size;              /* and the space allocated for it */
 };
 
 /* List of recognized environment variables. */
@@ -70,6 +74,15 @@ struct evlist evl[] = {
  { "regionlist_number", EVREGLNUM },    /* numberlist_region() indent */
  { "autodos",   EVAUTODOS },    /* Check for DOS on read-in? */
  { "showdir_tokskip", EVSDTKSKIP },     /* Token to skip in showdir */
+ { "lmem_live", EVLMEMLIVE },    /* Bytes allocated to lines (read only) */
+ { "lmem_waste", EVLMEMWASTE },  /* Slab bytes not handed out (read only) */
+ { "lmem_slabs", EVLMEMSLABS },  /* Slabs holding them (read only) */
+ { "magic_dfa", EVMAGICDFA },   /* Compiled (not backtracking) MAGIC search */
+ { "search_threads", EVSRCHTHREADS },   /* Parallel literal search */
+ { "max_fps",   EVMAXFPS },     /* Redisplay rate limit with typeahead */
+ { "undo_budget", EVUNDOBUDGET }, /* Most memory for a buffer's undo records */
+ { "clock",     EVCLOCK },      /* Milliseconds since first read (read only) */
+ { "profile",   EVPROFILE },    /* Profile macro lines and commands */
 };
 
 /* The tags for user functions - used in struct evlist */
@@ -19,6 +19,62 @@
 
 static char *prev_line_seen = NULL;
 
+/* dobuf() compiles a buffer into an array of struct mac_op, one for each
+ * line that isn't blank or a comment, with the directive looked up and
+ * the jumps for !while, !break, !endwhile and !goto and for skipping a
+ * false !if (or an !else) worked out.
+ * The first time a line is executed its tokens are split off and kept,
+ * and, if it is a simple command, the command looked up too.
+ * A buffer keeps its compiled form in b_prog until it changes
+ * (see proc_free()).
+ * While $profile is TRUE each line also holds its profile.c entry, which
+ * is looked up again if the profile has been reset since.
+ */
+struct mac_arg {
+    char *a_start;          /* First char of the token in o_text    */
+    char *a_next;           /* Where token() would leave execstr    */
+    char *a_text;           /* The token, as token() would return it */
+    int a_len;              /* ...and its length                    */
+    int a_slot;             /* Where it was found (getval_slot())   */
+};
+
+struct mac_op {
+    struct line *o_lp;      /* Line this came from                  */
+    char *o_text;           /* Its text, without leading whitespace */
+    char *o_cmd;            /* Command/arguments after any directive */
+    int o_cmdlen;           /* strlen(o_cmd)                        */
+    int o_dir;              /* Directive, -1 if none, NUMDIRS if bad */
+    int o_label;            /* Line starts with '*' - a !goto target */
+    int o_jump;             /* Op a !while/!break/!endwhile/!goto goes to */
+    int o_skip;             /* Op a false !if, or !else, resumes at */
+    int o_skiplevel;        /* ...and execlevel to resume with      */
+    struct mac_arg *o_args; /* Its tokens (NULL until first run)    */
+    struct name_bind *o_nbp;    /* Command, if simple enough to look up */
+    char *o_argp;           /* ...where its arguments start         */
+    int o_f, o_n;           /* ...and the numeric argument it takes */
+    int o_lineno;           /* Line number in the buffer            */
+    int o_prof;             /* Its profile entry...                 */
+    unsigned int o_profgen; /* ...and the prof_generation it is for */
+};
+
+struct mac_prog {
+    struct mac_op *p_op;
+    int p_nops;
+    int p_busy;             /* dobuf()s currently running it        */
+};
+
+/* A user variable made local by !local, and the value to put back
+ * when the procedure ends.
+ */
+struct local_var {
+    int lv_slot;                /* uv[] slot (see uv_local()) */
+    char *lv_saved;             /* Value from outside the procedure */
+    struct local_var *lv_next;
+};
+
+/* Tokens of the line being run by dobuf(), for nextarg() */
+static struct mac_arg *exec_args = NULL;
+
 /*
  * docmd:
  *      take a passed string as a command line and translate
@@ -39,7 +95,7 @@ static int docmd(char *cline) {
     int oldcle;             /* old contents of clexec flag */
     char *oldestr;          /* original exec string */
     char tkn[NSTRING];      /* next token off of command line */
-    char tbuf[NSTRING];     /* string buffer for some workings */
+    struct value val = VALUE_INIT;
 
 /* If we are scanning and not executing..go back here */
     if (execlevel) return TRUE;
@@ -60,27 +116,27 @@ static int docmd(char *cline) {
     lastflag = thisflag;
     thisflag = 0;
 
-    if ((status = macarg(tkn)) != TRUE) {   /* and grab the first token */
-        goto final_exit;
-    }
-
-/* Process leading argument */
-    if (gettyp(tkn) != TKCMD) {
-        f = TRUE;
-/* GGR - There is the possibility of an illegal overlap of args here.
- *       So it must be done via a temporary buffer.
- *              strcpy(tkn, getval(tkn));
+/* Grab the first token.
+ * A number is the leading argument, as is any text which doesn't look
+ * like a command name (which is evaluated again to get it).
  */
-        strcpy(tbuf, getval(tkn));
-        strcpy(tkn, tbuf);
-        n = atoi(tkn);
-
-/* and now get the command to execute */
-        if ((status = macarg(tkn)) != TRUE) {
-            goto final_exit;
+    if ((status = macarg_val(&val)) != TRUE) goto final_exit;
+    if (val.v_type == VT_INT) {
+        f = TRUE;
+        n = val.v_int;
+    }
+    else {
+        snprintf(tkn, NSTRING, "%s", val_str(&val));
+        if (gettyp(tkn) != TKCMD) {
+            int slot = -1;
+            f = TRUE;
+            n = val_int(getvalue(tkn, &slot, &val));
         }
     }
 
+/* and now get the command to execute */
+    if (f == TRUE && (status = macarg(tkn)) != TRUE) goto final_exit;
+
 /* If the command is "reexecute" we need to recurse with the previous
  * command line.
  * We also need to preserve the previous line as the current line,
@@ -111,7 +167,8 @@ static int docmd(char *cline) {
     oldcle = clexec;        /* save old clexec flag */
     clexec = TRUE;          /* in cline execution */
     current_command = nbp->n_name;
-    status = (nbp->n_func)(f, n); /* call the function */
+    if (macro_profile) status = prof_call(nbp, f, n);
+    else status = (nbp->n_func)(f, n); /* call the function */
     cmdstatus = status;     /* save the status */
     clexec = oldcle;        /* restore clexec flag */
 
@@ -129,11 +186,50 @@ remember_cmd:
     }
 /* "Just tidy up..." exit */
 final_exit:
+    val_free(&val);
     free(this_line_seen);
     execstr = oldestr;
     return status;
 }
 
+/*
+ * docmd_op:
+ *      run a line which op_prepare() has found to be a simple command,
+ *      so that is already looked up and needs no parsing.
+ *      The equivalent of docmd(op->o_cmd).
+ *
+ * struct mac_op *op;   compiled line to run
+ */
+static int docmd_op(struct mac_op *op) {
+    int status;             /* return status of function */
+    int oldcle;             /* old contents of clexec flag */
+    char *oldestr;          /* original exec string */
+
+/* If we are scanning and not executing..go back here */
+    if (execlevel) return TRUE;
+
+    oldestr = execstr;
+    execstr = op->o_argp;   /* Just the arguments are left */
+    lastflag = thisflag;
+    thisflag = 0;
+
+    oldcle = clexec;
+    clexec = TRUE;
+    current_command = op->o_nbp->n_name;
+    if (macro_profile) status = prof_call(op->o_nbp, op->o_f, op->o_n);
+    else status = (op->o_nbp->n_func)(op->o_f, op->o_n);
+    cmdstatus = status;
+    clexec = oldcle;
+
+/* This is now the line any reexecute should run.
+ * It replaces whatever was there, so can re-use its space.
+ */
+    prev_line_seen = Xrealloc(prev_line_seen, op->o_cmdlen + 1);
+    memcpy(prev_line_seen, op->o_cmd, op->o_cmdlen + 1);
+    execstr = oldestr;
+    return status;
+}
+
 /*
  * token:
  *      chop a token off a string
@@ -286,6 +382,69 @@ int macarg(char *tok) {
     return status;
 }
 
+/*
+ * cached_arg:
+ *      find the token which starts at src in the line dobuf() is running.
+ *      Commands take their arguments from execstr as they need them, so
+ *      this goes by where token() would start.
+ *
+ * char *src;           where the next token is to be read from
+ */
+static struct mac_arg *cached_arg(char *src) {
+    if (exec_args == NULL) return NULL;
+    while (*src == ' ' || *src == '\t') ++src;
+    for (struct mac_arg *ap = exec_args; ap->a_start; ap++)
+        if (ap->a_start == src) return ap;
+    return NULL;
+}
+
+/*
+ * macarg_val:
+ *      get the value of the next macro line argument, of whatever
+ *      type and size it is.
+ *
+ * struct value *vp;            where to put it
+ */
+int macarg_val(struct value *vp) {
+    int savcle;             /* buffer to store original clexec */
+    int slot = -1;
+    char tbuf[NSTRING];     /* token, if it fits */
+    char *tok;
+
+    savcle = clexec;
+    clexec = TRUE;
+
+/* If dobuf() has already split this token off, use that (and wherever
+ * its variable or function was found last time).
+ */
+    struct mac_arg *ap = cached_arg(execstr);
+    if (ap) {
+        execstr = ap->a_next;
+        getvalue(ap->a_text, &ap->a_slot, vp);
+        clexec = savcle;
+        return TRUE;
+    }
+
+/* Grab token and advance past.
+ * A token is never longer than the text it came from.
+ * If the value is the token itself it must be copied before the token
+ * goes.
+ */
+    int len = strlen(execstr);
+    tok = (len < NSTRING)? tbuf: Xmalloc(len + 1);
+    execstr = token(execstr, tok, len + 1);
+    getvalue(tok, &slot, vp);
+    switch (gettyp(tok)) {
+    case TKLIT:
+    case TKSTR:
+    case TKCMD:
+        val_own(vp);
+    }
+    if (tok != tbuf) free(tok);
+    clexec = savcle;
+    return TRUE;
+}
+
 /*
  * nextarg:
  *      get the next argument
@@ -294,24 +453,31 @@ int macarg(char *tok) {
  * char *buffer;                buffer to put token into
  * int size;                    size of the buffer
  * int terminator;              terminating char to be used on interactive fetch
+ *
+ * A value from a macro line which won't fit is an error, rather than being
+ * cut short. Commands wanting values of any length use macarg_val().
  */
 int nextarg(char *prompt, char *buffer, int size, enum cmplt_type ctype) {
-    char tbuf[NSTRING];     /* string buffer for some workings */
+    struct value val = VALUE_INIT;
+    char *vs;
+    int len;
+    int status;
 
 /* If we are interactive, go get it! */
     if (clexec == FALSE) return getstring(prompt, buffer, size, ctype);
 
-/* Grab token and advance past */
-    execstr = token(execstr, buffer, size);
-
-/* Evaluate it */
-/* GGR - There is the possibility of an illegal overlap of args here.
- *       So it must be done via a temporary buffer.
- *      strcpy(buffer, getval(buffer));
- */
-    strcpy(tbuf, getval(buffer));
-    strcpy(buffer, tbuf);
-    return TRUE;
+/* Evaluate the next token, and give it back if it fits */
+    if ((status = macarg_val(&val)) != TRUE) return status;
+    vs = val_str(&val);
+    len = strlen(vs);
+    if (len >= size) {
+        mlwrite("%%Argument too long (%d bytes) - max %d", len, size - 1);
+        status = FALSE;
+    }
+    else
+        memcpy(buffer, vs, len + 1);
+    val_free(&val);
+    return status;
 }
 
 /*
@@ -954,12 +1120,259 @@ int execbuf(int f, int n) {
 }
 
 /*
- * free a list of while block pointers
+ * free a compiled buffer
+ *
+ * struct mac_prog *prog;               what proc_compile() returned
+ */
+static void prog_free(struct mac_prog *prog) {
+    for (int i = 0; i < prog->p_nops; i++) {
+        struct mac_op *op = prog->p_op + i;
+        if (op->o_args) {
+            for (struct mac_arg *ap = op->o_args; ap->a_start; ap++)
+                free(ap->a_text);
+            free(op->o_args);
+        }
+        free(op->o_text);
+    }
+    free(prog->p_op);
+    free(prog);
+}
+
+/*
+ * Drop a buffer's compiled procedure, as its text has changed.
+ * If it is running at the moment dobuf() frees it when it finishes.
+ *
+ * struct buffer *bp;                   buffer that has changed
+ */
+void proc_free(struct buffer *bp) {
+    if (bp->b_prog && bp->b_prog->p_busy == 0) prog_free(bp->b_prog);
+    bp->b_prog = NULL;
+}
+
+/*
+ * Which sort of !while block, if any, a line starts.
+ *
+ * char *text;                          line, without leading whitespace
+ */
+static int block_type(char *text) {
+    if (text[0] != '!') return 0;
+    if (text[1] == 'w' && text[2] == 'h') return BTWHILE;
+    if (text[1] == 'b' && text[2] == 'r') return BTBREAK;
+    return 0;
+}
+
+/*
+ * Work out where execution resumes after a false !if, or an !else which
+ * has been reached by running the !if part, by stepping through the
+ * lines that would be skipped just as dobuf() would.
+ * This normally ends at the matching !else/!endif with execlevel back at
+ * 0, but an !endm or a bad directive must still be run, so it stops there
+ * with execlevel however deep it has got.
  *
- * struct while_block *wp;              head of structure to free
+ * struct mac_prog *prog;               compiled buffer
+ * struct mac_op *op;                   the !if or !else
  */
-static void freewhile(struct while_block *wp) {
-    for (struct while_block *fwp = wp; fwp; fwp = fwp->w_next) free(fwp);
+static void set_skip(struct mac_prog *prog, struct mac_op *op) {
+    int level = 1;
+    int pc = op - prog->p_op + 1;
+
+    while (pc < prog->p_nops) {
+        struct mac_op *sop = prog->p_op + pc;
+        if (sop->o_dir == DENDM || sop->o_dir == NUMDIRS) break;
+        if (sop->o_dir == DIF) ++level;
+        else if (sop->o_dir == DELSE) {
+            if (level == 1) {
+                level = 0;
+                pc++;
+                break;
+            }
+        }
+        else if (sop->o_dir == DENDIF || sop->o_dir == DENDWHILE) {
+            if (--level == 0) {
+                pc++;
+                break;
+            }
+        }
+        else if (sop->o_dir == DWHILE) pc = sop->o_jump;
+        pc++;
+    }
+    op->o_skip = pc;
+    op->o_skiplevel = level;
+}
+
+/*
+ * Compile a buffer for dobuf() (see struct mac_op).
+ * Returns NULL, with a message, if the !while blocks don't match up.
+ *
+ * struct buffer *bp;                   buffer to compile
+ */
+static struct mac_prog *proc_compile(struct buffer *bp) {
+    struct mac_prog *prog;
+    struct mac_op *op;
+    struct line *lp;
+    char *tp;
+    int len;
+    int open;               /* Innermost unclosed block, linked by o_jump */
+    int dirnum;
+    int lineno;
+    int i;
+
+    i = 1;
+    for (lp = lforw(bp->b_linep); lp != bp->b_linep; lp = lforw(lp)) i++;
+    prog = Xmalloc(sizeof(struct mac_prog));
+    prog->p_op = Xmalloc(i * sizeof(struct mac_op));
+    prog->p_nops = 0;
+    prog->p_busy = 0;
+
+    open = -1;
+    lineno = 0;
+    for (lp = lforw(bp->b_linep); lp != bp->b_linep; lp = lforw(lp)) {
+        lineno++;
+
+/* Trim leading whitespace and dump comments and blank lines */
+        tp = lp->l_text;
+        len = llength(lp);
+        while (len > 0 && (*tp == ' ' || *tp == '\t')) {
+            tp++;
+            len--;
+        }
+        if (len == 0 || *tp == ';' || *tp == 0) continue;
+
+        op = prog->p_op + prog->p_nops++;
+        op->o_lp = lp;
+        op->o_text = Xmalloc(len + 1);
+        memcpy(op->o_text, tp, len);
+        op->o_text[len] = 0;
+        op->o_label = (lgetc(lp, 0) == '*');
+        op->o_jump = -1;
+        op->o_args = NULL;
+        op->o_nbp = NULL;
+        op->o_lineno = lineno;
+        op->o_profgen = 0;
+
+/* Find out which directive this is, and skip past it */
+        op->o_dir = -1;
+        op->o_cmd = op->o_text;
+        if (op->o_text[0] == '!') {
+            for (dirnum = 0; dirnum < NUMDIRS; dirnum++)
+                if (strncmp(op->o_text + 1, dname[dirnum],
+                    strlen(dname[dirnum])) == 0)
+                break;
+            op->o_dir = dirnum;
+            while (*op->o_cmd && *op->o_cmd != ' ' && *op->o_cmd != '\t')
+                ++op->o_cmd;
+        }
+        op->o_cmdlen = strlen(op->o_cmd);
+
+/* Pair up !while (and !break) blocks with their !endwhile.
+ * Open blocks are stacked, linked through o_jump.
+ */
+        i = op - prog->p_op;
+        switch (block_type(op->o_text)) {
+        case BTBREAK:
+            if (open < 0) {
+                mlwrite_one("%!BREAK outside of any !WHILE loop");
+                goto fail;
+            }
+            /* Falls through */
+        case BTWHILE:
+            op->o_jump = open;
+            open = i;
+            continue;
+        }
+        if (op->o_text[0] == '!' && strncmp(op->o_text+1, "endw", 4) == 0) {
+            if (open < 0) {
+                mlwrite("%%!ENDWHILE with no preceding !WHILE in '%s'",
+                     bp->b_bname);
+                goto fail;
+            }
+/* Close all blocks up to and including the innermost !while */
+            int bt;
+            do {
+                struct mac_op *bop = prog->p_op + open;
+                bt = block_type(bop->o_text);
+                open = bop->o_jump;
+                bop->o_jump = i;
+                if (bt == BTWHILE) op->o_jump = bop - prog->p_op;
+            } while (bt == BTBREAK);
+        }
+    }
+
+/* While and endwhile should match! */
+    if (open >= 0) {
+        mlwrite("%%!WHILE with no matching !ENDWHILE in '%s'", bp->b_bname);
+        goto fail;
+    }
+
+/* Now all the lines are known, resolve !goto labels (which must start
+ * their line) and where a false !if goes to.
+ */
+    for (op = prog->p_op; op < prog->p_op + prog->p_nops; op++) {
+        if (op->o_dir == DIF || op->o_dir == DELSE) set_skip(prog, op);
+        if (op->o_dir != DGOTO) continue;
+        token(op->o_cmd, golabel, NPAT);
+        len = strlen(golabel);
+        for (i = 0; i < prog->p_nops; i++) {
+            if (prog->p_op[i].o_label &&
+                strncmp(prog->p_op[i].o_text+1, golabel, len) == 0) {
+                op->o_jump = i;
+                break;
+            }
+        }
+    }
+    return prog;
+
+fail:
+    prog_free(prog);
+    return NULL;
+}
+
+/*
+ * Split a compiled line into tokens the first time it is run, and look
+ * up its command if it is a plain one, optionally with a numeric
+ * argument, so docmd_op() can run it.
+ * Anything else (a command name from a variable, reexecute...) is left
+ * to docmd().
+ *
+ * struct mac_op *op;                   compiled line
+ */
+static void op_prepare(struct mac_op *op) {
+    char tkn[NSTRING];
+    char *src;
+    char *next;
+    int nargs = 0;
+    struct mac_arg *ap;
+
+    for (src = op->o_text; ; src = next) {
+        while (*src == ' ' || *src == '\t') ++src;
+        if (*src == 0) break;
+        next = token(src, tkn, NSTRING);
+        op->o_args = Xrealloc(op->o_args, (nargs + 2) * sizeof(struct mac_arg));
+        ap = op->o_args + nargs++;
+        ap->a_start = src;
+        ap->a_next = next;
+        ap->a_len = strlen(tkn);
+        ap->a_text = Xmalloc(ap->a_len + 1);
+        memcpy(ap->a_text, tkn, ap->a_len + 1);
+        ap->a_slot = -1;
+    }
+    if (nargs == 0) op->o_args = Xmalloc(sizeof(struct mac_arg));
+    op->o_args[nargs].a_start = NULL;
+
+    if ((op->o_dir != -1 && op->o_dir != DFORCE) || op->o_text[0] == '*')
+        return;
+    op->o_f = FALSE;
+    op->o_n = 1;
+    exec_args = op->o_args;
+    ap = cached_arg(op->o_cmd);
+    if (ap && gettyp(ap->a_text) == TKLIT) {
+        op->o_f = TRUE;
+        op->o_n = atoi(ap->a_text);
+        ap = cached_arg(ap->a_next);
+    }
+    if (ap == NULL || gettyp(ap->a_text) != TKCMD) return;
+    if (strcmp(ap->a_text, "reexecute") == 0) return;
+    if ((op->o_nbp = name_info(ap->a_text)) != NULL) op->o_argp = ap->a_next;
 }
 
 /*
@@ -978,38 +1391,43 @@ static void freewhile(struct while_block *wp) {
  *      !force          Force macro to continue...even if command fails
  *      !while (cond)   Execute a loop if the condition is true
  *      !endwhile
+ *      !local %var...  Make user variables local to this run of the buffer
  *
  *      Line Labels begin with a "*" as the first nonblank char, like:
  *
  *      *LBL01
  *
+ * The buffer is compiled first (see struct mac_op). A procedure keeps
+ * this until it is changed, anything else is compiled for each run.
+ *
  * NOTE! NOTE! NOTE! NOTE! NOTE! NOTE! NOTE! NOTE! NOTE! NOTE! NOTE
  * This routine sets the buffer to be read-only while running it,
  * so it is IMPORTANT to ensure that any exit goes via the code
- * to restore the original setting - by "goto single_exit" not "return".
+ * to restore the original setting - by "goto failexit" not "return".
  *
  * struct buffer *bp;           buffer to execute
  */
 int dobuf(struct buffer *bp) {
     int status;             /* status return */
-    struct line *lp;        /* pointer to line to execute */
-    struct line *hlp;       /* pointer to line header */
-    struct line *glp;       /* line to goto */
+    struct mac_prog *prog;  /* compiled buffer */
+    struct mac_op *op;      /* compiled line to execute */
+    struct mac_arg *oldargs;    /* tokens of any line that called us */
+    struct local_var *locals;   /* variables made local by !local */
+    struct local_var *lvp;
     struct line *mp;        /* Macro line storage temp */
+    int pc;                 /* index of line to execute */
     int dirnum;             /* directive index */
     int linlen;             /* length of line to execute */
-    int i;                  /* index */
     int c;                  /* temp character */
     int force;              /* force TRUE result? */
     struct window *wp;              /* ptr to windows to scan */
-    struct while_block *whlist;     /* ptr to !WHILE list */
-    struct while_block *scanner;    /* ptr during scan */
-    struct while_block *whtemp;     /* temporary ptr to a struct while_block */
-    char *einit;            /* initial value of eline */
-    char *eline;            /* text of line to execute */
     char tkn[NSTRING];      /* buffer to evaluate an expresion in */
+    struct value cond = VALUE_INIT; /* !if or !while condition */
     int return_stat = TRUE; /* What we expect to do */
     int orig_pause_key_index_update;    /* State on entry - to be restored */
+    int prof_idx = -1;      /* profile entry of the line being run */
+    unsigned int prof_gen = 0;  /* ...its prof_generation */
+    long long prof_start = 0;   /* ...and when it started */
 
 /* GGR - Only allow recursion up to a certain level... */
 
@@ -1028,94 +1446,51 @@ int dobuf(struct buffer *bp) {
     orig_pause_key_index_update = pause_key_index_update;
     pause_key_index_update = 1;
 
-/* Clear IF level flags/while ptr */
+/* Clear IF level flags */
     execlevel = 0;
-    whlist = NULL;
-    scanner = NULL;
-
-/* Scan the buffer to execute, building WHILE header blocks */
-    hlp = bp->b_linep;
-    lp = hlp->l_fp;
-    while (lp != hlp) {
-/* Scan the current line */
-        eline = lp->l_text;
-        i = lp->l_used;
-
-/* Trim leading whitespace */
-        while (i-- > 0 && (*eline == ' ' || *eline == '\t')) ++eline;
-
-/* If there's nothing here, don't bother */
-        if (i <= 0) goto nxtscan;
-
-/* If is a while directive, make a block... */
-        if (eline[0] == '!' && eline[1] == 'w' && eline[2] == 'h') {
-            whtemp = Xmalloc(sizeof(struct while_block));
-            whtemp->w_begin = lp;
-            whtemp->w_type = BTWHILE;
-            whtemp->w_next = scanner;
-            scanner = whtemp;
-        }
-
-/* If is a BREAK directive, make a block... */
-        if (eline[0] == '!' && eline[1] == 'b' && eline[2] == 'r') {
-            if (scanner == NULL) {
-                mlwrite_one("%!BREAK outside of any !WHILE loop");
-                goto failexit2;
-            }
-            whtemp = Xmalloc(sizeof(struct while_block));
-            whtemp->w_begin = lp;
-            whtemp->w_type = BTBREAK;
-            whtemp->w_next = scanner;
-            scanner = whtemp;
-        }
+    oldargs = exec_args;
+    locals = NULL;
 
-/* If it is an endwhile directive, record the spot... */
-        if (eline[0] == '!' && strncmp(eline+1, "endw", 4) == 0) {
-            if (scanner == NULL) {
-                mlwrite("%%!ENDWHILE with no preceding !WHILE in '%s'",
-                     bp->b_bname);
-                goto failexit2;
-            }
-/* move top records from the scanner list to the whlist until we have
- * moved all BREAK records and one WHILE record.
+/* Get the compiled buffer, compiling it if need be.
+ * It is kept until the buffer changes (see proc_free()).
  */
-            do {
-                scanner->w_end = lp;
-                whtemp = whlist;
-                whlist = scanner;
-                scanner = scanner->w_next;
-                whlist->w_next = whtemp;
-            } while (whlist->w_type == BTBREAK);
-        }
-
-        nxtscan:          /* on to the next line */
-        lp = lp->l_fp;
-    }
-
-/* While and endwhile should match! */
-    if (scanner != NULL) {
-        mlwrite("%%!WHILE with no matching !ENDWHILE in '%s'", bp->b_bname);
-        goto failexit2;
+    if ((prog = bp->b_prog) == NULL) {
+        if ((prog = proc_compile(bp)) == NULL) goto failexit2;
+        bp->b_prog = prog;
     }
+    prog->p_busy++;
 
 /* Let the first command inherit the flags from the last one.. */
     thisflag = lastflag;
 
 /* Starting at the beginning of the buffer */
-    hlp = bp->b_linep;
-    lp = hlp->l_fp;
-    while (lp != hlp) {
-/* Allocate eline and copy macro line to it */
-        linlen = lp->l_used;
-        einit = eline = Xmalloc(linlen + 1);
-        memcpy(eline, lp->l_text, linlen);
-        eline[linlen] = 0;      /* make sure it ends */
-
-/* trim leading whitespace */
-        while (*eline == ' ' || *eline == '\t') ++eline;
-
-/* dump comments and blank lines */
-        if (*eline == ';' || *eline == 0) goto onward;
+    pc = 0;
+    while (pc < prog->p_nops) {
+        op = prog->p_op + pc;
+        if (op->o_args == NULL) op_prepare(op);
+        exec_args = op->o_args;
+
+/* When profiling, the line just run takes the time up to now (so
+ * includes any procedure it ran) and this one starts, unless it is only
+ * being stored (the body of a store-procedure, up to its !endm).
+ */
+        if (prof_idx >= 0 || macro_profile) {
+            long long now = prof_now();
+            if (prof_idx >= 0) {
+                prof_add(prof_idx, prof_gen, now - prof_start);
+                prof_idx = -1;
+            }
+            if (macro_profile && !mstore) {
+                if (op->o_profgen != prof_generation) {
+                    op->o_prof = prof_entry(bp->b_fname[0]?
+                         bp->b_fname: bp->b_bname, op->o_lineno, op->o_text);
+                    op->o_profgen = prof_generation;
+                }
+                prof_idx = op->o_prof;
+                prof_gen = prof_generation;
+                prof_start = now;
+            }
+        }
 
 #if DEBUGM
 /* If $debug == TRUE, every line to execute gets echoed and a key needs
@@ -1135,22 +1510,9 @@ int dobuf(struct buffer *bp) {
             strcat(outline, ":");
 
 /* and lastly the line. GGR - if line > 80 chars, chop it */
-            if (strlen(eline) > 80) strncat(outline, eline, 80);
-            else                    strcat(outline, eline);
+            if (strlen(op->o_text) > 80) strncat(outline, op->o_text, 80);
+            else                         strcat(outline, op->o_text);
             strcat(outline, ">>>");
-#if 0
-/* Change all '%' to ':' so mlwrite won't expect arguments */
-            sp = outline;
-            while (*sp)
-                if (*sp++ == '%') {
-                    ep = --sp;          /* Advance to the end */
-                    while (*ep++);
-                    *(ep + 1) = 0;      /* Null terminate the string */
-                    while (ep-- > sp)   /* copy backwards */
-                        *(ep + 1) = *ep;
-                    sp += 2;            /* and advance sp past the new % */
-                }
-#endif
 
 /* Write out the debug line */
             mlforce(outline);
@@ -1166,76 +1528,63 @@ int dobuf(struct buffer *bp) {
         }
 #endif
 
-/* Parse directives here.... */
-        dirnum = -1;
-        if (*eline == '!') {
-/* Find out which directive this is */
-            ++eline;
-            for (dirnum = 0; dirnum < NUMDIRS; dirnum++)
-                if (strncmp(eline, dname[dirnum],
-                    strlen(dname[dirnum])) == 0)
-                break;
+/* Check the directive.... */
+        dirnum = op->o_dir;
 
-/* and bitch if it's illegal */
-            if (dirnum == NUMDIRS) {
-                mlwrite_one("%Unknown Directive");
-                goto failexit2;
-            }
+/* bitch if it's illegal */
+        if (dirnum == NUMDIRS) {
+            mlwrite_one("%Unknown Directive");
+            goto failexit2;
+        }
 
 /* service only the !ENDM macro here */
-            if (dirnum == DENDM) {
-                if (ptt_storing) {
-                    ptt_compile(bstore);
-                    ptt_storing = 0;
-                }
-                mstore = FALSE;
-                bstore = NULL;
-                goto onward;
+        if (dirnum == DENDM) {
+            if (ptt_storing) {
+                ptt_compile(bstore);
+                ptt_storing = 0;
             }
-
-/* Restore the original eline.... */
-            --eline;
+            mstore = FALSE;
+            bstore = NULL;
+            goto onward;
         }
 
 /* If macro store is on, just salt this away */
         if (mstore) {
 /* Allocate the space for the line */
-            linlen = strlen(eline);
-            if ((mp = lalloc(linlen)) == NULL) {
+            linlen = strlen(op->o_text);
+            if ((mp = lalloc(bstore, linlen)) == NULL) {
                 mlwrite_one ("Out of memory while storing macro");
-                bp->b_exec_level--;
-                pause_key_index_update = orig_pause_key_index_update;
                 status = FALSE;
-                goto single_exit;
+                goto failexit;
             }
 
 /* Copy the text into the new line */
-            lfillchars(mp, linlen, eline);
+            lfillchars(mp, linlen, op->o_text);
 
 /* Attach the line to the end of the buffer */
             bstore->b_linep->l_bp->l_fp = mp;
             mp->l_bp = bstore->b_linep->l_bp;
             bstore->b_linep->l_bp = mp;
             mp->l_fp = bstore->b_linep;
+            lindex_insert(bstore, mp);
+            proc_free(bstore);
             goto onward;
         }
         force = FALSE;
 
 /* Dump comments */
-        if (*eline == '*') goto onward;
+        if (op->o_text[0] == '*') goto onward;
 
 /* Now, execute directives */
         if (dirnum != -1) {
-/* Skip past the directive */
-            while (*eline && *eline != ' ' && *eline != '\t') ++eline;
-            execstr = eline;
+            execstr = op->o_cmd;
 
             switch (dirnum) {
             case DIF:       /* IF directive */
 /* Grab the value of the logical exp */
                 if (execlevel == 0) {
-                    if (macarg(tkn) != TRUE) goto eexec;
-                    if (stol(tkn) == FALSE) ++execlevel;
+                    if (macarg_val(&cond) != TRUE) goto eexec;
+                    if (val_log(&cond) == FALSE) goto skip;
                 }
                 else ++execlevel;
                 goto onward;
@@ -1243,35 +1592,25 @@ int dobuf(struct buffer *bp) {
             case DWHILE:    /* WHILE directive */
 /* Grab the value of the logical exp */
                 if (execlevel == 0) {
-                    if (macarg(tkn) != TRUE) goto eexec;
-                    if (stol(tkn) == TRUE) goto onward;
+                    if (macarg_val(&cond) != TRUE) goto eexec;
+                    if (val_log(&cond) == TRUE) goto onward;
                 }
 /* Drop down and act just like !BREAK */
                 /* Falls through */
             case DBREAK:    /* BREAK directive */
                 if (dirnum == DBREAK && execlevel) goto onward;
 
-/* Jump down to the endwhile
- * Find the right while loop
- */
-                whtemp = whlist;
-                while (whtemp) {
-                    if (whtemp->w_begin == lp) break;
-                    whtemp = whtemp->w_next;
-                }
-
-                if (whtemp == NULL) {
+/* Jump down to the endwhile */
+                if (op->o_jump < 0) {
                     mlwrite_one("%Internal While loop error");
                     goto failexit2;
                 }
-
-/* Reset the line pointer back.. */
-                lp = whtemp->w_end;
+                pc = op->o_jump;
                 goto onward;
 
             case DELSE:     /* ELSE directive */
                 if (execlevel == 1) --execlevel;
-                else if (execlevel == 0) ++execlevel;
+                else if (execlevel == 0) goto skip;
                 goto onward;
 
             case DENDIF:    /* ENDIF directive */
@@ -1281,20 +1620,11 @@ int dobuf(struct buffer *bp) {
             case DGOTO:     /* GOTO directive */
 /* .....only if we are currently executing */
                 if (execlevel == 0) {
-/* Grab label to jump to */
-                    eline = token(eline, golabel, NPAT);
-                    linlen = strlen(golabel);
-                    glp = hlp->l_fp;
-                    while (glp != hlp) {
-                        if (*glp->l_text == '*' &&
-                            (strncmp(&glp->l_text[1], golabel, linlen) == 0)) {
-                            lp = glp;
-                            goto onward;
-                        }
-                        glp = glp->l_fp;
+                    if (op->o_jump < 0) {
+                        mlwrite_one("%No such label");
+                        goto failexit2;
                     }
-                    mlwrite_one("%No such label");
-                    goto failexit2;
+                    pc = op->o_jump;
                 }
                 goto onward;
 
@@ -1308,22 +1638,13 @@ int dobuf(struct buffer *bp) {
                     goto onward;
                 }
                 else {
-/* Find the right while loop */
-                    whtemp = whlist;
-                    while (whtemp) {
-                        if (whtemp->w_type == BTWHILE &&
-                            whtemp->w_end == lp) break;
-                        whtemp = whtemp->w_next;
-                    }
-
-                    if (whtemp == NULL) {
+                    if (op->o_jump < 0) {
                         mlwrite_one("%Internal While loop error");
                         goto failexit2;
                     }
-
-/* reset the line pointer back.. */
-                    lp = whtemp->w_begin->l_bp;
-                    goto onward;
+/* Go back to the !while itself */
+                    pc = op->o_jump;
+                    continue;
                 }
 
             case DFORCE:    /* FORCE directive */
@@ -1336,12 +1657,41 @@ int dobuf(struct buffer *bp) {
                     goto eexec;
                 }
                 goto onward;
+
+            case DLOCAL:    /* LOCAL directive */
+/* Each variable starts empty, and gets its old value back when we exit.
+ * If it is already local here it is just emptied again.
+ */
+                if (execlevel) goto onward;
+                while (1) {
+                    execstr = token(execstr, tkn, NVSIZE + 1);
+                    if (tkn[0] == '\0') break;
+                    if (gettyp(tkn) != TKVAR) {
+                        mlwrite("%%Not a user variable: %s", tkn);
+                        goto failexit2;
+                    }
+                    lvp = Xmalloc(sizeof(struct local_var));
+                    lvp->lv_slot = uv_local(tkn+1, &lvp->lv_saved);
+                    for (struct local_var *tp = locals; tp; tp = tp->lv_next)
+                        if (tp->lv_slot == lvp->lv_slot) {
+                            free(lvp->lv_saved);
+                            free(lvp);
+                            lvp = NULL;
+                            break;
+                        }
+                    if (lvp) {
+                        lvp->lv_next = locals;
+                        locals = lvp;
+                    }
+                }
+                goto onward;
             }
         }
 
 /* Execute the statement */
 
-        status = docmd(eline);
+        if (op->o_nbp) status = docmd_op(op);
+        else           status = docmd(op->o_cmd);
         if (force) status = TRUE;       /* force the status */
 
 /* Check for a command error */
@@ -1350,26 +1700,34 @@ int dobuf(struct buffer *bp) {
             wp = wheadp;
             while (wp != NULL) {
                 if (wp->w_bufp == bp) { /* And point it */
-                    wp->w_dotp = lp;
+                    wp->w_dotp = op->o_lp;
                     wp->w_doto = 0;
                     wp->w_flag |= WFHARD;
                 }
                 wp = wp->w_wndp;
             }
 /* In any case set the buffer . */
-            bp->b_dotp = lp;
+            bp->b_dotp = op->o_lp;
             bp->b_doto = 0;
-            free(einit);
             execlevel = 0;
-            freewhile(whlist);
-            bp->b_exec_level--;
-            pause_key_index_update = orig_pause_key_index_update;
-            goto single_exit;
+            goto failexit;
         }
+        goto onward;
+
+/* Skip the rest of a false !if, or the !else part of a true one.
+ * When debugging step through it instead, so every line gets shown.
+ */
+skip:
+        if (macbug) {
+            ++execlevel;
+            goto onward;
+        }
+        pc = op->o_skip;
+        execlevel = op->o_skiplevel;
+        continue;
 
 onward:                 /* On to the next line */
-        free(einit);
-        lp = lp->l_fp;
+        pc++;
     }
 
 eexec:                  /* Exit the current function */
@@ -1382,12 +1740,19 @@ failexit2:
     status = FALSE;
 
 failexit:
-    freewhile(whlist);
+    if (prof_idx >= 0) prof_add(prof_idx, prof_gen, prof_now() - prof_start);
+    while (locals) {
+        lvp = locals;
+        locals = lvp->lv_next;
+        uv_unlocal(lvp->lv_slot, lvp->lv_saved);
+        free(lvp);
+    }
+    val_free(&cond);
+    exec_args = oldargs;
+    if (prog && --prog->p_busy == 0 && prog != bp->b_prog) prog_free(prog);
     bp->b_exec_level--;
     pause_key_index_update = orig_pause_key_index_update;
 
-single_exit:
-
 /* Revert to original read-only status if it wasn't set */
 
     if (!orig_view_bit) bp->b_mode &= ~MDVIEW;
@@ -17,7 +17,13 @@
 #include "line.h"
 
 /* Max number of lines from one file. */
-#define MAXNLINE 10000000
+#define MAXNLINE 100000000
+
+/* How often to report progress when reading a file.
+ * Reading is now quick enough that anything more frequent just means
+ * we spend our time updating the message line.
+ */
+#define READ_REPORT 100000
 
 /* Read a file into the current buffer.
  * This is really easy; all you do is find the name of the file and
@@ -77,9 +83,8 @@ static int resetkey(void) { /* Reset the encryption key if needed */
  * Return the final status of the read.
  */
 static int ifile(char *fname) {
-    struct line *lp0;
     struct line *lp1;
-    struct line *lp2;
+    struct line *first, *last;
     struct buffer *bp;
     int s;
     int nline;
@@ -110,35 +115,38 @@ static int ifile(char *fname) {
     curwp->w_markp = curwp->w_dotp;
     curwp->w_marko = 0;
 
+/* Collect the lines into a chain, which is linked in once read */
     nline = 0;
+    first = last = NULL;
     int dos_include = 0;
     while ((s = ffgetline()) == FIOSUC) {
         lp1 = fline;            /* Allocate by ffgetline..*/
-        lp0 = curwp->w_dotp;    /* line previous to insert */
-        lp2 = lp0->l_fp;        /* line after insert */
-
-/* Re-link new line between lp0 and lp2 */
-        lp2->l_bp = lp1;
-        lp0->l_fp = lp1;
-        lp1->l_bp = lp0;
-        lp1->l_fp = lp2;
-
-/* And advance and write out the current line */
-        curwp->w_dotp = lp1;
+        if (first == NULL) first = lp1;
+        else {
+            last->l_fp = lp1;
+            lp1->l_bp = last;
+        }
+        last = lp1;
         ++nline;
 
 /* Check for a DOS line ending on line 1 */
-        if (nline == 1 && lp1->l_text[lp1->l_used-1] == '\r')
+        if (nline == 1 && lp1->l_used && lp1->l_text[lp1->l_used-1] == '\r')
             dos_include = 1;
-        if (dos_include && lp1->l_text[lp1->l_used-1] == '\r') {
+        if (dos_include && lp1->l_used &&
+             lp1->l_text[lp1->l_used-1] == '\r') {
              lp1->l_used--;             /* Remove the trailing CR */
         }
 
-        if (!(nline % 300) && !silent)      /* GGR */
+        if (!(nline % READ_REPORT) && !silent)  /* GGR */
              mlwrite(MLbkt("Inserting file") " : %d lines", nline);
 
     }
     ffclose();              /* Ignore errors. */
+    if (first != NULL) {
+        curwp->w_dotp = lforw(curwp->w_dotp);
+        linsert_lines(first, last);
+        curwp->w_dotp = last;
+    }
     curwp->w_markp = lforw(curwp->w_markp);
     strcpy(readin_mesg, MLpre);
     if (s == FIOERR) {
@@ -432,19 +440,24 @@ int readin(char *fname, int lockfl) {
  * so a file can be re-read with the required autodos setting.
  */
         if (nline == 1) {
-            if (autodos && lp1->l_text[lp1->l_used-1] == '\r')
+            if (autodos && lp1->l_used &&
+                 lp1->l_text[lp1->l_used-1] == '\r')
                 curbp->b_mode |= MDDOSLE;
             else
                 curbp->b_mode &= ~MDDOSLE;
         }
-        if ((curbp->b_mode & MDDOSLE) != 0 &&
+        if ((curbp->b_mode & MDDOSLE) != 0 && lp1->l_used &&
              lp1->l_text[lp1->l_used-1] == '\r') {
              lp1->l_used--;             /* Remove the trailing CR */
         }
-        if (!(nline % 300) && !silent)  /* GGR */
+        if (!(nline % READ_REPORT) && !silent)  /* GGR */
             mlwrite(MLbkt("Reading file") " : %d lines", nline);
     }
     ffclose();                          /* Ignore errors. */
+/* The lines were linked in by hand, so any index built (e.g. by the
+ * M-FNR hook looking at $curline) is for the empty buffer.
+ */
+    lindex_drop(curbp);
     if (!silent) strcpy(readin_mesg, MLpre);
     if (s == FIOERR) {
         if (!silent) strcat(readin_mesg, "I/O ERROR, ");
@@ -7,8 +7,10 @@
  */
 
 #include <stdio.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include "estruct.h"
 #include "edef.h"
 #include "efunc.h"
@@ -18,18 +20,26 @@
 #include "utf8proc.h"
 
 static FILE *ffp;                       /* File pointer, all functions. */
-static int eofflag;                     /* end-of-file flag */
 
-/* The cache.
- * Used for reading and writing as only one can be active at any one time.
- */
+/* The write cache. */
 #define CSIZE 8192
 static struct {
     char buf[CSIZE];
-    int rst;                /* Read pointer */
-    int len;                /* Valid tot chars (write) or past rst (read) */
+    int rst;                /* Set once the first line is written */
+    int len;                /* Valid tot chars */
 } cache;
 
+/* The text of the file being read.
+ * The whole file is read in at once, into a block which is handed over
+ * to the text store of the current buffer. ffgetline() then returns
+ * lines which point into this.
+ */
+static struct {
+    char *text;
+    size_t len;
+    size_t rst;             /* Read pointer */
+} ftext;
+
 /*
  * Save the first FILE_START_LEN bytes of each file written for
  * binary/text checking (excludes any newlines).
@@ -84,10 +94,10 @@ int ffropen(char *fn) {
     }
 
 /* Unset these on open */
-    cache.rst = cache.len = 0;
+    ftext.text = NULL;
+    ftext.len = ftext.rst = 0;
     curbp->b_EOLmissing = 0;
     fline = NULL;
-    eofflag = FALSE;
 
     return FIOSUC;
 }
@@ -100,6 +110,12 @@ int ffwopen(char *fn) {
 #if (BSD | USG)
     fixup_fname(fn);
 #endif
+/* If we have this file mapped in any buffer we have to stop using that
+ * before we truncate it.
+ */
+    struct stat statbuf;
+    if (stat(fn, &statbuf) == 0) lstore_unmap(statbuf.st_dev, statbuf.st_ino);
+
 /* Opening for writing displays errors here */
     if ((ffp = fopen(fn, "w")) == NULL) {
         if (errno == EISDIR)    /* Can't open a dir for writing */
@@ -131,7 +147,7 @@ int ffwopen(char *fn) {
 int ffclose(void) {
 
     fline = NULL;
-    eofflag = FALSE;
+    ftext.text = NULL;
 
 #if USG | BSD
     if (fclose(ffp) != FALSE) {
@@ -301,87 +317,106 @@ int ffputline(char *buf, int nbuf) {
 }
 
 /*
- * Read a line from a file, and store the bytes into a global, Xmalloc()ed
- * buffer (fline).
- * Complain about lines at the end of the file that don't have a newline.
- * Check for I/O errors too. Return status.
+ * Read the whole of the file into a block and add that to the text store
+ * of the current buffer.
+ * If we can, we just mmap() it, so nothing is actually read until it is
+ * looked at (and then only once). We can't for crypted files (we need to
+ * alter the text) so those, and anything that mmap() won't handle, are
+ * read. Then we start with what we expect the size to be but allow for
+ * it having grown since then.
  */
+static int ffreadall(void) {
+    struct stat statbuf;
+    size_t size, got;
+    char *text;
+    int have_stat;
+
+    have_stat = (fstat(fileno(ffp), &statbuf) == 0);
+    if (have_stat && !cryptflag && statbuf.st_size > 0 &&
+         (statbuf.st_mode & S_IFMT) == S_IFREG) {
+        size = statbuf.st_size;
+        text = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(ffp), 0);
+        if (text != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+            madvise(text, size, MADV_SEQUENTIAL);
+#endif
+            struct text_block *tbp = lstore_add(curbp, text, size);
+            tbp->tb_mapped = 1;
+            tbp->tb_dev = statbuf.st_dev;
+            tbp->tb_ino = statbuf.st_ino;
+            ftext.text = text;
+            ftext.len = size;
+            ftext.rst = 0;
+            return FIOSUC;
+        }
+    }
 
-/* Helper routine to add text into fline, re-allocating it if required */
-static int add_to_fline(int len) {
-
-    int newlen = -1;
-    if (fline == NULL) {
-        newlen = len;
+    if (have_stat) size = statbuf.st_size;
+    else           size = CSIZE;
+    text = Xmalloc(size + 1);
+    got = 0;
+    while (1) {     /* Ask for one more byte than we expect to get */
+        got += fread(text + got, sizeof(*text), size + 1 - got, ffp);
+        if (got <= size) break;
+        size += size/2 + CSIZE;
+        text = Xrealloc(text, size + 1);
     }
-    else if (len >= (fline->l_size - fline->l_used)) {
-        newlen = len + fline->l_used;
+    if (ferror(ffp)) {
+        free(text);
+        mlwrite_one("File read error");
+        return FIOERR;
     }
-    if (newlen >= 0) {      /* Need a new/bigger fline */
-        struct line *nl = lalloc(newlen);
-        if (nl == NULL) return FALSE;
-        if (fline) {
-            nl->l_used = fline->l_used;
-            memcpy(nl->l_text, fline->l_text, fline->l_used);
-            free(fline);
+    if (cryptflag) {    /* myencrypt() only takes an unsigned length */
+        for (size_t done = 0; done < got; done += CSIZE) {
+            size_t todo = got - done;
+            if (todo > CSIZE) todo = CSIZE;
+            myencrypt(text + done, todo);
         }
-        else
-            nl->l_used = 0; /* Need to set to how much is in there *now* */
-        fline = nl;
     }
-    memcpy(fline->l_text+fline->l_used, cache.buf+cache.rst, len);
-    fline->l_used += len;   /* Record the real size of the line */
-    cache.rst += len;       /* Advance cache read-pointer */
-    cache.len -= len;       /* Decrement left-to-read counter */
-    return TRUE;
+    lstore_add(curbp, text, got);
+    ftext.text = text;
+    ftext.len = got;
+    ftext.rst = 0;
+    return FIOSUC;
 }
 
-/* The actual callable function */
+/*
+ * Read a line from a file, and set the global line (fline) to point to it.
+ * The line's text is not copied - it is in the buffer's text store.
+ * Complain about lines at the end of the file that don't have a newline.
+ * Check for I/O errors too. Return status.
+ */
 int ffgetline(void) {
+    char *sp, *nlp;
+    size_t left, cc;
 
     fline = NULL;       /* Start afresh */
 
-/* Do we have a newline in our cache */
-
-    char *nlp = NULL;
-    while (!nlp) {
-        nlp = memchr(cache.buf+cache.rst, '\n', cache.len);
-        if (!nlp) {
-            if (!add_to_fline(cache.len))
-                return FIOMEM;      /* Only reason for failure */
-            cache.len = fread(cache.buf, sizeof(*cache.buf),
-                sizeof(cache.buf), ffp);
-            cache.rst = 0;
-/* If we are at the end...return it.
- * But - if we still have cached data then there was no final
- * newline, but we still have to return that, and warn about the
- * missing newline.
- */
-            if (eofflag && (cache.len == 0)) {
-                if (fline->l_used) {
-                    curbp->b_EOLmissing = 1;
-                    mlforce("Newline absent at end of file. Added....");
-                    sleep(1);
-                }
-                return fline->l_used? FIOSUC: FIOEOF;
-            }
-            if (cache.len != sizeof(cache.buf)) { /* short read - why? */
-                if (feof(ffp)) {
-                    eofflag = TRUE;
-                }
-                else {
-                    mlwrite_one("File read error");
-                    return FIOERR;
-                }
-            }
-            if (cryptflag) myencrypt(cache.buf, cache.len);
-        }
+    if (ftext.text == NULL) {   /* First call - read it all */
+        int status = ffreadall();
+        if (status != FIOSUC) return status;
     }
-    int cc = nlp - (cache.buf+cache.rst);
-    if (!add_to_fline(cc)) return FIOMEM;
-    cache.rst++;        /* Step over newline */
-    cache.len--;        /* Step over newline */
-
+    if (ftext.rst >= ftext.len) return FIOEOF;
+
+    sp = ftext.text + ftext.rst;
+    left = ftext.len - ftext.rst;
+    nlp = memchr(sp, '\n', left);
+    if (nlp) {
+        cc = nlp - sp;
+        ftext.rst += cc + 1;    /* Step over newline */
+    }
+    else {
+        cc = left;
+        ftext.rst += cc;
+        curbp->b_EOLmissing = 1;
+        mlforce("Newline absent at end of file. Added....");
+        sleep(1);
+    }
+    if (cc > INT_MAX) {     /* A line can't be this long */
+        mlwrite_one("Line too long");
+        return FIOMEM;
+    }
+    fline = lalloc_shared(curbp, sp, cc);
     return FIOSUC;
 }
 
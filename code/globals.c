@@ -51,11 +51,7 @@ char *cname[] = {               /* names of colors              */
             , "HIGH"
 #endif
 };
-struct kill *kbufp = NULL;      /* current kill buffer chunk pointer    */
-struct kill *kbufh[] = {[0 ... KRING_SIZE-1] = NULL};
-                                /* kill buffer header pointers          */
-int kused[] = {[0 ... KRING_SIZE-1] = KBLOCK};
-                                /* # of bytes used in kill buffer       */
+struct kill kbuf[KRING_SIZE];   /* the kill ring                        */
 struct window *swindow = NULL;  /* saved window pointer                 */
 int cryptflag = FALSE;          /* currently encrypting?                */
 int *kbdptr;                    /* current position in keyboard buf */
@@ -120,6 +116,7 @@ char *dname[] = {
         "while", "endwhile", "break",
         "force"
         , "finish"              /* GGR */
+        , "local"
 };
 
 #if     DEBUGM
@@ -153,6 +150,11 @@ int hscroll = FALSE;
 int hjump = 1;
 int autodos = TRUE;     /* Default is to do the check */
 int showdir_tokskip = -1;
+int magic_dfa = TRUE;   /* Use the compiled matcher for MAGIC searches */
+int search_threads = 0; /* Worker threads for literal searches (< 2 - none) */
+int max_fps = 60;       /* Redisplay rate limit with typeahead (0 - none) */
+int undo_budget = 4194304;  /* Undo memory per buffer (0 - no undo) */
+int macro_profile = FALSE;  /* Time macro lines and commands */
 
 const char kbdmacro_buffer[] = "//kbd_macro";
 struct buffer *kbdmac_bp = NULL;
@@ -7,6 +7,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -245,7 +246,7 @@ static char *getnname(char *name, int namelen) {
  */
 extern int *envvar_index;
 extern int *usrvar_index;
-extern char *uvnames[];
+extern char **uvnames;
 extern struct evlist evl[];
 
 /* Since we know the string will be copied immediately after return we
@@ -649,6 +650,11 @@ static int ensure_uppercase(int c) {
     return c;
 }
 
+/* Set by getcmd() when it has read the start of a bracketed paste, so
+ * that bracketed_paste() knows the text is there to be read.
+ */
+static int paste_started = FALSE;
+
 /* getcmd: Get a command from the keyboard.
  *         Process all applicable prefix keys
  */
@@ -679,6 +685,21 @@ handle_CSI:
             d = get1key();
             if (d == '~')   /* ESC [ n ~   P.K. */
                 return SPEC | c | cmask;
+/* ESC [ 2 0 0 ~ and ESC [ 2 0 1 ~ start and end a bracketed paste, but
+ * ESC [ 2 0 ~ is F9, so only take it as a paste if it is all there.
+ * Anything else is mapped as below, with its third byte as the tilde.
+ */
+            if (c == '2' && d == '0') {
+                int e = get1key();
+                if ((e == '0' || e == '1') && get1key() == '~') {
+                    if (e == '0') {     /* Start of a bracketed paste */
+                        paste_started = TRUE;
+                        return PASTEKEY;
+                    }
+                    return getcmd();    /* Ignore a stray end */
+                }
+                return SPEC | (d + 48) | cmask;
+            }
             switch (c) {    /* ESC [ n n ~ P.K. */
             case '1':
                 c = d + 32;
@@ -749,6 +770,76 @@ proc_ctlxc:
     return c;
 }
 
+/* bracketed_paste: Insert the text of a bracketed paste.
+ *         Bound to PASTEKEY, which getcmd() returns when the terminal
+ *         sends ESC [ 200 ~. Everything up to ESC [ 201 ~ is read in one
+ *         go and inserted with linsert_block(), rather than each character
+ *         being run as a command, so nothing like word-wrap or phonetic
+ *         translation is applied to it. The terminal sends newlines as
+ *         CRs, so these are turned back into newlines.
+ */
+#define PASTE_RECLEN 128    /* Most bytes per insert-raw-string recorded */
+
+int bracketed_paste(int f, int n) {
+    char *text, *ip, *op, *end;
+    char piece[PASTE_RECLEN + 1];
+    int len, plen, status;
+
+    UNUSED(f); UNUSED(n);
+    if (!paste_started) {       /* Not run by the terminal */
+        mlwrite_one(MLbkt("No paste to insert"));
+        return FALSE;
+    }
+    paste_started = FALSE;
+    text = ttgetpaste(&len);
+    end = text + len;
+    for (ip = op = text; ip < end; ip++) {
+        if (*ip == '\r') {
+            if (ip + 1 < end && ip[1] == '\n') ip++;
+            *op++ = '\n';
+        }
+        else *op++ = *ip;
+    }
+    end = op;
+    status = linsert_block(text, end - text);
+
+/* A keyboard macro can't replay the paste itself, so record the text.
+ * The keys replayed get the characters (with CRs for newlines) in place
+ * of the paste sequence, as if they had been typed. The macro buffer
+ * (where bracketed-paste isn't recorded) gets insert-raw-strings, a
+ * piece at a time as macro arguments are limited in length, without
+ * splitting a utf8 sequence.
+ */
+    if (status == TRUE && kbdmode == RECORD) {
+        unicode_t uc;
+        while (kbdptr > kbdm && *--kbdptr != 0x9b && *kbdptr != 0x1b);
+        for (ip = text; ip < end && kbdmode == RECORD; ) {
+            ip += utf8_to_unicode(ip, 0, end - ip, &uc);
+            *kbdptr++ = (uc == '\n')? '\r': uc;
+            kbdend = kbdptr;
+            if (kbdptr == &kbdm[NKBDM - 1]) {   /* as tgetc() */
+                kbdmode = STOP;
+                TTbeep();
+            }
+        }
+    }
+    if (status == TRUE && !inmb && kbdmode == RECORD) {
+        for (ip = text; ip < end; ip += plen) {
+            plen = end - ip;
+            if (plen > PASTE_RECLEN) {
+                plen = PASTE_RECLEN;
+                while (plen > 1 && (ip[plen] & 0xc0) == 0x80) plen--;
+            }
+            memcpy(piece, ip, plen);
+            piece[plen] = '\0';
+            addto_kbdmacro("insert-raw-string", 1, 0);
+            addto_kbdmacro(piece, 0, 1);
+        }
+    }
+    free(text);
+    return status;
+}
+
 /* GGR
  * A version of getstring in which the minibuffer is a true buffer!
  * Note that this loops for each character, so you can manipulate the
@@ -0,0 +1,453 @@
+/*      lindex.c
+ *
+ * A line-number index for a buffer.
+ *
+ * The lines of a buffer are grouped into runs of consecutive lines
+ * ("chunks"), each line pointing at the chunk it is in. The chunks are
+ * kept in buffer order in an array, along with a Fenwick (binary indexed)
+ * tree of their line counts. So the number of a line is the count of lines
+ * in the chunks before its own (O(log n)) plus its position within its
+ * chunk (a short walk), and finding line N is the reverse.
+ *
+ * Each chunk also has the number of bytes in its lines (held in a second
+ * tree, so we also have the byte offset of any line) and, once asked for,
+ * the number of words in them. These are worked out again for a chunk
+ * the next time they are needed after any line in it is altered.
+ *
+ * The index is built when first needed. The line.c primitives keep it
+ * up to date as lines are added and removed, and tell it (lindex_touch(),
+ * through ltouch()) when a line's text changes. Anything else that changes the line list
+ * wholesale (reading a file, narrowing...) just drops it, and it is
+ * rebuilt the next time that it is wanted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+
+#define LCHUNK_FILL 256         /* Lines per chunk when built */
+#define LCHUNK_MAX  512         /* Split a chunk when it gets beyond this */
+
+struct lchunk {
+    struct line *c_first;       /* First line in this chunk */
+    int c_count;                /* Number of lines in it */
+    int c_pos;                  /* Where it is in ix_chunk[] */
+    long c_bytes;               /* Bytes in its lines (as in ix_btree) */
+    long c_words;               /* Words in its lines (-1 == not known) */
+    int c_dirty;                /* c_bytes needs to be recounted */
+};
+
+struct lindex {
+    struct lchunk **ix_chunk;   /* The chunks, in buffer order */
+    int *ix_tree;               /* Fenwick tree of c_count (1-based) */
+    long *ix_btree;             /* Fenwick tree of c_bytes (1-based) */
+    int ix_nchunk;
+    int ix_alloc;               /* Space in ix_chunk[] and ix_tree[] */
+    struct lchunk **ix_dirty;   /* Chunks with c_dirty set */
+    int ix_ndirty;
+    int ix_dalloc;
+};
+
+/* Fenwick tree handling. */
+
+static void tree_add(struct lindex *ix, int pos, int delta) {
+    for (pos++; pos <= ix->ix_nchunk; pos += pos & -pos)
+        ix->ix_tree[pos] += delta;
+}
+static void btree_add(struct lindex *ix, int pos, long delta) {
+    for (pos++; pos <= ix->ix_nchunk; pos += pos & -pos)
+        ix->ix_btree[pos] += delta;
+}
+
+/* Lines in the chunks before chunk "pos" */
+static int tree_prefix(struct lindex *ix, int pos) {
+    int sum = 0;
+    for (; pos > 0; pos -= pos & -pos) sum += ix->ix_tree[pos];
+    return sum;
+}
+/* Bytes in the chunks before chunk "pos" */
+static long btree_prefix(struct lindex *ix, int pos) {
+    long sum = 0;
+    for (; pos > 0; pos -= pos & -pos) sum += ix->ix_btree[pos];
+    return sum;
+}
+
+/* (Re)build the tree from the chunk counts, and number the chunks */
+static void tree_build(struct lindex *ix) {
+    int i, j;
+
+    for (i = 0; i < ix->ix_nchunk; i++) {
+        ix->ix_chunk[i]->c_pos = i;
+        ix->ix_tree[i+1] = ix->ix_chunk[i]->c_count;
+        ix->ix_btree[i+1] = ix->ix_chunk[i]->c_bytes;
+    }
+    for (i = 1; i <= ix->ix_nchunk; i++) {
+        j = i + (i & -i);
+        if (j <= ix->ix_nchunk) {
+            ix->ix_tree[j] += ix->ix_tree[i];
+            ix->ix_btree[j] += ix->ix_btree[i];
+        }
+    }
+}
+
+/* Make room for at least one more chunk */
+static void ix_grow(struct lindex *ix) {
+    if (ix->ix_nchunk < ix->ix_alloc) return;
+    ix->ix_alloc = ix->ix_alloc? 2*ix->ix_alloc: 16;
+    ix->ix_chunk = Xrealloc(ix->ix_chunk,
+          ix->ix_alloc*sizeof(struct lchunk *));
+    ix->ix_tree = Xrealloc(ix->ix_tree, (ix->ix_alloc + 1)*sizeof(int));
+    ix->ix_btree = Xrealloc(ix->ix_btree, (ix->ix_alloc + 1)*sizeof(long));
+}
+
+/* Put a new chunk into the array at "pos" */
+static struct lchunk *ix_newchunk(struct lindex *ix, int pos) {
+    struct lchunk *ch;
+
+    ix_grow(ix);
+    ch = Xmalloc(sizeof(struct lchunk));
+    memmove(ix->ix_chunk + pos + 1, ix->ix_chunk + pos,
+          (ix->ix_nchunk - pos)*sizeof(struct lchunk *));
+    ix->ix_chunk[pos] = ch;
+    ix->ix_nchunk++;
+    ch->c_first = NULL;
+    ch->c_count = 0;
+    ch->c_bytes = 0;
+    ch->c_words = -1;
+    ch->c_dirty = 0;
+    return ch;
+}
+
+/* Note that the byte and word counts for a chunk need redoing */
+static void ix_dirty(struct lindex *ix, struct lchunk *ch) {
+    ch->c_words = -1;
+    if (ch->c_dirty) return;
+    if (ix->ix_ndirty == ix->ix_dalloc) {
+        ix->ix_dalloc = ix->ix_dalloc? 2*ix->ix_dalloc: 16;
+        ix->ix_dirty = Xrealloc(ix->ix_dirty,
+              ix->ix_dalloc*sizeof(struct lchunk *));
+    }
+    ix->ix_dirty[ix->ix_ndirty++] = ch;
+    ch->c_dirty = 1;
+}
+
+/* Recount the bytes in any chunks that need it */
+static void ix_clean(struct lindex *ix) {
+    struct lchunk *ch;
+    struct line *lp;
+    long bytes;
+    int n;
+
+    while (ix->ix_ndirty > 0) {
+        ch = ix->ix_dirty[--ix->ix_ndirty];
+        bytes = 0;
+        for (lp = ch->c_first, n = ch->c_count; n--; lp = lforw(lp))
+            bytes += llength(lp);
+        btree_add(ix, ch->c_pos, bytes - ch->c_bytes);
+        ch->c_bytes = bytes;
+        ch->c_dirty = 0;
+    }
+}
+
+/*
+ * Build the index for buffer "bp".
+ */
+static struct lindex *lindex_build(struct buffer *bp) {
+    struct lindex *ix;
+    struct lchunk *ch = NULL;
+    struct line *lp;
+
+    ix = Xmalloc(sizeof(struct lindex));
+    ix->ix_chunk = NULL;
+    ix->ix_tree = NULL;
+    ix->ix_btree = NULL;
+    ix->ix_nchunk = ix->ix_alloc = 0;
+    ix->ix_dirty = NULL;
+    ix->ix_ndirty = ix->ix_dalloc = 0;
+    for (lp = lforw(bp->b_linep); lp != bp->b_linep; lp = lforw(lp)) {
+        if (ch == NULL || ch->c_count == LCHUNK_FILL) {
+            ch = ix_newchunk(ix, ix->ix_nchunk);
+            ch->c_first = lp;
+        }
+        lp->l_chunk = ch;
+        ch->c_count++;
+        ch->c_bytes += llength(lp);
+    }
+    tree_build(ix);
+    bp->b_lindex = ix;
+    return ix;
+}
+
+/*
+ * Drop the index for buffer "bp" (if it has one).
+ * Done whenever its lines are changed other than by the functions below.
+ */
+void lindex_drop(struct buffer *bp) {
+    struct lindex *ix = bp->b_lindex;
+
+    if (ix == NULL) return;
+    for (int i = 0; i < ix->ix_nchunk; i++) free(ix->ix_chunk[i]);
+    free(ix->ix_chunk);
+    free(ix->ix_tree);
+    free(ix->ix_btree);
+    free(ix->ix_dirty);
+    free(ix);
+    bp->b_lindex = NULL;
+}
+
+/*
+ * Split a chunk that has got too big into two.
+ * The new chunk starts with no bytes, and both are recounted later.
+ */
+static void lindex_split(struct lindex *ix, struct lchunk *ch) {
+    struct lchunk *nch;
+    struct line *lp;
+    int keep = ch->c_count/2;
+
+    nch = ix_newchunk(ix, ch->c_pos + 1);
+    for (lp = ch->c_first; keep--; lp = lforw(lp));
+    nch->c_first = lp;
+    nch->c_count = ch->c_count - ch->c_count/2;
+    ch->c_count -= nch->c_count;
+    for (int n = nch->c_count; n--; lp = lforw(lp)) lp->l_chunk = nch;
+    tree_build(ix);
+    ix_dirty(ix, ch);
+    ix_dirty(ix, nch);
+}
+
+/*
+ * Line "lp" has just been linked into buffer "bp".
+ * It joins the chunk of the line after it (or, at the end of the buffer,
+ * the one before it).
+ */
+void lindex_insert(struct buffer *bp, struct line *lp) {
+    struct lindex *ix = bp->b_lindex;
+    struct lchunk *ch;
+
+    if (ix == NULL) return;
+    if (lforw(lp) != bp->b_linep) {
+        ch = lforw(lp)->l_chunk;
+        if (ch->c_first == lforw(lp)) ch->c_first = lp;
+    }
+    else if (lback(lp) != bp->b_linep)
+        ch = lback(lp)->l_chunk;
+    else {                      /* First line in an empty buffer */
+        ch = ix_newchunk(ix, 0);
+        ch->c_first = lp;
+        tree_build(ix);
+    }
+    lp->l_chunk = ch;
+    ch->c_count++;
+    tree_add(ix, ch->c_pos, 1);
+    ix_dirty(ix, ch);
+    if (ch->c_count > LCHUNK_MAX) lindex_split(ix, ch);
+}
+
+/*
+ * Line "lp" is about to be unlinked from buffer "bp".
+ */
+void lindex_remove(struct buffer *bp, struct line *lp) {
+    struct lindex *ix = bp->b_lindex;
+    struct lchunk *ch;
+    int pos;
+
+    if (ix == NULL) return;
+    ch = lp->l_chunk;
+    if (--ch->c_count > 0) {
+        if (ch->c_first == lp) ch->c_first = lforw(lp);
+        tree_add(ix, ch->c_pos, -1);
+        ix_dirty(ix, ch);
+        return;
+    }
+    if (ch->c_dirty) {          /* Empty - so drop the chunk */
+        for (int i = 0; i < ix->ix_ndirty; i++) {
+            if (ix->ix_dirty[i] != ch) continue;
+            ix->ix_dirty[i] = ix->ix_dirty[--ix->ix_ndirty];
+            break;
+        }
+    }
+    pos = ch->c_pos;
+    free(ch);
+    ix->ix_nchunk--;
+    memmove(ix->ix_chunk + pos, ix->ix_chunk + pos + 1,
+          (ix->ix_nchunk - pos)*sizeof(struct lchunk *));
+    tree_build(ix);
+}
+
+/*
+ * Line "newlp" is taking the place of "oldlp" in buffer "bp".
+ * It need not be the same length, so its chunk is recounted.
+ */
+void lindex_replace(struct buffer *bp, struct line *oldlp,
+     struct line *newlp) {
+    if (bp->b_lindex == NULL) return;
+    newlp->l_chunk = oldlp->l_chunk;
+    if (newlp->l_chunk->c_first == oldlp) newlp->l_chunk->c_first = newlp;
+    ix_dirty(bp->b_lindex, newlp->l_chunk);
+}
+
+/*
+ * The text of line "lp" in buffer "bp" has been changed.
+ */
+void lindex_touch(struct buffer *bp, struct line *lp) {
+    if (bp->b_lindex == NULL || lp == bp->b_linep) return;
+    ix_dirty(bp->b_lindex, lp->l_chunk);
+}
+
+/*
+ * The number of lines in buffer "bp".
+ */
+int lindex_nlines(struct buffer *bp) {
+    struct lindex *ix = bp->b_lindex;
+
+    if (ix == NULL) ix = lindex_build(bp);
+    return tree_prefix(ix, ix->ix_nchunk);
+}
+
+/*
+ * The line number (from 1) of line "lp" in buffer "bp".
+ * The header line counts as the one after the last.
+ */
+int lindex_lineno(struct buffer *bp, struct line *lp) {
+    struct lindex *ix = bp->b_lindex;
+    struct lchunk *ch;
+    struct line *clp;
+    int lineno;
+
+    if (ix == NULL) ix = lindex_build(bp);
+    if (lp == bp->b_linep) return tree_prefix(ix, ix->ix_nchunk) + 1;
+    ch = lp->l_chunk;
+    lineno = tree_prefix(ix, ch->c_pos) + 1;
+    for (clp = ch->c_first; clp != lp; clp = lforw(clp)) lineno++;
+    return lineno;
+}
+
+/*
+ * Line number "n" (from 1) in buffer "bp".
+ * Anything beyond the end gets the header line.
+ */
+struct line *lindex_goto(struct buffer *bp, int n) {
+    struct lindex *ix = bp->b_lindex;
+    struct line *lp;
+    int pos, step, left;
+
+    if (ix == NULL) ix = lindex_build(bp);
+    if (n < 1) n = 1;
+    if (n > tree_prefix(ix, ix->ix_nchunk)) return bp->b_linep;
+
+/* Find the chunk with line n in it by descending the tree, leaving
+ * "left" as how far into that chunk it is.
+ */
+    pos = 0;
+    left = n - 1;
+    for (step = 1; 2*step <= ix->ix_nchunk; step *= 2);
+    for (; step > 0; step /= 2) {
+        if (pos + step <= ix->ix_nchunk && ix->ix_tree[pos + step] <= left) {
+            pos += step;
+            left -= ix->ix_tree[pos];
+        }
+    }
+    for (lp = ix->ix_chunk[pos]->c_first; left--; lp = lforw(lp));
+    return lp;
+}
+
+/*
+ * The number of bytes in the lines of buffer "bp" (not counting the
+ * newlines).
+ */
+long lindex_nbytes(struct buffer *bp) {
+    struct lindex *ix = bp->b_lindex;
+
+    if (ix == NULL) ix = lindex_build(bp);
+    ix_clean(ix);
+    return btree_prefix(ix, ix->ix_nchunk);
+}
+
+/*
+ * The number of bytes in the lines of buffer "bp" that come before line
+ * "lp" (not counting the newlines).
+ */
+long lindex_bytes(struct buffer *bp, struct line *lp) {
+    struct lindex *ix = bp->b_lindex;
+    struct line *clp;
+    long bytes;
+
+    if (ix == NULL) ix = lindex_build(bp);
+    ix_clean(ix);
+    if (lp == bp->b_linep) return btree_prefix(ix, ix->ix_nchunk);
+    bytes = btree_prefix(ix, lp->l_chunk->c_pos);
+    for (clp = lp->l_chunk->c_first; clp != lp; clp = lforw(clp))
+        bytes += llength(clp);
+    return bytes;
+}
+
+/*
+ * If line "lp" in buffer "bp" starts a chunk, return the line after the
+ * end of that chunk, setting the number of lines, bytes and words in it.
+ * Otherwise return NULL.
+ * The word count is only done (by count_words()) when first asked for.
+ */
+struct line *lindex_chunk(struct buffer *bp, struct line *lp,
+     int *nlines, long *nbytes, long *nwords) {
+    struct lindex *ix = bp->b_lindex;
+    struct lchunk *ch;
+    struct line *clp;
+    int n;
+
+    if (ix == NULL) ix = lindex_build(bp);
+    if (lp == bp->b_linep || lp->l_chunk->c_first != lp) return NULL;
+    ix_clean(ix);
+    ch = lp->l_chunk;
+    if (ch->c_words < 0) {
+        ch->c_words = 0;
+        for (clp = lp, n = ch->c_count; n--; clp = lforw(clp))
+            ch->c_words += count_words(clp, 0, llength(clp));
+    }
+    *nlines = ch->c_count;
+    *nbytes = ch->c_bytes;
+    *nwords = ch->c_words;
+    if (ch->c_pos + 1 < ix->ix_nchunk)
+        return ix->ix_chunk[ch->c_pos + 1]->c_first;
+    return bp->b_linep;
+}
+
+/*
+ * The number of chunks in the index of buffer "bp".
+ * With lindex_chunkat() and lindex_chunkno() this lets the buffer be
+ * split up into runs of lines that can be worked on separately.
+ */
+int lindex_nchunks(struct buffer *bp) {
+    struct lindex *ix = bp->b_lindex;
+
+    if (ix == NULL) ix = lindex_build(bp);
+    return ix->ix_nchunk;
+}
+
+/*
+ * The first line of chunk "n" (from 0) in buffer "bp", setting the
+ * number of lines in it.
+ */
+struct line *lindex_chunkat(struct buffer *bp, int n, int *nlines) {
+    struct lindex *ix = bp->b_lindex;
+
+    if (ix == NULL) ix = lindex_build(bp);
+    *nlines = ix->ix_chunk[n]->c_count;
+    return ix->ix_chunk[n]->c_first;
+}
+
+/*
+ * The number of the chunk that line "lp" of buffer "bp" is in.
+ * The header line counts as being in the one after the last.
+ */
+int lindex_chunkno(struct buffer *bp, struct line *lp) {
+    struct lindex *ix = bp->b_lindex;
+
+    if (ix == NULL) ix = lindex_build(bp);
+    if (lp == bp->b_linep) return ix->ix_nchunk;
+    return lp->l_chunk->c_pos;
+}
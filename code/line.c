@@ -15,36 +15,551 @@
 
 #include "line.h"
 
+#include <limits.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "estruct.h"
 #include "edef.h"
 #include "efunc.h"
 #include "utf8.h"
+#include "usage.h"
 
 #define BLOCK_SIZE 16 /* Line block chunk size. */
 
 static int force_newline = 0;   /* lnewline may need to be told this */
+                                /* (2 - every newline, linsert_literal) */
+
+/*
+ * Line memory.
+ * Lines (and the text that lown() gives them) are carved out of slabs
+ * belonging to the buffer they are in, using a set of size classes each
+ * with its own free list. So growing a line (which means allocating a
+ * new one of the next size up) just reuses a freed slot, and clearing a
+ * buffer releases its slabs in one go rather than freeing each line.
+ * Slabs are aligned on their size, so the slab (and hence arena) that
+ * anything belongs to is found by masking its address.
+ * Anything too big for the largest class gets a "slab" to itself.
+ * Header lines live in their own arena, which is never released.
+ */
+#define SLAB_SIZE 32768                 /* Must be a power of 2 */
+#define BIG_SLAB  -1                    /* s_class of a single object */
+
+struct slab {
+    struct slab *s_next;
+    struct slab *s_prev;
+    struct line_arena *s_arena;         /* Owner */
+    int s_class;                        /* Size class, or BIG_SLAB */
+    size_t s_size;                      /* Object size, if BIG_SLAB */
+};
+#define SLAB_HDR ((sizeof(struct slab) + 15) & ~15)
+#define SLAB_OF(p) ((struct slab *)((uintptr_t)(p) & ~(uintptr_t)(SLAB_SIZE-1)))
+
+static const int class_size[] = {
+    32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072,
+    4096,
+};
+#define NCLASS (int)(sizeof(class_size)/sizeof(class_size[0]))
+
+struct line_arena {
+    struct slab *la_slabs;              /* Every slab we have */
+    char *la_fill[NCLASS];              /* Where to carve next...  */
+    char *la_end[NCLASS];               /* ...and where to stop    */
+    void *la_free[NCLASS];              /* Freed objects, chained  */
+    size_t la_live;                     /* Bytes handed out        */
+    size_t la_held;                     /* Bytes in its slabs      */
+    int la_nslabs;
+};
+
+static struct line_arena hdr_arena;     /* For header lines */
+static unsigned long line_gen;          /* Last line generation given out */
+
+/* Totals over every arena, for the $lmem_* variables */
+static size_t lmem_tot_live, lmem_tot_held;
+static int lmem_tot_slabs;
+
+static void slab_link(struct line_arena *ap, struct slab *sp, size_t size) {
+    sp->s_arena = ap;
+    sp->s_prev = NULL;
+    sp->s_next = ap->la_slabs;
+    if (ap->la_slabs) ap->la_slabs->s_prev = sp;
+    ap->la_slabs = sp;
+    ap->la_nslabs++;
+    ap->la_held += size;
+    lmem_tot_slabs++;
+    lmem_tot_held += size;
+}
+
+static struct slab *slab_get(size_t size) {
+    void *mem = NULL;
+
+    if (posix_memalign(&mem, SLAB_SIZE, size) != 0)
+        die("posix_memalign: Out of memory");
+    return mem;
+}
+
+/*
+ * Allocate an object of at least "need" bytes in arena "ap".
+ * What we actually got is returned in "got".
+ */
+static void *lmem_alloc(struct line_arena *ap, size_t need, int *got) {
+    struct slab *sp;
+    void *obj;
+    int c;
+
+    for (c = 0; c < NCLASS; c++) if (need <= (size_t)class_size[c]) break;
+    if (c == NCLASS) {                  /* Too big to share a slab */
+        need = (need + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+        sp = slab_get(SLAB_HDR + need);
+        sp->s_class = BIG_SLAB;
+        sp->s_size = need;
+        slab_link(ap, sp, SLAB_HDR + need);
+        ap->la_live += need;
+        lmem_tot_live += need;
+        *got = need;
+        return (char *)sp + SLAB_HDR;
+    }
+    if ((obj = ap->la_free[c]) != NULL)
+        ap->la_free[c] = *(void **)obj;
+    else {
+        if (ap->la_fill[c] == NULL ||
+             ap->la_fill[c] + class_size[c] > ap->la_end[c]) {
+            sp = slab_get(SLAB_SIZE);
+            sp->s_class = c;
+            slab_link(ap, sp, SLAB_SIZE);
+            ap->la_fill[c] = (char *)sp + SLAB_HDR;
+            ap->la_end[c] = (char *)sp + SLAB_SIZE;
+        }
+        obj = ap->la_fill[c];
+        ap->la_fill[c] += class_size[c];
+    }
+    ap->la_live += class_size[c];
+    lmem_tot_live += class_size[c];
+    *got = class_size[c];
+    return obj;
+}
+
+/*
+ * Return an object to the free list of the arena it came from.
+ */
+static void lmem_free(void *obj) {
+    struct slab *sp = SLAB_OF(obj);
+    struct line_arena *ap = sp->s_arena;
+
+    if (sp->s_class == BIG_SLAB) {
+        if (sp->s_prev) sp->s_prev->s_next = sp->s_next;
+        else            ap->la_slabs = sp->s_next;
+        if (sp->s_next) sp->s_next->s_prev = sp->s_prev;
+        ap->la_live -= sp->s_size;
+        ap->la_held -= SLAB_HDR + sp->s_size;
+        ap->la_nslabs--;
+        lmem_tot_live -= sp->s_size;
+        lmem_tot_held -= SLAB_HDR + sp->s_size;
+        lmem_tot_slabs--;
+        free(sp);
+        return;
+    }
+    *(void **)obj = ap->la_free[sp->s_class];
+    ap->la_free[sp->s_class] = obj;
+    ap->la_live -= class_size[sp->s_class];
+    lmem_tot_live -= class_size[sp->s_class];
+}
+
+/*
+ * Create a new, empty, arena for a buffer.
+ */
+struct line_arena *larena_alloc(void) {
+    struct line_arena *ap;
+
+    ap = (struct line_arena *)Xmalloc(sizeof(struct line_arena));
+    memset(ap, 0, sizeof(struct line_arena));
+    return ap;
+}
+
+/*
+ * Release everything in an arena (i.e. every line in the buffer bar the
+ * header line), leaving it empty and ready for reuse.
+ * The caller has to ensure nothing still points at any of it.
+ */
+void larena_release(struct line_arena *ap) {
+    struct slab *sp;
+
+    while ((sp = ap->la_slabs) != NULL) {
+        ap->la_slabs = sp->s_next;
+        free(sp);
+    }
+    lmem_tot_live -= ap->la_live;
+    lmem_tot_held -= ap->la_held;
+    lmem_tot_slabs -= ap->la_nslabs;
+    memset(ap, 0, sizeof(struct line_arena));
+}
+
+/*
+ * Totals for the $lmem_* variables, over all arenas (including those of
+ * text held for undo), kept as slabs and objects come and go.
+ * "live" is what has been handed out to lines (and their text), "waste"
+ * is the slab memory which hasn't been - slab headers, the ends of slabs
+ * not yet carved up, freed slots waiting to be reused and whatever is
+ * left over when a slab is divided into its size class - and "slabs" is
+ * how many slabs we have (counting each big object as one).
+ * The rest of a slot beyond a line's text isn't counted, as the line
+ * grows into that before it needs a new one.
+ */
+size_t lmem_live(void) {
+    return lmem_tot_live;
+}
+size_t lmem_waste(void) {
+    return lmem_tot_held - lmem_tot_live;
+}
+int lmem_slabs(void) {
+    return lmem_tot_slabs;
+}
 
 /*
  * This routine allocates a block of memory large enough to hold a struct line
- * containing "used" characters. The block is always rounded up a bit. Return
- * a pointer to the new block, or NULL if there isn't any memory left. Print a
- * message in the message line if no space.
+ * containing "used" characters, from the arena of buffer "bp" (NULL
+ * meaning a header line). The block is always rounded up a bit, and the
+ * line may use all of it. Return a pointer to the new block, or NULL if
+ * there isn't any memory left. Print a message in the message line if no
+ * space.
  */
-struct line *lalloc(int used) {
+struct line *lalloc(struct buffer *bp, int used) {
     struct line *lp;
     int size;
 
-    size = (used + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+    size = used;
     if (size == 0)              /* Assume that is an empty. */
         size = BLOCK_SIZE;  /* Line is for type-in. */
-    lp = (struct line *)Xmalloc(sizeof(struct line) + size);
-    lp->l_size = size;
+    lp = lmem_alloc(bp? bp->b_arena: &hdr_arena,
+          sizeof(struct line) + size, &size);
+    lp->l_text = (char *)(lp + 1);
+    lp->l_chunk = NULL;
+    lp->l_size = size - sizeof(struct line);
+    lp->l_used = used;
+    lp->l_gen = ++line_gen;
+    return lp;
+}
+
+/*
+ * Allocate a line structure for "used" bytes of text which are held
+ * elsewhere (in a struct text_block). No copy of the text is made.
+ */
+struct line *lalloc_shared(struct buffer *bp, char *text, int used) {
+    struct line *lp;
+    int size;
+
+    lp = lmem_alloc(bp->b_arena, sizeof(struct line), &size);
+    lp->l_text = text;
+    lp->l_chunk = NULL;
+    lp->l_size = 0;
     lp->l_used = used;
+    lp->l_gen = ++line_gen;
     return lp;
 }
 
+/*
+ * Note that the text of line "lp" in buffer "bp" has been changed.
+ * It gets a new generation number, so anything kept about how it looked
+ * before can be seen to be out of date (no two lines, nor one line before
+ * and after a change, ever have the same one), and the line index is told.
+ */
+void ltouch(struct buffer *bp, struct line *lp) {
+    lp->l_gen = ++line_gen;
+    lindex_touch(bp, lp);
+}
+
+/*
+ * Link line "lp" onto the end of buffer "bp". This is for building the
+ * text of a buffer from scratch, so no windows are adjusted, but "." is
+ * moved onto the line if it was at the end.
+ */
+void lappend(struct buffer *bp, struct line *lp) {
+    lp->l_bp = bp->b_linep->l_bp;
+    lp->l_fp = bp->b_linep;
+    bp->b_linep->l_bp->l_fp = lp;
+    bp->b_linep->l_bp = lp;
+    lindex_insert(bp, lp);
+    if (bp->b_dotp == bp->b_linep) bp->b_dotp = lp;
+}
+
+/*
+ * Release the memory for a line which is no longer linked into anything.
+ * The text is only ours to free if it has been moved out to its own
+ * allocation by lown().
+ */
+void lrelease(struct line *lp) {
+    if (lp->l_size && lp->l_text != (char *)(lp + 1)) lmem_free(lp->l_text);
+    lmem_free(lp);
+}
+
+/*
+ * Give a line with shared text its own copy of it, so that it may be
+ * altered in place. The line structure itself doesn't move, so nothing
+ * that points at it needs to be changed.
+ */
+void lown(struct line *lp) {
+    int size;
+    char *text;
+
+    if (lp->l_size) return;     /* Already ours */
+    size = lp->l_used;
+    if (size == 0) size = BLOCK_SIZE;
+    text = lmem_alloc(SLAB_OF(lp)->s_arena, size, &size);
+    memcpy(text, lp->l_text, lp->l_used);
+    lp->l_text = text;
+    lp->l_size = size;
+}
+
+/*
+ * Hand the (Xmalloc()ed) block of "len" bytes at "text" over to the text
+ * store of buffer "bp".
+ * Lines may then point into this with lalloc_shared().
+ * The blocks live until the buffer is cleared.
+ * The caller may mark the returned block as mapped.
+ */
+struct text_block *lstore_add(struct buffer *bp, char *text, size_t len) {
+    struct text_block *tbp;
+
+    tbp = (struct text_block *)Xmalloc(sizeof(struct text_block));
+    tbp->tb_text = text;
+    tbp->tb_len = len;
+    tbp->tb_mapped = 0;
+    tbp->tb_next = bp->b_store;
+    bp->b_store = tbp;
+    return tbp;
+}
+
+/*
+ * Release a list of text store blocks.
+ */
+static void lstore_release(struct text_block *tbp) {
+    struct text_block *next;
+
+    for (; tbp != NULL; tbp = next) {
+        next = tbp->tb_next;
+        if (tbp->tb_mapped) munmap(tbp->tb_text, tbp->tb_len);
+        else                free(tbp->tb_text);
+        free(tbp);
+    }
+}
+
+/*
+ * Release all of the text store for buffer "bp".
+ * Must only be done once no line in the buffer points into it.
+ */
+void lstore_free(struct buffer *bp) {
+    lstore_release(bp->b_store);
+    bp->b_store = NULL;
+}
+
+/*
+ * A file is about to be overwritten (and so truncated), so any buffer
+ * with that file mapped into its text store must stop using the mapping,
+ * otherwise its lines will vanish beneath it.
+ * Copy each such mapping into memory and move the lines across to the
+ * copy. Lines only point into a block if they haven't got their own
+ * text, and they will all be in the buffer which owns it. (An empty line
+ * may be left pointing at the very end, but its text is never looked at.)
+ * With "any" set every mapping is copied, whatever file it is from.
+ */
+static void lstore_unmap_in(struct text_block *tbp, struct line *lp,
+     struct line *end, dev_t dev, ino_t ino, int any) {
+    struct line *first = lp;
+    char *copy;
+
+    for (; tbp != NULL; tbp = tbp->tb_next) {
+        if (!tbp->tb_mapped ||
+             (!any && (tbp->tb_dev != dev || tbp->tb_ino != ino)))
+            continue;
+        copy = Xmalloc(tbp->tb_len);
+        memcpy(copy, tbp->tb_text, tbp->tb_len);
+        for (lp = first; lp != end; lp = lforw(lp)) {
+            if (lp->l_size == 0 && lp->l_text >= tbp->tb_text &&
+                 lp->l_text < tbp->tb_text + tbp->tb_len)
+                lp->l_text = copy + (lp->l_text - tbp->tb_text);
+        }
+        munmap(tbp->tb_text, tbp->tb_len);
+        tbp->tb_text = copy;
+        tbp->tb_mapped = 0;
+    }
+}
+
+/*
+ * The text of a buffer held away from it (by undo.c), with the arena and
+ * text store that its lines use. They are all kept on a list, so that
+ * lstore_unmap() can find them too.
+ */
+struct ltext {
+    struct ltext *lt_next;
+    struct ltext *lt_prev;
+    struct line *lt_first;          /* The lines, linked through l_fp */
+    struct line *lt_last;           /* and ending with NULL (if any)  */
+    struct line_arena *lt_arena;
+    struct text_block *lt_store;
+};
+static struct ltext *ltext_list;
+
+void lstore_unmap(dev_t dev, ino_t ino) {
+    struct buffer *bp;
+    struct ltext *tp;
+
+    for (bp = bheadp; bp != NULL; bp = bp->b_bufp)
+        lstore_unmap_in(bp->b_store, lforw(bp->b_linep), bp->b_linep,
+             dev, ino, FALSE);
+    for (tp = ltext_list; tp != NULL; tp = tp->lt_next)
+        lstore_unmap_in(tp->lt_store, tp->lt_first, NULL, dev, ino, FALSE);
+}
+
+/*
+ * Copy every mapped file into memory and release the mappings, so that
+ * nothing then depends on what happens to the files.
+ * Used before the buffers are saved on a fatal signal.
+ */
+void lstore_unmap_all(void) {
+    struct buffer *bp;
+    struct ltext *tp;
+
+    for (bp = bheadp; bp != NULL; bp = bp->b_bufp)
+        lstore_unmap_in(bp->b_store, lforw(bp->b_linep), bp->b_linep,
+             0, 0, TRUE);
+    for (tp = ltext_list; tp != NULL; tp = tp->lt_next)
+        lstore_unmap_in(tp->lt_store, tp->lt_first, NULL, 0, 0, TRUE);
+}
+
+/*
+ * A SIGBUS at "addr". If that is in a mapped file then the file has been
+ * cut short by someone else since we read it, and that part of it has
+ * gone. Map zeroes over the rest of the block, so that the access can be
+ * retried, and mark the buffer as truncated (as for a failed read), so
+ * that it isn't written back without a warning.
+ * Returns TRUE if the fault was dealt with.
+ * This is called from a signal handler, so it must not allocate.
+ */
+static int lstore_fault_in(struct text_block *tbp, char *addr) {
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start, end;
+
+    for (; tbp != NULL; tbp = tbp->tb_next) {
+        if (!tbp->tb_mapped || addr < tbp->tb_text ||
+             addr >= tbp->tb_text + tbp->tb_len)
+            continue;
+        start = (uintptr_t)addr & ~(page - 1);
+        end = ((uintptr_t)tbp->tb_text + tbp->tb_len + page - 1) &
+             ~(page - 1);
+        return mmap((void *)start, end - start, PROT_READ,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED;
+    }
+    return FALSE;
+}
+
+int lstore_fault(char *addr) {
+    struct buffer *bp;
+    struct ltext *tp;
+    struct window *wp;
+
+    for (bp = bheadp; bp != NULL; bp = bp->b_bufp) {
+        if (!lstore_fault_in(bp->b_store, addr)) continue;
+        bp->b_flag |= BFTRUNC;
+        for (wp = wheadp; wp != NULL; wp = wp->w_wndp)
+            if (wp->w_bufp == bp) wp->w_flag |= WFMODE;
+        return TRUE;
+    }
+    for (tp = ltext_list; tp != NULL; tp = tp->lt_next)
+        if (lstore_fault_in(tp->lt_store, addr)) return TRUE;
+    return FALSE;
+}
+
+/*
+ * Exchange the text of buffer "bp" with that held in "tp".
+ * Every window onto the buffer is left at the top of it (any mark too).
+ */
+void ltext_swap(struct buffer *bp, struct ltext *tp) {
+    struct line *hp = bp->b_linep;
+    struct line *first, *last;
+    struct line_arena *ap;
+    struct text_block *tbp;
+    struct window *wp;
+
+    first = (lforw(hp) != hp)? lforw(hp): NULL;
+    last = (first)? lback(hp): NULL;
+    if (tp->lt_first) {
+        hp->l_fp = tp->lt_first;
+        hp->l_bp = tp->lt_last;
+        tp->lt_first->l_bp = hp;
+        tp->lt_last->l_fp = hp;
+    }
+    else
+        hp->l_fp = hp->l_bp = hp;
+    if (first) last->l_fp = NULL;
+    tp->lt_first = first;
+    tp->lt_last = last;
+    ap = bp->b_arena;
+    bp->b_arena = tp->lt_arena;
+    tp->lt_arena = ap;
+    tbp = bp->b_store;
+    bp->b_store = tp->lt_store;
+    tp->lt_store = tbp;
+    lindex_drop(bp);
+
+    for (wp = wheadp; wp != NULL; wp = wp->w_wndp) {
+        if (wp->w_bufp != bp) continue;
+        wp->w_linep = wp->w_dotp = lforw(hp);
+        wp->w_doto = 0;
+        if (wp->w_markp) {
+            wp->w_markp = lforw(hp);
+            wp->w_marko = 0;
+        }
+        wp->w_flag |= WFHARD | WFMODE;
+    }
+}
+
+/*
+ * Take the text away from buffer "bp", leaving it empty (with a new
+ * arena), and return it.
+ */
+struct ltext *ltext_take(struct buffer *bp) {
+    struct ltext *tp;
+
+    tp = (struct ltext *)Xmalloc(sizeof(struct ltext));
+    tp->lt_first = tp->lt_last = NULL;
+    tp->lt_arena = larena_alloc();
+    tp->lt_store = NULL;
+    ltext_swap(bp, tp);
+    tp->lt_prev = NULL;
+    tp->lt_next = ltext_list;
+    if (ltext_list) ltext_list->lt_prev = tp;
+    ltext_list = tp;
+    return tp;
+}
+
+/*
+ * Throw away some held text.
+ */
+void ltext_free(struct ltext *tp) {
+    if (tp->lt_prev) tp->lt_prev->lt_next = tp->lt_next;
+    else             ltext_list = tp->lt_next;
+    if (tp->lt_next) tp->lt_next->lt_prev = tp->lt_prev;
+    larena_release(tp->lt_arena);
+    free(tp->lt_arena);
+    lstore_release(tp->lt_store);
+    free(tp);
+}
+
+/*
+ * The memory that some held text is using.
+ */
+size_t ltext_size(struct ltext *tp) {
+    size_t size = sizeof(struct ltext) + tp->lt_arena->la_live;
+    struct text_block *tbp;
+
+    for (tbp = tp->lt_store; tbp != NULL; tbp = tbp->tb_next)
+        size += tbp->tb_len;
+    return size;
+}
+
 /*
  * Delete line "lp". Fix all of the links that might point at it (they are
  * moved to offset 0 of the next line. Unlink the line from whatever buffer it
@@ -82,9 +597,10 @@ void lfree(struct line *lp) {
         }
         bp = bp->b_bufp;
     }
+    lindex_remove(curbp, lp);
     lp->l_bp->l_fp = lp->l_fp;
     lp->l_fp->l_bp = lp->l_bp;
-    free((char *)lp);
+    lrelease(lp);
 }
 
 /*
@@ -112,6 +628,10 @@ void lchange(int flag) {
 /* If this is a translation table, remove any compiled data */
 
     if ((curbp->b_type == BTPHON) && curbp->ptt_headp) ptt_free(curbp);
+
+/* Likewise for a compiled procedure */
+
+    if (curbp->b_prog) proc_free(curbp);
 }
 
 /*
@@ -127,23 +647,23 @@ int insspace(int f, int n) {
 }
 
 /*
- * Insert "n" copies of the character "c" at the current location of dot. In
- * the easy case all that happens is the text is stored in the line. In the
- * hard case, the line has to be Xreallocated. When the window list is updated,
+ * Insert "n" copies of the character "c" (or, if "text" isn't NULL, the "n"
+ * bytes there, which mustn't include a newline) at the current location of
+ * dot. In the easy case all that happens is the text is stored in the line.
+ * In the hard case, the line has to be Xreallocated. When the window list is updated,
  * take special care; I screwed it up once. You always update dot in the
  * current window. You update mark, and a dot in another window, if it is
  * greater than the place where you did the insert. Return TRUE if all is
  * well, and FALSE on errors.
  */
 
-int linsert_byte(int n, unsigned char c) {
+static int linsert_text(int n, unsigned char c, const char *text) {
     char *cp1;
     char *cp2;
     struct line *lp1;
     struct line *lp2;
     struct line *lp3;
     int doto;
-    int i;
     struct window *wp;
 
     if (curbp->b_mode & MDVIEW) /* don't allow this command if */
@@ -155,21 +675,23 @@ int linsert_byte(int n, unsigned char c) {
             mlwrite_one("bug: linsert");
             return FALSE;
         }
-        if ((lp2 = lalloc(n)) == NULL)  /* Allocate new line   */
+        if ((lp2 = lalloc(curbp, n)) == NULL)  /* Allocate new line   */
             return FALSE;
         lp3 = lp1->l_bp;        /* Previous line        */
         lp3->l_fp = lp2;        /* Link in              */
         lp2->l_fp = lp1;
         lp1->l_bp = lp2;
         lp2->l_bp = lp3;
-        for (i = 0; i < n; ++i) lp2->l_text[i] = c;
+        lindex_insert(curbp, lp2);
+        if (text) memcpy(lp2->l_text, text, n);
+        else      memset(lp2->l_text, c, n);
         curwp->w_dotp = lp2;
         curwp->w_doto = n;
         return TRUE;
     }
     doto = curwp->w_doto;                   /* Save for later.      */
     if (lp1->l_used + n > lp1->l_size) {    /* Hard: reallocate     */
-        if ((lp2 = lalloc(lp1->l_used + n)) == NULL) return FALSE;
+        if ((lp2 = lalloc(curbp, lp1->l_used + n)) == NULL) return FALSE;
         cp1 = &lp1->l_text[0];
         cp2 = &lp2->l_text[0];
         while (cp1 != &lp1->l_text[doto]) *cp2++ = *cp1++;
@@ -179,7 +701,8 @@ int linsert_byte(int n, unsigned char c) {
         lp2->l_fp = lp1->l_fp;
         lp1->l_fp->l_bp = lp2;
         lp2->l_bp = lp1->l_bp;
-        free((char *)lp1);
+        lindex_replace(curbp, lp1, lp2);
+        lrelease(lp1);
     }
     else {                          /* Easy: in place       */
         lp2 = lp1;                  /* Pretend new line     */
@@ -188,8 +711,11 @@ int linsert_byte(int n, unsigned char c) {
         cp1 = cp2 - n;
         while (cp1 != &lp1->l_text[doto]) *--cp2 = *--cp1;
     }
-    for (i = 0; i < n; ++i)         /* Add the characters   */
-        lp2->l_text[doto + i] = c;
+    if (text)                       /* Add the characters   */
+        memcpy(lp2->l_text + doto, text, n);
+    else
+        memset(lp2->l_text + doto, c, n);
+    ltouch(curbp, lp2);
     wp = wheadp;                    /* Update windows       */
     while (wp != NULL) {
         if (wp->w_linep == lp1) wp->w_linep = lp2;
@@ -206,56 +732,284 @@ int linsert_byte(int n, unsigned char c) {
     return TRUE;
 }
 
+int linsert_byte(int n, unsigned char c) {
+    int status;
+
+    undo_ins_start();
+    status = linsert_text(n, c, NULL);
+    undo_ins_end();
+    return status;
+}
+
 /*
- * linstr -- Insert a string at the current point
+ * Free a chain of lines (linked through l_fp) that was never put into a
+ * buffer.
  */
+static void lfree_chain(struct line *lp) {
+    struct line *next;
 
-int linstr(char *instr) {
-    int status = TRUE;
-    char tmpc;
+    for (; lp != NULL; lp = next) {
+        next = lp->l_fp;
+        lrelease(lp);
+    }
+}
 
-/* We have to check this here to avoid the "Out of memory" message
- * on failure when linsert_byte() gripes about it.
+/*
+ * Link line "lp" into the current buffer in front of line "next".
  */
-    if (curbp->b_mode & MDVIEW) /* don't allow this command if */
-        return rdonly();        /* we are in read only mode    */
+static void llink_before(struct line *lp, struct line *next) {
+    lp->l_bp = next->l_bp;
+    lp->l_fp = next;
+    next->l_bp->l_fp = lp;
+    next->l_bp = lp;
+    lindex_insert(curbp, lp);
+}
 
-    if (instr != NULL)
-        while ((tmpc = *instr)) {
-/* GGR - linsert inserts unicode....but we've been sent a (utf8) string! */
-            status = (tmpc == '\n' ? lnewline() : linsert_byte(1, tmpc));
+/*
+ * linsert_lines -- Link the chain of whole lines "first" to "last" (as for
+ * lsplice()) into the current buffer in front of the current line.
+ * Nothing already there moves, so no window needs fixing up.
+ */
+void linsert_lines(struct line *first, struct line *last) {
+    struct line *lp, *next;
 
-/* Insertion error? */
-            if (status != TRUE) {
-                mlwrite_one("%Out of memory while inserting");
-                break;
+    undo_ins_start();
+    lchange(WFHARD | WFINS);
+    for (lp = first; ; lp = next) {
+        next = lp->l_fp;
+        llink_before(lp, curwp->w_dotp);
+        if (lp == last) break;
+    }
+    undo_ins_end();
+}
+
+/*
+ * lsplice -- Insert a chain of lines at the current point in one go.
+ * "first" to "last" are linked through l_fp, allocated for the current
+ * buffer, and hold text with a newline after all but the last of them.
+ * The text of "first" is added to the current line at ".", which is then
+ * split, the lines in between are linked in as they are and the text of
+ * "last" goes in front of the rest of the current line. Dot and mark in
+ * each window are fixed up in one pass, ending where they would have
+ * been had the text been typed (lnewline()'s rules at the end of the
+ * buffer included), so this costs the same for any number of lines.
+ * The lines are used up, whether or not this succeeds.
+ */
+static int lsplice_chain(struct line *first, struct line *last) {
+    struct line *lp1, *lp, *next, *fl;
+    struct window *wp;
+    int doto, flen, force, midtext, status;
+
+    last->l_fp = NULL;
+    if (curbp->b_mode & MDVIEW) {   /* don't allow this command if */
+        lfree_chain(first);         /* we are in read only mode    */
+        return rdonly();
+    }
+    if (first == last) {            /* No newline, so nothing to split */
+        status = (llength(first) == 0) ||
+             linsert_text(llength(first), 0, first->l_text);
+        lrelease(first);
+        return status;
+    }
+    lchange(WFHARD | WFINS);
+    force = force_newline;
+    force_newline = 0;
+    lp1 = curwp->w_dotp;
+    doto = curwp->w_doto;
+    flen = llength(first);
+
+/* At the end of a non-empty last line the first newline (unless forced)
+ * just takes us to the end of the buffer, as in lnewline().
+ */
+    if (!force && lp1 != curbp->b_linep && lforw(lp1) == curbp->b_linep &&
+         doto == llength(lp1) && doto + flen > 0) {
+        if (flen && !linsert_text(flen, 0, first->l_text)) {
+            lfree_chain(first);
+            return FALSE;
+        }
+        next = first->l_fp;
+        lrelease(first);
+        first = next;
+        curwp->w_dotp = lp1 = curbp->b_linep;
+        curwp->w_doto = 0;
+    }
+
+/* At the end of the buffer each line goes in front of the header line,
+ * except for an empty last one (we just stay at the end).
+ * Anything else left on the header line (the top line, dot or mark of
+ * a window) moves to the start of the new text, as lsplit() does.
+ */
+    if (lp1 == curbp->b_linep) {
+        for (lp = first; lp != last; lp = next) {
+            next = lp->l_fp;
+            llink_before(lp, lp1);
+        }
+        if (llength(last) == 0) {
+            lrelease(last);
+            if (first == last) return TRUE;
+            last = NULL;
+        }
+        else
+            llink_before(last, lp1);
+        for (wp = wheadp; wp != NULL; wp = wp->w_wndp) {
+            if (wp->w_linep == lp1) wp->w_linep = first;
+            if (wp->w_dotp == lp1 && wp != curwp) {
+                wp->w_dotp = first;
+                wp->w_doto = 0;
             }
-            instr++;
+            if (wp->w_markp == lp1) {
+                wp->w_markp = first;
+                wp->w_marko = 0;
+            }
+        }
+        if (last) {
+            curwp->w_dotp = last;
+            curwp->w_doto = llength(last);
+        }
+        return TRUE;
+    }
+
+/* Otherwise split the current line at "." as lnewline() does. The first
+ * half (with the text of "first" on the end) is a new line, and the
+ * second half stays in "lp1", with the other lines linked in before it.
+ */
+    next = first->l_fp;
+    if (doto == 0) fl = first;
+    else {
+        fl = lalloc(curbp, doto + flen);
+        memcpy(fl->l_text, lp1->l_text, doto);
+        memcpy(fl->l_text + doto, first->l_text, flen);
+        lrelease(first);
+        if (lp1->l_size == 0)       /* Shared text, so just */
+            lp1->l_text += doto;    /* step over it         */
+        else
+            memmove(lp1->l_text, lp1->l_text + doto, lp1->l_used - doto);
+        lp1->l_used -= doto;
+        ltouch(curbp, lp1);
+    }
+    llink_before(fl, lp1);
+    midtext = FALSE;
+    for (lp = next; lp != last; lp = next) {
+        next = lp->l_fp;
+        if (llength(lp)) midtext = TRUE;
+        llink_before(lp, lp1);
+    }
+    for (wp = wheadp; wp != NULL; wp = wp->w_wndp) {
+        if (wp->w_linep == lp1) wp->w_linep = fl;
+        if (wp->w_dotp == lp1) {
+            if (wp == curwp)
+                wp->w_doto = 0;
+            else if (wp->w_doto < doto || (wp->w_doto == doto && flen))
+                wp->w_dotp = fl;
+            else
+                wp->w_doto -= doto;
+        }
+        if (wp->w_markp == lp1) {
+            if (wp->w_marko <= doto) wp->w_markp = fl;
+            else                     wp->w_marko -= doto;
         }
+    }
+
+/* If that left "." at the start of an empty last line, a newline after
+ * some text would have taken us on to the end of the buffer (as above),
+ * leaving no empty line.
+ */
+    if (llength(last) == 0) {
+        lrelease(last);
+        if (force < 2 && midtext && llength(lp1) == 0 &&
+             lforw(lp1) == curbp->b_linep)
+            lfree(lp1);
+        return TRUE;
+    }
+
+/* The text of "last" goes at the start of what's left */
+    status = linsert_text(llength(last), 0, last->l_text);
+    lrelease(last);
+    return status;
+}
+
+int lsplice(struct line *first, struct line *last) {
+    int status;
+
+    undo_ins_start();
+    status = lsplice_chain(first, last);
+    undo_ins_end();
     return status;
 }
 
 /*
- * lins_nc -- Insert bytes given a pointer and count
- * Currently only used from this file.
+ * linsert_block -- Insert "len" bytes of text, which may run over
+ * several lines, at the current point in one go.
+ * Each line of it is allocated at its full size and the chain of them
+ * handed to lsplice(), so the cost is per line rather than (as it was
+ * for linstr()) per byte.
  */
+static int linsert_chain(const char *text, int len) {
+    const char *nl, *end = text + len;
+    struct line *first, *last, *lp;
 
-static int lins_nc(char *instr, int nb) {
-    int status = TRUE;
-    char tmpc;
+    if (curbp->b_mode & MDVIEW) /* don't allow this command if */
+        return rdonly();        /* we are in read only mode    */
 
-    if (instr != NULL)
-        while (nb--) {
-            tmpc = *instr;
-/* GGR - linsert inserts unicode....but we've been sent a (utf8) string! */
-            status = (tmpc == '\n' ? lnewline() : linsert_byte(1, tmpc));
-/* Insertion error? */
-            if (status != TRUE) {
-                mlwrite_one("%Out of memory while inserting");
-                break;
-            }
-            instr++;
+    nl = memchr(text, '\n', len);
+    if (nl == NULL) return (len == 0) || linsert_text(len, 0, text);
+    first = last = NULL;
+    for (;;) {
+        if (nl == NULL) nl = end;
+        lp = lalloc(curbp, nl - text);
+        memcpy(lp->l_text, text, nl - text);
+        if (first == NULL) first = lp;
+        else {
+            last->l_fp = lp;
+            lp->l_bp = last;
         }
+        last = lp;
+        if (nl == end) break;
+        text = nl + 1;
+        nl = memchr(text, '\n', end - text);
+    }
+    return lsplice_chain(first, last);
+}
+
+int linsert_block(const char *text, int len) {
+    int status;
+
+    undo_ins_start();
+    status = linsert_chain(text, len);
+    undo_ins_end();
+    return status;
+}
+
+/*
+ * linsert_literal -- Insert text with every newline in it taken as it
+ * is, even at the end of the buffer (so none of lnewline()'s special
+ * rules apply). Undo uses this to put back text exactly as it was.
+ */
+int linsert_literal(const char *text, int len) {
+    int status;
+
+    force_newline = 2;
+    status = linsert_block(text, len);
+    force_newline = 0;
+    return status;
+}
+
+/*
+ * linstr -- Insert a string at the current point
+ */
+
+int linstr(char *instr) {
+    int status;
+
+/* We have to check this here to avoid the "Out of memory" message
+ * on failure when linsert_block() gripes about it.
+ */
+    if (curbp->b_mode & MDVIEW) /* don't allow this command if */
+        return rdonly();        /* we are in read only mode    */
+
+    if (instr == NULL) return TRUE;
+    status = linsert_block(instr, strlen(instr));
+    if (status == FALSE) mlwrite_one("%Out of memory while inserting");
     return status;
 }
 
@@ -321,7 +1075,7 @@ int lover(char *ostr) {
  * update of dot and mark is a bit easier than in the above case, because the
  * split forces more updating.
  */
-int lnewline(void) {
+static int lsplit(void) {
     char *cp1;
     char *cp2;
     struct line *lp1;
@@ -353,18 +1107,24 @@ int lnewline(void) {
 
     lp1 = curwp->w_dotp;    /* Get the address and  */
     doto = curwp->w_doto;   /* offset of "."        */
-    if ((lp2 = lalloc(doto)) == NULL)   /* New first half line      */
+    if ((lp2 = lalloc(curbp, doto)) == NULL)   /* New first half line      */
         return FALSE;
     cp1 = &lp1->l_text[0];  /* Shuffle text around  */
     cp2 = &lp2->l_text[0];
     while (cp1 != &lp1->l_text[doto]) *cp2++ = *cp1++;
-    cp2 = &lp1->l_text[0];
-    while (cp1 != &lp1->l_text[lp1->l_used]) *cp2++ = *cp1++;
+    if (lp1->l_size == 0)   /* Shared text, so just */
+        lp1->l_text += doto;    /* step over it         */
+    else {
+        cp2 = &lp1->l_text[0];
+        while (cp1 != &lp1->l_text[lp1->l_used]) *cp2++ = *cp1++;
+    }
     lp1->l_used -= doto;
     lp2->l_bp = lp1->l_bp;
     lp1->l_bp = lp2;
     lp2->l_bp->l_fp = lp2;
     lp2->l_fp = lp1;
+    lindex_insert(curbp, lp2);
+    ltouch(curbp, lp1);
     wp = wheadp;            /* Windows              */
 
 /* When inserting a newline we want to keep any mark on the original line if
@@ -389,6 +1149,15 @@ int lnewline(void) {
     return TRUE;
 }
 
+int lnewline(void) {
+    int status;
+
+    undo_ins_start();
+    status = lsplit();
+    undo_ins_end();
+    return status;
+}
+
 /* Get the grapheme structure for what point is looking at.
  * Returns the number of bytes used up by the utf8 string.
  */
@@ -498,17 +1267,22 @@ static int ldelnewline(void) {
             wp = wp->w_wndp;
         }
         lp1->l_used += lp2->l_used;
+        ltouch(curbp, lp1);
+        lindex_remove(curbp, lp2);
         lp1->l_fp = lp2->l_fp;
         lp2->l_fp->l_bp = lp1;
-        free((char *)lp2);
+        lrelease(lp2);
         return TRUE;
     }
-    if ((lp3 = lalloc(lp1->l_used + lp2->l_used)) == NULL) return FALSE;
+    if ((lp3 = lalloc(curbp, lp1->l_used + lp2->l_used)) == NULL) return FALSE;
     cp1 = &lp1->l_text[0];
     cp2 = &lp3->l_text[0];
     while (cp1 != &lp1->l_text[lp1->l_used]) *cp2++ = *cp1++;
     cp1 = &lp2->l_text[0];
     while (cp1 != &lp2->l_text[lp2->l_used]) *cp2++ = *cp1++;
+    lindex_remove(curbp, lp2);
+    lindex_replace(curbp, lp1, lp3);
+    ltouch(curbp, lp3);
     lp1->l_bp->l_fp = lp3;
     lp3->l_fp = lp2->l_fp;
     lp2->l_fp->l_bp = lp3;
@@ -530,8 +1304,8 @@ static int ldelnewline(void) {
         }
         wp = wp->w_wndp;
     }
-    free((char *)lp1);
-    free((char *)lp2);
+    lrelease(lp1);
+    lrelease(lp2);
     return TRUE;
 }
 
@@ -560,7 +1334,7 @@ int ldelgrapheme(long n, int kflag) {
  * long n;              # of chars to delete
  * int kflag;            put killed text in kill buffer flag
  */
-int ldelete(long n, int kflag) {
+static int ldelete_bytes(long n, int kflag) {
     char *cp1;
     char *cp2;
     struct line *dotp;
@@ -579,6 +1353,8 @@ int ldelete(long n, int kflag) {
         if (chunk > n) chunk = n;
         if (chunk == 0) {       /* End of line, merge.  */
             lchange(WFHARD | WFKILLS);
+            if (dotp->l_used == 0 || lforw(dotp) != curbp->b_linep)
+                undo_delete("\n", 1);  /* Not a no-op at the end */
             if (ldelnewline() == FALSE
                   || (kflag != FALSE && kinsert('\n') == FALSE))
                 return FALSE;
@@ -589,14 +1365,24 @@ int ldelete(long n, int kflag) {
         cp1 = &dotp->l_text[doto];      /* Scrunch text.        */
         cp2 = cp1 + chunk;
         if (kflag != FALSE) {           /* Kill?                */
-            while (cp1 != cp2) {
-                if (kinsert(*cp1) == FALSE) return FALSE;
-                ++cp1;
+            if (kinsert_block(cp1, chunk) == FALSE) return FALSE;
+        }
+        undo_delete(cp1, chunk);
+/* Shared text can't be scrunched, but deleting from the start (or the
+ * end) of it doesn't need to move anything.
+ */
+        if (dotp->l_size == 0 && doto == 0)
+            dotp->l_text += chunk;
+        else {
+            if (dotp->l_size == 0 && cp2 != &dotp->l_text[dotp->l_used]) {
+                lown(dotp);
+                cp1 = &dotp->l_text[doto];
+                cp2 = cp1 + chunk;
             }
-            cp1 = &dotp->l_text[doto];
+            while (cp2 != &dotp->l_text[dotp->l_used]) *cp1++ = *cp2++;
         }
-        while (cp2 != &dotp->l_text[dotp->l_used]) *cp1++ = *cp2++;
         dotp->l_used -= chunk;
+        ltouch(curbp, dotp);
         wp = wheadp;                    /* Fix windows          */
         while (wp != NULL) {
             if (wp->w_dotp == dotp && wp->w_doto >= doto) {
@@ -614,28 +1400,13 @@ int ldelete(long n, int kflag) {
     return TRUE;
 }
 
-/*
- * getctext:    grab and return a string with the text of
- *              the current line
- */
-char *getctext(void) {
-    struct line *lp;            /* line to copy */
-    int size;                   /* length of line to return */
-    char *sp;                   /* string pointer into line */
-    char *dp;                   /* string pointer into returned line */
-    static char rline[NSTRING]; /* line to return */
-
-/* Find the contents of the current line and its length */
-    lp = curwp->w_dotp;
-    sp = lp->l_text;
-    size = lp->l_used;
-    if (size >= NSTRING) size = NSTRING - 1;
+int ldelete(long n, int kflag) {
+    int status;
 
-/* Copy it across */
-    dp = rline;
-    while (size--) *dp++ = *sp++;
-    *dp = 0;
-    return rline;
+    undo_del_start();
+    status = ldelete_bytes(n, kflag);
+    undo_del_end();
+    return status;
 }
 
 /*
@@ -660,36 +1431,25 @@ int putctext(char *iline) {
 
 /*
  * Delete all of the text saved in the kill buffer. Called by commands when a
- * new kill context is being created. The kill buffer array is released, just
- * in case the buffer has grown to immense size. No errors.
+ * new kill context is being created. The text of the bottom entry of the
+ * kill ring is released, just in case it has grown to immense size.
+ * No errors.
  */
 void kdelete(void) {
 
-/* First, delete all the chunks on the bottom item.
+/* First, free the text of the bottom item.
  * This is the one we are about to remove.
  */
-    if (kbufh[KRING_SIZE-1] != NULL) {
-        struct kill *np;        /* Next pointer */
-        struct kill *tp = kbufh[KRING_SIZE-1];
-        while (tp != NULL) {
-            np = tp->d_next;
-            free(tp);
-            tp = np;
-        }
-    }
+    free(kbuf[KRING_SIZE-1].d_text);
 
 /* Move the remaining ones down */
 
-    int ix = KRING_SIZE-1;
-    while (ix--) {      /* Move KRING_SIZE-2 ... 0 to one higher */
-        kbufh[ix+1] = kbufh[ix];
-        kused[ix+1] = kused[ix];
-    }
+    memmove(kbuf + 1, kbuf, (KRING_SIZE-1)*sizeof(struct kill));
 
-/* Create a new one at the top and reset all kill buffer pointers */
+/* Create a new (empty) one at the top */
 
-    kbufh[0] = kbufp = NULL;
-    kused[0] = KBLOCK;
+    kbuf[0].d_text = NULL;
+    kbuf[0].d_used = kbuf[0].d_size = 0;
 }
 
 /* A function to rotate the lastmb ring - NOT bindable.
@@ -734,45 +1494,57 @@ static void rotate_kill_ring(int n) {
     if (rotate_count < 0) rotate_count += KRING_SIZE;
     rotate_count = KRING_SIZE - rotate_count;   /* So we go the right way */
     if (rotate_count > 0) {
-        struct kill *tmp_bufh[KRING_SIZE];
-        int tmp_used[KRING_SIZE];
+        struct kill tmp_buf[KRING_SIZE];
         int dx = rotate_count;
         for (int ix = 0; ix < KRING_SIZE; ix++, dx++) {
             dx %= KRING_SIZE;
-            tmp_bufh[dx] = kbufh[ix];
-            tmp_used[dx] = kused[ix];
+            tmp_buf[dx] = kbuf[ix];
         }
-        memcpy(kbufh, tmp_bufh, sizeof(tmp_bufh));
-        memcpy(kused, tmp_used, sizeof(tmp_used));
+        memcpy(kbuf, tmp_buf, sizeof(tmp_buf));
     }
-    kbufp = kbufh[0];
     return;
 }
 
 /*
- * Insert a character to the kill buffer, allocating new chunks as needed.
+ * Append a block of text to the kill buffer, doubling its size as needed.
+ * Return TRUE if all is well, and FALSE on errors.
+ *
+ * const char *text;            text to append to the kill buffer
+ * int len;                     and its length
+ */
+int kinsert_block(const char *text, int len) {
+    struct kill *kp = &kbuf[0];
+
+/* Check to see if we need more room */
+    if (kp->d_used + len > kp->d_size) {
+        int nsize = (kp->d_size)? kp->d_size: KBLOCK;
+        while (nsize < kp->d_used + len) {
+            if (nsize > INT_MAX/2) {
+                mlwrite_one("%Kill buffer too large");
+                return FALSE;
+            }
+            nsize *= 2;
+        }
+        kp->d_text = Xrealloc(kp->d_text, nsize);
+        kp->d_size = nsize;
+    }
+
+/* And now append the text */
+    memcpy(kp->d_text + kp->d_used, text, len);
+    kp->d_used += len;
+    return TRUE;
+}
+
+/*
+ * Insert a character to the kill buffer.
  * Return TRUE if all is well, and FALSE on errors.
  *
  * int c;                       character to insert in the kill buffer
  */
 int kinsert(int c) {
-    struct kill *nchunk;    /* ptr to newly Xmalloced chunk */
-
-/* Check to see if we need a new chunk */
-    if (kused[0] >= KBLOCK) {
-        nchunk = (struct kill *)Xmalloc(sizeof(struct kill));
-        if (kbufh[0] == NULL)  /* set head ptr if first time */
-            kbufh[0] = nchunk;
-        if (kbufp != NULL)  /* point the current to this new one */
-            kbufp->d_next = nchunk;
-        kbufp = nchunk;
-        kbufp->d_next = NULL;
-        kused[0] = 0;
-    }
-
-/* And now insert the character */
-    kbufp->d_chunk[kused[0]++] = c;
-    return TRUE;
+    char ch = c;
+
+    return kinsert_block(&ch, 1);
 }
 
 /*
@@ -784,9 +1556,6 @@ int kinsert(int c) {
 int yank(int f, int n) {
     UNUSED(f);
 
-    char *sp;                       /* pointer into string to insert */
-    struct kill *kp;                /* pointer into kill buffer */
-
 /* Don't allow this command if we are in read only mode */
 
     if (curbp->b_mode & MDVIEW) return rdonly();
@@ -808,7 +1577,7 @@ int yank(int f, int n) {
     curwp->w_marko = curwp->w_doto;
 
 /* Make sure there is something to yank */
-    if (kbufh[0] == NULL) {
+    if (kbuf[0].d_used == 0) {
         thisflag |= CFYANK;         /* It's still a yank... */
         last_yank = NormalYank;     /* Save the type */
         return TRUE;                /* not an error, just nothing */
@@ -836,19 +1605,13 @@ int yank(int f, int n) {
     if (curwp->w_dotp == curbp->b_linep && curwp->w_doto == 0)
          fixup_line = lback(curbp->b_linep);
 
-/* For each time.... */
+/* For each time.... insert the kill buffer text straight from there */
     while (n--) {
-        kp = kbufh[0];
-        while (kp != NULL) {
-            int nb, status;
-            if (kp->d_next == NULL) nb = kused[0];
-            else                    nb = KBLOCK;
-            sp = kp->d_chunk;
-            if (!fixup_line) force_newline = 1;
-            if ((status = lins_nc(sp, nb)) != TRUE) return status;
-            force_newline = 0;
-            kp = kp->d_next;
-        }
+        int status;
+        if (!fixup_line) force_newline = 1;
+        status = linsert_block(kbuf[0].d_text, kbuf[0].d_used);
+        force_newline = 0;
+        if (status != TRUE) return status;
     }
 
 /* This will display the inserted text, leaving the last line at the last
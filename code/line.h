@@ -1,8 +1,16 @@
 #ifndef LINE_H_
 #define LINE_H_
 
+#include <stddef.h>
+#include <sys/types.h>
 #include "utf8.h"
 
+struct buffer;
+struct text_block;
+struct line_arena;
+struct lchunk;
+struct ltext;
+
 /*
  * All text is kept in circularly linked lists of "struct line" structures.
  * These begin at the header line (which is the blank line beyond the
@@ -14,13 +22,21 @@
  * marker!!!
  * Future additions will include update hints, and a list of marks
  * into the line.
+ *
+ * The text is normally allocated along with the line structure, but
+ * lines read in from a file just point at the text in a block held by
+ * the buffer (see struct text_block) and have an l_size of 0.
+ * Such text is treated as read-only and is copied to a private
+ * allocation (lown()) the first time that it needs to be altered in place.
  */
 struct line {
     struct line *l_fp;      /* Link to the next line        */
     struct line *l_bp;      /* Link to the previous line    */
-    int l_size;             /* Allocated size               */
+    char *l_text;           /* A bunch of characters.       */
+    struct lchunk *l_chunk; /* Line index chunk (lindex.c)  */
+    int l_size;             /* Allocated size (0 == shared) */
     int l_used;             /* Used size                    */
-    char l_text[1];         /* A bunch of characters.       */
+    unsigned long l_gen;    /* Generation (see ltouch())    */
 };
 
 #define lforw(lp)       ((lp)->l_fp)
@@ -31,10 +47,33 @@ struct line {
 #define lfillchars(lp, n, c)    (memcpy((lp)->l_text, (c), (n)))
 
 extern void lfree(struct line *lp);
+extern void lrelease(struct line *lp);
+extern void lown(struct line *lp);
+extern struct line *lalloc_shared(struct buffer *, char *, int);
+extern void lappend(struct buffer *, struct line *);
+extern void ltouch(struct buffer *, struct line *);
+extern struct line_arena *larena_alloc(void);
+extern void larena_release(struct line_arena *);
+extern size_t lmem_live(void);
+extern size_t lmem_waste(void);
+extern int lmem_slabs(void);
+extern struct text_block *lstore_add(struct buffer *, char *, size_t);
+extern void lstore_free(struct buffer *);
+extern void lstore_unmap(dev_t, ino_t);
+extern void lstore_unmap_all(void);
+extern int lstore_fault(char *);
+extern struct ltext *ltext_take(struct buffer *);
+extern void ltext_swap(struct buffer *, struct ltext *);
+extern void ltext_free(struct ltext *);
+extern size_t ltext_size(struct ltext *);
 extern void lchange(int flag);
 extern int insspace(int f, int n);
 extern int linsert_byte(int, unsigned char);
 extern int linstr(char *instr);
+extern int linsert_block(const char *text, int len);
+extern int linsert_literal(const char *text, int len);
+extern int lsplice(struct line *first, struct line *last);
+extern void linsert_lines(struct line *first, struct line *last);
 extern int linsert_uc(int n, unicode_t c);
 extern int lover(char *ostr);
 extern int lnewline(void);
@@ -44,15 +83,32 @@ extern int lgetgrapheme(struct grapheme *, int);
 #ifdef CURRENTLY_UNUSED
 extern int lputgrapheme(struct grapheme *gp);
 #endif
-extern char *getctext(void);
 extern int putctext(char *iline);
 extern void kdelete(void);
 extern void addto_lastmb_ring(char *);
 extern int kinsert(int c);
+extern int kinsert_block(const char *text, int len);
 extern int yank(int f, int n);
 extern int yank_replace(int, int);
 extern int yankmb(int f, int n);
-extern struct line *lalloc(int);  /* Allocate a line. */
+extern struct line *lalloc(struct buffer *, int);  /* Allocate a line. */
+
+/* lindex.c */
+extern void lindex_drop(struct buffer *);
+extern void lindex_insert(struct buffer *, struct line *);
+extern void lindex_remove(struct buffer *, struct line *);
+extern void lindex_replace(struct buffer *, struct line *, struct line *);
+extern int lindex_nlines(struct buffer *);
+extern int lindex_lineno(struct buffer *, struct line *);
+extern struct line *lindex_goto(struct buffer *, int);
+extern void lindex_touch(struct buffer *, struct line *);
+extern long lindex_nbytes(struct buffer *);
+extern long lindex_bytes(struct buffer *, struct line *);
+extern struct line *lindex_chunk(struct buffer *, struct line *,
+     int *, long *, long *);
+extern int lindex_nchunks(struct buffer *);
+extern struct line *lindex_chunkat(struct buffer *, int, int *);
+extern int lindex_chunkno(struct buffer *, struct line *);
 
 /* A macro to determine the effect on the "display column" of adding a
  * given character.
@@ -65,6 +65,7 @@
 #include "efunc.h"   /* Function declarations and name table. */
 #include "ebind.h"   /* Default key bindings. */
 #include "version.h"
+#include "line.h"
 
 #ifndef GOOD
 #define GOOD    0
@@ -359,7 +360,7 @@ static int end_kbdmacro(void) {
 int macro_helper(int f, int n) {
     UNUSED(f);
     char tag[2];                        /* Just char + NULL needed */
-    int status = mlreply("helper:", tag, 1, CMPLT_NONE);
+    int status = mlreply("helper:", tag, sizeof(tag), CMPLT_NONE);
     if (status != TRUE) return status;  /* Only act on +ve response */
     switch(tag[0]) {
     case '}':
@@ -508,6 +509,12 @@ static void dump_modified_buffers(void) {
     char tagged_name[NFILEN], orig_name[NFILEN];
     int ts_len = set_time_stamp(0);     /* Set it for "now" */
 
+/* Copy any mapped files into memory first, so that what we write can't
+ * depend on files which may have been cut short under us (anything lost
+ * from them reads as zeroes - see bus_signal()).
+ */
+    lstore_unmap_all();
+
 /* Scan the buffers */
 
     int index_open = 0;
@@ -777,6 +784,29 @@ void exit_via_signal(int signr) {
     exit(signr);
 }
 
+/* ======================================================================
+ * Signal handler for SIGBUS.
+ * This is what we get if a file that we have mapped (see ffreadall())
+ * is cut short by someone else and we then look at the part that went.
+ * lstore_fault() maps zeroes over that, so we can return and retry.
+ * Anything else is fatal, as for the other signals.
+ * It is set with SA_NODEFER, so that a lost mapping met while saving the
+ * buffers on the way out is handled too, which means a second fatal
+ * SIGBUS has to be left to the default action.
+ */
+static void bus_signal(int signr, siginfo_t *si, void *uctx) {
+    UNUSED(uctx);
+    static int dying = 0;
+
+    if (lstore_fault(si->si_addr)) return;
+    if (dying) {
+        signal(SIGBUS, SIG_DFL);
+        return;             /* ...and fault again */
+    }
+    dying = 1;
+    exit_via_signal(signr);
+}
+
 /* ====================================================================== */
 
 com_arg *multiplier_check(int c) {
@@ -877,7 +907,6 @@ int main(int argc, char **argv) {
     char bname[NBUFN];      /* buffer name of file to read */
     int cryptflag;          /* encrypting on the way in? */
     char ekey[NPAT];        /* startup encryption key */
-    int newc;
     int verflag = 0;        /* GGR Flags -v/-V presence on command line */
     char *rcfile = NULL;    /* GGR non-default rc file */
     char *rcextra[10];      /* GGR additional rc files */
@@ -898,9 +927,14 @@ int main(int argc, char **argv) {
     sigact.sa_handler = exit_via_signal;
     sigact.sa_flags = SA_RESETHAND; /* So we can't loop into our handler */
 /* The SIGTERM is there so you can trace a loop by sending one */
-    int siglist[] = { SIGBUS, SIGFPE, SIGSEGV, SIGTERM, SIGABRT };
+    int siglist[] = { SIGFPE, SIGSEGV, SIGTERM, SIGABRT };
     for (unsigned int si = 0; si < sizeof(siglist)/sizeof(siglist[0]); si++)
         sigaction(siglist[si], &sigact, &oldact);
+/* SIGBUS may just be a mapped file having been truncated */
+    sigact.sa_sigaction = bus_signal;
+    sigact.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigaction(SIGBUS, &sigact, &oldact);
+    sigact.sa_flags = SA_RESETHAND;
     called_as = argv[0];
 /* The old one to get you out... */
     sigact.sa_handler = emergencyexit;
@@ -1164,23 +1198,10 @@ loop:
     execute(META | SPEC | 'C', FALSE, 1);
     lastflag = saveflag;
 
-    if (typahead()) {
-        newc = getcmd();
-        update(FALSE);
-        do {
-            if (c == newc) {
-                struct key_tab *ktp = getbind(c);
-                if (ktp) {
-                    fn_t execfunc = ktp->hndlr.k_fp;
-                    if (execfunc != insert_newline && execfunc != insert_tab)
-                         newc = getcmd();
-                }
-            }
-            else break;
-        } while (typahead());
-        c = newc;
-    }
-    else {
+/* Show the result, unless more input is already waiting and the last
+ * screen update was too recent (see update_due()).
+ */
+    if (update_due()) {
         update(FALSE);
         if (display_readin_msg) {   /* First one gets removed by update() */
             mlwrite_one(readin_mesg);
@@ -1188,8 +1209,8 @@ loop:
             movecursor(0, 0);       /* Send the cursor back to BoB */
             TTflush();
         }
-        c = getcmd();
     }
+    c = getcmd();
 /* If there is something on the command line, clear it */
     if (mpresf != FALSE) {
         mlerase();
@@ -1205,6 +1226,7 @@ loop:
 
 /* And execute the command */
     if (carg->n) mlerase();   /* Remove any numeric arg */
+    undo_boundary();
     execute(carg->c, carg->f, carg->n);
     goto loop;
 }
@@ -1490,6 +1512,7 @@ int execute(int c, int f, int n) {
             return n < 0 ? FALSE : TRUE;
         }
         thisflag = 0;   /* For the future.      */
+        undo_typed();   /* Runs of these are undone together */
 
 /* If we are in overwrite mode, not at eol, and next char is not a tab
  * or we are at a tab stop, delete a char forward
@@ -21,6 +21,7 @@ struct name_bind names[] = {
     {"beginning-of-file", gotobob, {0, 0}},
     {"beginning-of-line", gotobol, {0, 0}},
     {"bind-to-key", bindtokey, {0, 0}},
+    {"bracketed-paste", bracketed_paste, {1, 0}},
     {"buffer-position", showcpos, {0, 0}},
     {"buffer-to-key", buffertokey, {0, 0}},     /* GGR */
     {"case-region-lower", lowerregion, {0, 0}},
@@ -127,6 +128,7 @@ struct name_bind names[] = {
     {"kill-to-end-of-line", killtext, {0, 0}},
     {"leave-one-white", leaveone, {0, 0}},      /* GGR */
     {"list-buffers", listbuffers, {0, 1}},
+    {"list-profile", listprofile, {0, 1}},
     {"macro-helper", macro_helper, {0, 1}},     /* GGR */
     {"makelist-region", makelist_region, {0, 0}},       /* GGR */
     {"numberlist-region", numberlist_region, {0, 0}},   /* GGR */
@@ -145,6 +147,8 @@ struct name_bind names[] = {
     {"next-window", nextwind, {0, 1}},
     {"next-word", forwword, {0, 0}},
     {"nop", nullproc, {1, 0}},
+    {"occur", occur, {0, 1}},
+    {"occur-goto", occur_goto, {0, 1}},
     {"open-line", openline, {0, 0}},
     {"overwrite-string", ovstring, {0, 0}},
     {"pipe-command", pipecmd, {0, 1}},
@@ -158,6 +162,7 @@ struct name_bind names[] = {
     {"quote-character", quote, {1, 0}},
     {"quoted-count", quotedcount, {0, 0}},      /* GGR */
     {"read-file", fileread, {0, 0}},
+    {"redo", redo, {0, 0}},
     {"redraw-display", reposition, {0, 0}},
     {"reexecute", reexecute, {0, 0}},           /* GGR */
     {"resize-window", resize, {0, 1}},
@@ -191,6 +196,7 @@ struct name_bind names[] = {
     {"trim-line", trim, {0, 0}},
     {"type-tab", typetab, {0, 0}},              /* GGR */
     {"unbind-key", unbindkey, {0, 0}},
+    {"undo", undo, {0, 0}},
     {"universal-argument", unarg, {0, 0}},
     {"unmark-buffer", unmark, {0, 1}},
     {"update-screen", upscreen, {0, 0}},
@@ -1,8 +1,8 @@
 /*      posix.c
  *
  *      The functions in this file negotiate with the operating system for
- *      characters, and write characters in a barely buffered fashion on the
- *      display. All operating systems.
+ *      characters, and write characters to the display, buffering them
+ *      until it is flushed. All operating systems.
  *
  *      modified by Petri Kutvonen
  *
@@ -14,10 +14,15 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <termios.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 
 #include "estruct.h"
 #include "edef.h"
@@ -46,8 +51,17 @@ static int kbdpoll;                     /* in O_NDELAY mode             */
 static struct termios otermios;         /* original terminal characteristics */
 static struct termios ntermios;         /* charactoristics to use inside */
 
-#define TBUFSIZ 128
-static char tobuf[TBUFSIZ];             /* terminal output buffer */
+/* Terminal output is collected in a list of blocks until ttflush(), which
+ * writes them all with one writev(). update() only flushes once it has
+ * done the whole screen, so a screen update is (usually) one write,
+ * however many characters and escape sequences it takes.
+ * Each block's iov_base stays as allocated, iov_len is how much is used.
+ */
+#define TBLKSIZ 4096                    /* Size of an output block      */
+#define TBLKMAX 64                      /* Most blocks per writev()     */
+static struct iovec *toblk;             /* The blocks...                */
+static int toalloc;                     /* ...how many we have...       */
+static int tonblk;                      /* ...and how many are in use   */
 
 
 /*
@@ -85,11 +99,6 @@ void ttopen(void) {
     ntermios.c_cc[VTIME] = 0;
     tcsetattr(0, TCSADRAIN, &ntermios);     /* and activate them */
 
-/* Provide a smaller terminal output buffer so that the type-ahead
- * detection works better (more often)
- */
-    setbuffer(stdout, &tobuf[0], TBUFSIZ);
-
     kbdflgs = fcntl(0, F_GETFL, 0);
     kbdpoll = FALSE;
 
@@ -103,20 +112,26 @@ void ttopen(void) {
  * Another no-operation on CPM.
  */
 void ttclose(void) {
+    ttflush();                          /* Anything still to go */
     tcsetattr(0, TCSADRAIN, &otermios); /* restore terminal settings */
 }
 
-/* Write a character to the display. On VMS, terminal output is buffered, and
- * we just put the characters in the big array, after checking for overflow.
- * On CPM terminal I/O unbuffered, so we just write the byte out. Ditto on
- * MS-DOS (use the very very raw console output routine).
+/* Write a character to the display. We just put it (as utf8) at the end of
+ * the last output block, starting a new block if there's no room for it.
  */
 int ttputc(int c) {
-    char utf8[6];
-    int bytes;
+    struct iovec *iv;
 
-    bytes = unicode_to_utf8(c, utf8);
-    fwrite(utf8, 1, bytes, stdout);
+    if (tonblk == 0 || toblk[tonblk - 1].iov_len > TBLKSIZ - 6) {
+        if (tonblk == toalloc) {
+            toblk = Xrealloc(toblk, (toalloc + 1)*sizeof(struct iovec));
+            toblk[toalloc].iov_base = Xmalloc(TBLKSIZ);
+            toalloc++;
+        }
+        toblk[tonblk++].iov_len = 0;
+    }
+    iv = toblk + tonblk - 1;
+    iv->iov_len += unicode_to_utf8(c, (char *)iv->iov_base + iv->iov_len);
     return 0;
 }
 
@@ -132,17 +147,43 @@ void ttflush(void) {
  * everything?
  *
  * jph, 8-Oct-1993
- * Jani Jaakkola suggested using select after EAGAIN but let's just wait a bit
+ * Jani Jaakkola suggested using select after EAGAIN, which we now do
+ * (with poll()).
  *
+ * We write up to TBLKMAX blocks at a time, working on a copy of their
+ * iovecs so we can step over what a short write did write.
  */
-    int status;
-
-    status = fflush(stdout);
-    while (status < 0 && errno == EAGAIN) {
-        sleep(1);
-        status = fflush(stdout);
+    struct iovec iov[TBLKMAX];
+    struct pollfd out = { 1, POLLOUT, 0 };
+    int next = 0, niov, i;
+    ssize_t done;
+
+    fflush(stdout);         /* Just in case anything went there */
+    while (next < tonblk) {
+        niov = tonblk - next;
+        if (niov > TBLKMAX) niov = TBLKMAX;
+        memcpy(iov, toblk + next, niov*sizeof(struct iovec));
+        next += niov;
+        i = 0;
+        while (i < niov) {
+            done = writev(1, iov + i, niov - i);
+            if (done < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN) {
+                    poll(&out, 1, -1);
+                    continue;
+                }
+                exit(15);
+            }
+            while (i < niov && (size_t)done >= iov[i].iov_len)
+                done -= iov[i++].iov_len;
+            if (i < niov) {
+                iov[i].iov_base = (char *)iov[i].iov_base + done;
+                iov[i].iov_len -= done;
+            }
+        }
     }
-    if (status < 0) exit(15);
+    tonblk = 0;
 }
 
 /* Read a character from the terminal, performing no editing and doing no
@@ -153,18 +194,41 @@ void ttflush(void) {
  * all bytes in one go, but we do allow for a small delay in them
  * arriving for processing into one unicode character.
  */
-#include <poll.h>
 static struct pollfd ue_wait = { 0, POLLIN, 0 };
 
+/* Bytes read but not yet returned (typahead() counts these too) */
+static char buffer[32];
+static int pending;
+
+/* Input that ttgetpaste() read beyond the end of a paste, which has to be
+ * taken before anything more from the terminal.
+ */
+static char *spill;
+static int spill_len, spill_off;
+
+static int ttread(char *buf, int len) {
+    int n;
+
+    if (spill == NULL) return read(0, buf, len);
+    n = spill_len - spill_off;
+    if (n > len) n = len;
+    memcpy(buf, spill + spill_off, n);
+    spill_off += n;
+    if (spill_off == spill_len) {
+        free(spill);
+        spill = NULL;
+        spill_len = spill_off = 0;
+    }
+    return n;
+}
+
 int ttgetc(void) {
-    static char buffer[32];
-    static int pending;
     unicode_t c;
     int count, bytes = 1, expected;
 
     count = pending;
     if (!count) {
-        count = read(0, buffer, sizeof(buffer));
+        count = ttread(buffer, sizeof(buffer));
         if (count <= 0) return 0;
         pending = count;
     }
@@ -181,9 +245,11 @@ int ttgetc(void) {
 
 /* Special character - try to fill buffer */
     while (pending < expected) {
-        int chars_waiting = poll(&ue_wait, 1, 100);
-        if (chars_waiting <= 0) break;
-        pending += read(0, buffer + count, sizeof(buffer) - count);
+        if (spill == NULL) {
+            int chars_waiting = poll(&ue_wait, 1, 100);
+            if (chars_waiting <= 0) break;
+        }
+        pending += ttread(buffer + count, sizeof(buffer) - count);
     }
     if (pending > 1) {
         char second = buffer[1];
@@ -201,6 +267,63 @@ done:
     return c;
 }
 
+/* Read the text of a bracketed paste, the start of which (ESC [ 200 ~)
+ * has just been read, up to the ESC [ 201 ~ that ends it.
+ * This takes whatever ttgetc() already has and then reads in large
+ * blocks, without any conversion, so a large paste arrives in a few
+ * read()s. Anything read after the end is kept for ttgetc().
+ * Returns the (Xmalloc()ed) text, with its length in *lenp.
+ */
+#define PBLKSIZ 65536
+
+char *ttgetpaste(int *lenp) {
+    static const char paste_end[] = "\033[201~";
+    char *text, *ep;
+    int size, len, from, got, rest;
+
+    size = PBLKSIZ;
+    text = Xmalloc(size);
+    memcpy(text, buffer, pending);
+    len = pending;
+    pending = 0;
+    from = 0;
+    for (;;) {
+        ep = text + from;
+        while ((ep = memchr(ep, 033, text + len - ep)) != NULL) {
+            if (text + len - ep >= 6 && memcmp(ep, paste_end, 6) == 0) break;
+            ep++;
+        }
+        if (ep != NULL) break;
+        from = (len > 5)? len - 5: 0;
+        if (size - len < PBLKSIZ/2) {
+            size *= 2;
+            text = Xrealloc(text, size);
+        }
+        got = ttread(text + len, size - len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {             /* No end? Take what we have */
+            ep = text + len;
+            break;
+        }
+        len += got;
+    }
+
+/* Keep anything after the end, in front of whatever was still spilt */
+    rest = (ep < text + len)? text + len - (ep + 6): 0;
+    if (rest > 0) {
+        int old = spill_len - spill_off;
+        char *sp = Xmalloc(rest + old);
+        memcpy(sp, ep + 6, rest);
+        if (old) memcpy(sp + rest, spill + spill_off, old);
+        free(spill);
+        spill = sp;
+        spill_len = rest + old;
+        spill_off = 0;
+    }
+    *lenp = ep - text;
+    return text;
+}
+
 /* typahead:    Check to see if any characters are already in the
  *                keyboard buffer
  */
@@ -213,7 +336,7 @@ int typahead(void) {
 #else
     x = 0;
 #endif
-    return x;
+    return x + pending + spill_len - spill_off;
 }
 
 #endif                          /* POSIX */
@@ -0,0 +1,231 @@
+/*      profile.c
+ *
+ * Macro profiling.
+ *
+ * While $profile is TRUE dobuf() counts each line it runs, and the time
+ * from starting that line to starting the next (so a line which runs a
+ * procedure includes the time spent in it), and docmd() counts and times
+ * each command it calls. Lines which are only being stored (the body of
+ * a store-procedure) aren't run, so aren't counted.
+ * The results are kept by file name (or buffer name, for a buffer with
+ * no file, such as a procedure) and line number, rather than with the
+ * compiled buffer, so they outlive the temporary buffers used by
+ * execute-file, and two files with the same base name (so the same
+ * buffer name, at different times) are kept apart.
+ * list-profile shows them, slowest first, in /Profile.
+ * Setting $profile TRUE again starts a new profile.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+#include "utf8.h"
+
+#define PROF_TEXT   40          /* Most of a line's text to keep */
+
+struct prof_entry {
+    char *p_name;               /* File, buffer or command name */
+    int p_lineno;               /* Line number (0 for a command) */
+    char *p_text;               /* Start of the line (NULL for a command) */
+    long p_count;               /* Times run */
+    long long p_ns;             /* Total time, in nanoseconds */
+};
+
+static struct prof_entry *pe;
+static int pe_count, pe_alloc;
+static int *pe_hash;            /* Open hash of pe index + 1 */
+static int pe_hsize;            /* A power of 2 */
+
+/* Bumped by prof_reset(), so anything holding an entry index (dobuf()
+ * keeps one in each compiled line) knows it is out of date.
+ */
+unsigned int prof_generation = 1;
+
+static unsigned int prof_hashof(char *name, int lineno) {
+    unsigned int h = 2166136261u;
+    while (*name) h = (h ^ (unsigned char)*name++) * 16777619u;
+    return (h ^ (unsigned int)lineno) * 16777619u;
+}
+
+/* Monotonic time, in nanoseconds */
+long long prof_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/* Throw away the profile gathered so far */
+void prof_reset(void) {
+    for (int i = 0; i < pe_count; i++) {
+        free(pe[i].p_name);
+        free(pe[i].p_text);
+    }
+    pe_count = 0;
+    if (pe_hash) memset(pe_hash, 0, pe_hsize*sizeof(int));
+    prof_generation++;
+}
+
+/* Find the entry for a line or command, creating it if need be.
+ * Returns its index.
+ *
+ * char *name;                  file, buffer or command name
+ * int lineno;                  line number in the buffer (0 for a command)
+ * char *text;                  text of the line (NULL for a command)
+ */
+int prof_entry(char *name, int lineno, char *text) {
+    unsigned int hi;
+    int i, len, next, tlen;
+
+    if (pe_hsize) {
+        for (hi = prof_hashof(name, lineno);
+             (i = pe_hash[hi & (pe_hsize - 1)]); hi++) {
+            if (pe[i - 1].p_lineno == lineno &&
+                 strcmp(pe[i - 1].p_name, name) == 0)
+                return i - 1;
+        }
+    }
+    if (2*(pe_count + 1) >= pe_hsize) {         /* (Re)build the hash */
+        pe_hsize = pe_hsize? 2*pe_hsize: 256;
+        free(pe_hash);
+        pe_hash = Xmalloc(pe_hsize*sizeof(int));
+        memset(pe_hash, 0, pe_hsize*sizeof(int));
+        for (i = 0; i < pe_count; i++) {
+            hi = prof_hashof(pe[i].p_name, pe[i].p_lineno);
+            while (pe_hash[hi & (pe_hsize - 1)]) hi++;
+            pe_hash[hi & (pe_hsize - 1)] = i + 1;
+        }
+    }
+    if (pe_count == pe_alloc) {
+        pe_alloc = pe_alloc? 2*pe_alloc: 256;
+        pe = Xrealloc(pe, pe_alloc*sizeof(struct prof_entry));
+    }
+    pe[pe_count].p_name = strdup(name);
+    pe[pe_count].p_lineno = lineno;
+    pe[pe_count].p_text = NULL;
+    if (text) {             /* Keep whole characters, up to PROF_TEXT bytes */
+        tlen = strlen(text);
+        for (len = 0; len < tlen; len = next) {
+            next = next_utf8_offset(text, len, tlen, TRUE);
+            if (next > PROF_TEXT) break;
+        }
+        pe[pe_count].p_text = strndup(text, len);
+    }
+    pe[pe_count].p_count = 0;
+    pe[pe_count].p_ns = 0;
+    hi = prof_hashof(name, lineno);
+    while (pe_hash[hi & (pe_hsize - 1)]) hi++;
+    pe_hash[hi & (pe_hsize - 1)] = pe_count + 1;
+    return pe_count++;
+}
+
+/* Add a run, and the time it took, to an entry.
+ * Ignored if the profile has been reset since the index was handed out.
+ *
+ * int idx;                     index from prof_entry()
+ * unsigned int gen;            prof_generation when it was
+ * long long ns;                time taken
+ */
+void prof_add(int idx, unsigned int gen, long long ns) {
+    if (gen != prof_generation) return;
+    pe[idx].p_count++;
+    pe[idx].p_ns += ns;
+}
+
+/* Call a command, timing it.
+ *
+ * struct name_bind *nbp;       the command
+ * int f, n;                    its arguments
+ */
+int prof_call(struct name_bind *nbp, int f, int n) {
+    int idx = prof_entry(nbp->n_name, 0, NULL);
+    unsigned int gen = prof_generation;
+    long long start = prof_now();
+    int status;
+
+    status = (nbp->n_func)(f, n);
+    prof_add(idx, gen, prof_now() - start);
+    return status;
+}
+
+/* Slowest first */
+static int prof_cmp(const void *a, const void *b) {
+    long long ta = pe[*(const int *)a].p_ns;
+    long long tb = pe[*(const int *)b].p_ns;
+
+    if (ta > tb) return -1;
+    if (ta < tb) return 1;
+    return *(const int *)a - *(const int *)b;
+}
+
+static int prof_addline(struct buffer *bp, char *text) {
+    struct line *lp;
+    int ntext = strlen(text);
+
+    if ((lp = lalloc(bp, ntext)) == NULL) return FALSE;
+    lfillchars(lp, ntext, text);
+    lappend(bp, lp);
+    return TRUE;
+}
+
+/*
+ * list-profile -- Show the profile gathered while $profile was TRUE:
+ *      the lines run, then the commands called, each with the number of
+ *      times run and the total and average time, slowest first.
+ */
+int listprofile(int f, int n) {
+    UNUSED(f); UNUSED(n);
+    struct buffer *bp;
+    struct prof_entry *ep;
+    char line[NSTRING];
+    int *order;
+    int i, len, status;
+
+    if (pe_count == 0) {
+        mlwrite_one(MLbkt("No profile - set $profile TRUE first"));
+        return FALSE;
+    }
+    if ((bp = bfind("/Profile", TRUE, 0)) == NULL) return FALSE;
+    bp->b_flag &= ~BFCHG;               /* Don't complain!      */
+    if ((status = bclear(bp)) != TRUE) return status;
+
+    order = Xmalloc(pe_count*sizeof(int));
+    for (i = 0; i < pe_count; i++) order[i] = i;
+    qsort(order, pe_count, sizeof(int), prof_cmp);
+
+    status = prof_addline(bp,
+         "    Count    Total ms   Avg us  Line");
+    for (i = 0; status && i < pe_count; i++) {
+        ep = pe + order[i];
+        if (ep->p_lineno == 0 || ep->p_count == 0) continue;
+        len = snprintf(line, sizeof(line), "%9ld %11.3f %8.1f  %s:%d  ",
+             ep->p_count, ep->p_ns/1e6, ep->p_ns/1e3/ep->p_count,
+             ep->p_name, ep->p_lineno);
+        if (len < (int)sizeof(line))
+            snprintf(line + len, sizeof(line) - len, "%s", ep->p_text);
+        status = prof_addline(bp, line);
+    }
+    if (status) status = prof_addline(bp, "");
+    if (status) status = prof_addline(bp,
+         "    Count    Total ms   Avg us  Command");
+    for (i = 0; status && i < pe_count; i++) {
+        ep = pe + order[i];
+        if (ep->p_lineno != 0 || ep->p_count == 0) continue;
+        snprintf(line, sizeof(line), "%9ld %11.3f %8.1f  %s",
+             ep->p_count, ep->p_ns/1e6, ep->p_ns/1e3/ep->p_count,
+             ep->p_name);
+        status = prof_addline(bp, line);
+    }
+    free(order);
+    if (!status) return FALSE;
+
+    bp->b_mode |= MDVIEW;
+    bp->b_flag &= ~BFCHG;
+    return showbuffer(bp);
+}
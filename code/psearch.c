@@ -0,0 +1,261 @@
+/*      psearch.c
+ *
+ * A multi-threaded search of a large buffer for a literal pattern.
+ *
+ * When $search_threads is more than 1, forward and reverse searches
+ * (and hunts) for a pattern that has no newline in it (and isn't a
+ * MAGIC one) can be run here instead of by scanner(). Any match must then
+ * be within one line, so the buffer can be split up into separate runs
+ * of lines - the chunks of its line index (lindex.c) - and these are
+ * handed out in turn to a pool of worker threads, each of which runs
+ * litfwd()/litback() (search.c) over the lines of its chunks.
+ *
+ * Each chunk records how many (non-overlapping) matches there are in it
+ * and the match nearest to "." in the search direction (if it's in the
+ * right place for that), so at the end we have the match to move to and
+ * a count of the matches in the whole buffer.
+ *
+ * The worker threads are started when first needed and then wait for the
+ * next search. They only ever read the lines, and the buffer can't change
+ * while they are doing so, as the main thread is waiting for them. It
+ * checks the keyboard while it waits, so a search may be aborted with ^G.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+
+#define PS_MAXTHREADS   64      /* Most workers we'll start */
+#define PS_MINCHUNKS    8       /* Not worth it for a smaller buffer */
+#define PS_POLLMS       20      /* Keyboard check interval while waiting */
+
+struct pschunk {
+    struct line *pc_first;      /* First line of the chunk... */
+    int pc_nlines;              /* ...and how many are in it */
+    int pc_want;                /* Look for the match to move to */
+    struct line *pc_from;       /* Only at/after (before) here... */
+    int pc_fromoff;             /* ...and this offset (NULL - anywhere) */
+    int pc_count;               /* Matches in the chunk */
+    struct line *pc_mline;      /* The match to move to (if any) */
+    int pc_moff;                /* Where it starts */
+};
+
+/* The pool and the search it is working on. All under ps_lock. */
+static pthread_mutex_t ps_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ps_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ps_done = PTHREAD_COND_INITIALIZER;
+static int ps_nthreads;         /* Workers started */
+static struct litpat ps_lt;     /* The pattern */
+static int ps_direct;           /* FORWARD or REVERSE */
+static struct pschunk *ps_chunk;
+static int ps_nchunk;
+static int ps_next;             /* Next chunk to hand out */
+static int ps_left;             /* Chunks handed out or to be, not done */
+
+/*
+ * Search the lines of one chunk.
+ */
+static void ps_scan(struct pschunk *pc) {
+    struct line *lp = pc->pc_first;
+    int plen = ps_lt.lp_len;
+    int n, off, first, len;
+    int look = pc->pc_want;
+
+/* Forwards we start looking at pc_from, backwards we stop there */
+    if (pc->pc_from != NULL && ps_direct == FORWARD) look = FALSE;
+
+    for (n = pc->pc_nlines; n--; lp = lforw(lp)) {
+        len = llength(lp);
+        first = -1;
+        for (off = 0; (off = litfwd(&ps_lt, lp->l_text, len, off)) >= 0;
+             off += plen) {
+            if (first < 0) first = off;
+            pc->pc_count++;
+        }
+        if (ps_direct == FORWARD) {
+            if (lp == pc->pc_from && pc->pc_want) {
+                look = TRUE;
+                if (first >= 0)
+                    first = litfwd(&ps_lt, lp->l_text, len, pc->pc_fromoff);
+            }
+            if (look && first >= 0) {
+                pc->pc_mline = lp;
+                pc->pc_moff = first;
+                look = FALSE;
+            }
+        }
+        else if (look) {
+            if (first >= 0) {
+                off = litback(&ps_lt, lp->l_text,
+                     (lp == pc->pc_from)? pc->pc_fromoff: len);
+                if (off >= 0) {
+                    pc->pc_mline = lp;
+                    pc->pc_moff = off;
+                }
+            }
+            if (lp == pc->pc_from) look = FALSE;
+        }
+    }
+}
+
+/*
+ * A worker thread. Takes the next chunk of the current search (waiting
+ * for a search if there's nothing left) until the end of time.
+ */
+static void *ps_worker(void *arg) {
+    int i;
+
+    UNUSED(arg);
+    pthread_mutex_lock(&ps_lock);
+    for (;;) {
+        while (ps_next >= ps_nchunk) pthread_cond_wait(&ps_work, &ps_lock);
+        i = ps_next++;
+        pthread_mutex_unlock(&ps_lock);
+        ps_scan(ps_chunk + i);
+        pthread_mutex_lock(&ps_lock);
+        if (--ps_left == 0) pthread_cond_signal(&ps_done);
+    }
+    return NULL;
+}
+
+/*
+ * Make sure we have the workers. They have all signals blocked, so any
+ * signals still go to the main thread.
+ * The exceptions are SIGBUS and SIGSEGV, which are sent to the thread
+ * that caused them and would just kill us if blocked. A SIGBUS from a
+ * mapped file being cut short under a worker must get to bus_signal()
+ * (main.c) to be fixed up, as it would for the main thread.
+ * Returns how many there are.
+ */
+static int ps_start(int want) {
+    pthread_t tid;
+    sigset_t all, old;
+
+    if (want > PS_MAXTHREADS) want = PS_MAXTHREADS;
+    if (ps_nthreads >= want) return ps_nthreads;
+    sigfillset(&all);
+    sigdelset(&all, SIGBUS);
+    sigdelset(&all, SIGSEGV);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    while (ps_nthreads < want) {
+        if (pthread_create(&tid, NULL, ps_worker, NULL) != 0) break;
+        pthread_detach(tid);
+        ps_nthreads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return ps_nthreads;
+}
+
+/*
+ * Has the user typed the abort key while we wait?
+ * Anything else typed is put back for later (and we stop looking).
+ * We look at the terminal ourselves, as typahead() can't tell us
+ * anything where FIONREAD isn't defined.
+ */
+static int ps_aborted(int *polling) {
+    struct pollfd kbd = { 0, POLLIN, 0 };
+    int c;
+
+    if (!*polling || kbdmode == PLAY || poll(&kbd, 1, 0) <= 0) return FALSE;
+    c = TTgetc();
+    if (c == ectoc(abortc)) return TRUE;
+    reeat(c);
+    *polling = FALSE;
+    return FALSE;
+}
+
+/*
+ * parsearch -- Search for "patrn" (in forward order) from "." with the
+ *      worker threads, if this is a search they can do.
+ *      Returns FALSE if not, leaving it to scanner(). Otherwise returns
+ *      TRUE with the result (TRUE, FALSE or ABORT) in "status", having
+ *      left "." and matchline/matchoff where scanner() would and
+ *      reported the number of matches in the buffer.
+ */
+int parsearch(const char *patrn, int direct, int beg_or_end, int *status) {
+    struct timespec until;
+    struct timeval now;
+    struct line *lp;
+    int nchunk, dotchunk, i, count, polling, found;
+
+    if (search_threads < 2 || strchr(patrn, '\n') != NULL) return FALSE;
+    nchunk = lindex_nchunks(curbp);
+    if (nchunk < PS_MINCHUNKS) return FALSE;
+    if (ps_start(search_threads) < 2) return FALSE;
+
+    litprep(&ps_lt, patrn, (curbp->b_mode & MDEXACT) != 0);
+    dotchunk = lindex_chunkno(curbp, curwp->w_dotp);
+    ps_chunk = Xmalloc(nchunk * sizeof(struct pschunk));
+    for (i = 0; i < nchunk; i++) {
+        struct pschunk *pc = ps_chunk + i;
+        pc->pc_first = lindex_chunkat(curbp, i, &pc->pc_nlines);
+        pc->pc_want = (direct == FORWARD)? i >= dotchunk: i <= dotchunk;
+        pc->pc_from = (i == dotchunk)? curwp->w_dotp: NULL;
+        pc->pc_fromoff = curwp->w_doto;
+        pc->pc_count = 0;
+        pc->pc_mline = NULL;
+    }
+
+/* Hand the search out, then wait for it, checking for ^G */
+    pthread_mutex_lock(&ps_lock);
+    ps_direct = direct;
+    ps_nchunk = ps_left = nchunk;
+    ps_next = 0;
+    pthread_cond_broadcast(&ps_work);
+    polling = TRUE;
+    *status = TRUE;
+    while (ps_left > 0) {
+        gettimeofday(&now, NULL);
+        until.tv_sec = now.tv_sec;
+        until.tv_nsec = (now.tv_usec + PS_POLLMS*1000) * 1000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&ps_done, &ps_lock, &until);
+        if (ps_left == 0 || *status == ABORT) continue;
+        pthread_mutex_unlock(&ps_lock);
+        i = ps_aborted(&polling);
+        pthread_mutex_lock(&ps_lock);
+        if (i) {            /* Drop what's not been handed out yet */
+            ps_left -= ps_nchunk - ps_next;
+            ps_nchunk = ps_next;
+            *status = ABORT;
+        }
+    }
+    ps_nchunk = ps_next = 0;
+    pthread_mutex_unlock(&ps_lock);
+
+    if (*status == ABORT) {
+        free(ps_chunk);
+        mlwrite_one(MLbkt("Search aborted"));
+        return TRUE;
+    }
+
+/* Nearest match in the search direction, and the total */
+    count = 0;
+    found = -1;
+    for (i = 0; i < nchunk; i++) {
+        count += ps_chunk[i].pc_count;
+        if (ps_chunk[i].pc_mline == NULL) continue;
+        if (direct == REVERSE || found < 0) found = i;
+    }
+    if (found < 0) *status = FALSE;
+    else {
+        lp = ps_chunk[found].pc_mline;
+        litfound(lp, ps_chunk[found].pc_moff, ps_lt.lp_len, direct,
+             beg_or_end ^ direct);
+    }
+    free(ps_chunk);
+    mlwrite(MLbkt("%d matches"), count);
+    return TRUE;
+}
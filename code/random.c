@@ -52,45 +52,34 @@ int showcpos(int f, int n) {
     int bytes_used = 1;     /* ...by the current grapheme */
     int uc_used = 1;        /* unicode characters in grapheme */
 
-/* Starting at the beginning of the buffer */
-    lp = lforw(curbp->b_linep);
-
-/* Start counting chars and lines */
-    numchars = 0;
-    numlines = 0;
-    predchars = 0;
-    predlines = 0;
+/* The line and byte counts come from the buffer's line index, so we
+ * don't have to walk the whole buffer.
+ */
+    lp = curwp->w_dotp;
+    numlines = lindex_nlines(curbp);
+    numchars = lindex_nbytes(curbp) + numlines;
     curchar = 0;
-    while (lp != curbp->b_linep) {
-/* If we are on the current line, record it */
-        if (lp == curwp->w_dotp) {
-            predlines = numlines;
-            predchars = numchars + curwp->w_doto;
-            if ((curwp->w_doto) == llength(lp)) curchar = '\n';
-            else {
-                struct grapheme glyi;   /* Full data */
-                bytes_used = lgetgrapheme(&glyi, FALSE);
-                curchar = glyi.uc;
-                if (glyi.cdm != 0) uc_used = 2;
-                if (glyi.ex != NULL) {
-                    for (unicode_t *xc = glyi.ex; *xc != UEM_NOCHAR; xc++)
-                        uc_used++;
-                    free(glyi.ex);
-                }
-            }
-        }
-/* On to the next line */
-        ++numlines;
-        numchars += llength(lp) + 1;
-        lp = lforw(lp);
-    }
-
-/* If at end of file, record it */
-    if (curwp->w_dotp == curbp->b_linep) {
+    if (lp == curbp->b_linep) {     /* At end of file */
         predlines = numlines;
         predchars = numchars;
         curchar = UEM_NOCHAR;   /* NoChar */
     }
+    else {
+        predlines = lindex_lineno(curbp, lp) - 1;
+        predchars = lindex_bytes(curbp, lp) + predlines + curwp->w_doto;
+        if ((curwp->w_doto) == llength(lp)) curchar = '\n';
+        else {
+            struct grapheme glyi;   /* Full data */
+            bytes_used = lgetgrapheme(&glyi, FALSE);
+            curchar = glyi.uc;
+            if (glyi.cdm != 0) uc_used = 2;
+            if (glyi.ex != NULL) {
+                for (unicode_t *xc = glyi.ex; *xc != UEM_NOCHAR; xc++)
+                    uc_used++;
+                free(glyi.ex);
+            }
+        }
+    }
 
 /* Get real column and end-of-line column. */
     col = getccol(FALSE);
@@ -140,23 +129,7 @@ int showcpos(int f, int n) {
 
 /* Get the current line number */
 int getcline(void) {
-    struct line *lp;        /* current line */
-    int numlines;           /* # of lines before point */
-
-/* Starting at the beginning of the buffer */
-    lp = lforw(curbp->b_linep);
-
-/* Start counting lines */
-    numlines = 0;
-    while (lp != curbp->b_linep) {
-/* If we are on the current line, record it */
-        if (lp == curwp->w_dotp) break;
-        ++numlines;
-        lp = lforw(lp);
-    }
-
-/* And return the resulting count */
-    return numlines + 1;
+    return lindex_lineno(curbp, curwp->w_dotp);
 }
 
 /*
@@ -230,6 +203,8 @@ int twiddle(int f, int n) {
 
     int reset_col = 0;
     int maxlen = llength(dotp);
+    lown(dotp);                 /* We swap the text in place */
+    ltouch(curbp, dotp);
     char *l_buf = dotp->l_text;
 
 /* GGR
@@ -265,6 +240,7 @@ int twiddle(int f, int n) {
  * a character, so we have to reset to the original column.
  * This is the start of the now R/h character (i.e what was L/h).
  */
+    undo_replace(dotp, lch_st, lch_nb + rch_nb, lch_nb + rch_nb);
     memcpy(rch_buf, l_buf + rch_st, rch_nb);
     memcpy(lch_buf, l_buf + lch_st, lch_nb);
     memcpy(l_buf+lch_st, rch_buf, rch_nb);
@@ -485,7 +461,10 @@ int trim(int f, int n) {
                   break;
             length--;
         }
+        if (length != lp->l_used)
+            undo_replace(lp, length, lp->l_used - length, 0);
         lp->l_used = length;
+        ltouch(curbp, lp);
 
 /* Advance/or back to the next line */
         forwline(TRUE, inc);
@@ -1158,29 +1137,52 @@ enum istr_type { RAW_STR, COOKED_STR };
 
 int string_getter(int f, int n, enum istr_type call_type) {
     int status;                     /* status return code */
-    char tstring[NLINE + 1];        /* string to add */
+    char tstring[NLINE + 1];        /* string to add, if typed */
     char *prompt;
+    char *instr;                    /* String we were given */
     char *istrp;                    /* Final string to insert */
+    char *nstring = NULL;           /* COOKED_STR result */
+    char *tok = NULL;
+    struct value arg = VALUE_INIT;
+
+    if (f == FALSE) n = 1;
+    if (n < 0) n = -n;
+
+/* A string from a macro line is taken as it comes, with no limit on
+ * its size.
+ */
+    if (clexec) {
+        if ((status = macarg_val(&arg)) != TRUE) goto done;
+        instr = val_str(&arg);
+    }
+    else {
 
 /* ask for string to insert, using the requested function */
 
-    if (call_type == RAW_STR) prompt = "String: ";
-    else                      prompt = "Tokens/unicode chars: ";
+        if (call_type == RAW_STR) prompt = "String: ";
+        else                      prompt = "Tokens/unicode chars: ";
 
-    status = mlreply(prompt, tstring, NLINE, CMPLT_NONE);
-    if (status != TRUE)
-        return status;
+        status = mlreply(prompt, tstring, NLINE, CMPLT_NONE);
+        if (status != TRUE)
+            return status;
+        instr = tstring;
+    }
 
 /* For COOKED_STR we have to process this token-by-token
  * NOTE: that this means any spaces in the string WILL BE SKIPPED!
+ * The result is no longer than what we were given, bar U+ values out of
+ * range (which may give up to 7 bytes from 4 characters), so twice that
+ * is plenty.
  */
     if (call_type == COOKED_STR) {
-        char *rp = tstring;
-        char nstring[NLINE] = "";
+        char *rp = instr;
         int nlen = 0;
-        char tok[NLINE];
+        int len = strlen(instr) + 1;
+        nstring = Xmalloc(2*len);
+        nstring[0] = '\0';
+        tok = Xmalloc(len);
         while(*rp != '\0') {
-            rp = token(rp, tok, NLINE);
+            rp = token(rp, tok, len);
             if (tok[0] == '\0') break;
             if (!strncmp(tok, "0x", 2)) {
                 long add = strtol(tok+2, NULL, 16);
@@ -1200,14 +1202,15 @@ int string_getter(int f, int n, enum istr_type call_type) {
         istrp = nstring;
     }
     else
-        istrp = tstring;
-
-    if (f == FALSE) n = 1;
-    if (n < 0) n = -n;
+        istrp = instr;
 
 /* insert it */
 
     while (n-- && (status = linstr(istrp)));
+done:
+    free(nstring);
+    free(tok);
+    val_free(&arg);
     return status;
 }
 
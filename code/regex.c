@@ -0,0 +1,744 @@
+/*      regex.c
+ *
+ * A compiled matcher for MAGIC mode search patterns, which mcscanner()
+ * uses in place of the amatch() backtracking interpreter. (amatch() is
+ * still there, and is used if $magic_dfa is set to FALSE.)
+ *
+ * The pattern syntax is that of mcstr() in search.c, but it works on
+ * unicode characters rather than bytes. So "." matches one character,
+ * a closure applies to the whole of a multi-byte character and
+ * a character class may have any unicode characters (and ranges of
+ * them) in it. When not in EXACT mode the case-folding is done for all
+ * of unicode too.
+ *
+ * The pattern is compiled to a list of items, each a set of characters
+ * (held as sorted ranges) which may or may not be a closure, plus the
+ * BOL/EOL anchors. This is run as an NFA whose states are just the item
+ * positions, and a DFA is built from it lazily as the text is scanned,
+ * so matching is linear in the length of the text however many closures
+ * there are (amatch() can go exponential on nested ones).
+ * Characters are mapped to classes (sets of characters that no item can
+ * tell apart) to keep the DFA transition tables small.
+ *
+ * A search finds the same match as amatch() would: the one starting
+ * nearest to "." and, of those, the one amatch()'s greedy closures pick.
+ * The DFA states are lists of NFA states in amatch()'s order of
+ * preference, so we get this by dropping everything after a match in
+ * the list ("leftmost-first"). That tells us where the match ends; we
+ * then go back over the text with the pattern reversed, looking for the
+ * longest match, to find where it starts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+#include "utf8.h"
+
+#include "utf8proc.h"
+
+#define RX_MAXSTATE 1024        /* Flush the DFA when it gets this big */
+#define RX_HASH     2048        /* Size of the DFA state hash table */
+
+struct rx_range {
+    unicode_t lo, hi;
+};
+
+struct rx_item {
+    int closure;                /* Zero or more of these? */
+    int nrange;
+    struct rx_range *range;     /* Characters it matches (sorted) */
+};
+
+/* A DFA state. The list is the NFA states (item positions) it
+ * represents, in order of preference. nitem (end of pattern) is only
+ * left in the list when the pattern has to end at an end of line.
+ */
+struct rx_state {
+    int flags;
+    int hnext;                  /* Next in hash chain */
+    int *next;                  /* Transitions by class, -1 == not known */
+    int nlist;
+    short list[];
+};
+#define RXS_START   0x01        /* A match may start after this */
+#define RXS_MATCH   0x02        /* A match ends here */
+
+struct rx_dfa {
+    int longest;                /* Longest match, not leftmost-first */
+    int nstate;
+    struct rx_state *state[RX_MAXSTATE];
+    int hash[RX_HASH];
+};
+
+/* The pattern in one direction */
+struct rx_prog {
+    int nitem;
+    struct rx_item *item;
+    char *accept;               /* [item][class] - does the item match? */
+    int anch_start;             /* Only start a match at an end of line */
+    int anch_end;               /* Only end a match at an end of line */
+    struct rx_dfa *first;       /* Built when first needed */
+    struct rx_dfa *longest;
+};
+
+struct regex {
+    char *pat;                  /* What it was compiled from */
+    int nocase;                 /* ...and how */
+    int ncut;                   /* Character class boundaries */
+    unicode_t *cut;
+    int nclass;                 /* ncut + 1 classes, + 1 for end of text */
+    int nlclass;                /* The class of a newline */
+    int eosclass;               /* ...and for the end of the text */
+    short aclass[128];          /* Classes of ASCII chars */
+    struct rx_prog fwd, rev;
+};
+
+/* ------------------------------------------------------------ */
+/* Character sets */
+
+struct rx_set {
+    int n, alloc;
+    struct rx_range *r;
+};
+
+static void set_add(struct rx_set *s, unicode_t lo, unicode_t hi) {
+    if (s->n >= s->alloc) {
+        s->alloc = s->alloc? 2 * s->alloc: 8;
+        s->r = Xrealloc(s->r, s->alloc * sizeof(struct rx_range));
+    }
+    s->r[s->n].lo = lo;
+    s->r[s->n].hi = hi;
+    s->n++;
+}
+
+static int range_cmp(const void *a, const void *b) {
+    const struct rx_range *ra = a, *rb = b;
+    return (ra->lo > rb->lo) - (ra->lo < rb->lo);
+}
+
+/* Sort the ranges and merge any that overlap or touch */
+static void set_normalize(struct rx_set *s) {
+    int i, j;
+
+    if (s->n == 0) return;
+    qsort(s->r, s->n, sizeof(struct rx_range), range_cmp);
+    for (i = 0, j = 1; j < s->n; j++) {
+        if (s->r[j].lo <= s->r[i].hi + 1) {
+            if (s->r[j].hi > s->r[i].hi) s->r[i].hi = s->r[j].hi;
+        }
+        else s->r[++i] = s->r[j];
+    }
+    s->n = i + 1;
+}
+
+/* Everything not in the (normalized) set */
+static void set_negate(struct rx_set *s) {
+    struct rx_set ns = { 0, 0, NULL };
+    unicode_t from = 0;
+
+    for (int i = 0; i < s->n; i++) {
+        if (s->r[i].lo > from) set_add(&ns, from, s->r[i].lo - 1);
+        from = s->r[i].hi + 1;
+    }
+    if (from <= MAX_UTF8_CHAR) set_add(&ns, from, MAX_UTF8_CHAR);
+    free(s->r);
+    *s = ns;
+}
+
+/* Remove a character from the (normalized) set */
+static void set_remove(struct rx_set *s, unicode_t c) {
+    for (int i = 0; i < s->n; i++) {
+        if (c < s->r[i].lo || c > s->r[i].hi) continue;
+        if (s->r[i].lo == s->r[i].hi) {
+            memmove(s->r + i, s->r + i + 1,
+                 (s->n - i - 1) * sizeof(struct rx_range));
+            s->n--;
+        }
+        else if (c == s->r[i].lo) s->r[i].lo++;
+        else if (c == s->r[i].hi) s->r[i].hi--;
+        else {
+            unicode_t hi = s->r[i].hi;
+            s->r[i].hi = c - 1;
+            set_add(s, c + 1, hi);
+            set_normalize(s);
+        }
+        return;
+    }
+}
+
+/* Add the lower-case form of everything in the set, as the text is
+ * lower-cased as it is read when case doesn't matter.
+ */
+static void set_fold(struct rx_set *s) {
+    int n = s->n;
+
+    for (int i = 0; i < n; i++)
+        for (unicode_t c = s->r[i].lo; c <= s->r[i].hi; c++) {
+            unicode_t lc = utf8proc_tolower(c);
+            if (lc != c) set_add(s, lc, lc);
+        }
+    set_normalize(s);
+}
+
+static int set_has(struct rx_item *it, unicode_t c) {
+    int lo = 0, hi = it->nrange - 1;
+
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (c < it->range[mid].lo) hi = mid - 1;
+        else if (c > it->range[mid].hi) lo = mid + 1;
+        else return TRUE;
+    }
+    return FALSE;
+}
+
+/* ------------------------------------------------------------ */
+/* Parsing - this follows mcstr() and cclmake() in search.c */
+
+/* The unicode character at *pp, moving *pp past it. 0 at the end. */
+static unicode_t pat_getc(char **pp) {
+    unicode_t c;
+    int len = strlen(*pp);
+
+    if (len == 0) return 0;
+    *pp += utf8_to_unicode(*pp, 0, len, &c);
+    return c;
+}
+
+/* Character class. *pp is just after the MC_CCL */
+static int parse_ccl(char **pp, struct rx_set *s, int *negate) {
+    char *p = *pp;
+    unicode_t ochr, pchr;
+
+    *negate = FALSE;
+    if (*p == MC_NCCL) {
+        p++;
+        *negate = TRUE;
+    }
+    if (*p == MC_ECCL) {
+        mlwrite_one("%No characters in character class");
+        return FALSE;
+    }
+    ochr = pat_getc(&p);
+    if (ochr == MC_ESC) ochr = pat_getc(&p);
+    set_add(s, ochr, ochr);
+
+    while (ochr != '\0' && (pchr = pat_getc(&p)) != MC_ECCL) {
+        switch (pchr) {
+        case MC_RCCL:
+            if (*p == MC_ECCL) set_add(s, pchr, pchr);
+            else {
+                pchr = pat_getc(&p);
+                if (pchr > ochr) set_add(s, ochr + 1, pchr);
+            }
+            break;
+        case MC_ESC:
+            pchr = pat_getc(&p);
+            /* Falls through */
+        default:
+            set_add(s, pchr, pchr);
+            break;
+        }
+        ochr = pchr;
+    }
+    if (ochr == '\0') {
+        mlwrite_one("%Character class not ended");
+        return FALSE;
+    }
+    *pp = p;
+    return TRUE;
+}
+
+/* Fill in the forward program from the pattern */
+static int rx_parse(struct regex *rx) {
+    struct rx_prog *pr = &rx->fwd;
+    char *p = rx->pat;
+    int mj = 0;
+    int does_closure = FALSE;
+    unicode_t pchr;
+
+    pr->item = Xmalloc((strlen(p) + 1) * sizeof(struct rx_item));
+    while (*p) {
+        struct rx_set s = { 0, 0, NULL };
+        int negate = FALSE;
+        int fold = rx->nocase;
+        pchr = pat_getc(&p);
+        switch (pchr) {
+        case MC_CCL:
+            if (!parse_ccl(&p, &s, &negate)) {
+                free(s.r);
+                return FALSE;
+            }
+            does_closure = TRUE;
+            break;
+        case MC_BOL:
+            if (mj != 0) goto litcase;
+            pr->anch_start = TRUE;
+            does_closure = FALSE;
+            mj++;
+            continue;
+        case MC_EOL:
+            if (*p != '\0') goto litcase;
+            pr->anch_end = TRUE;
+            does_closure = FALSE;
+            mj++;
+            continue;
+        case MC_ANY:
+            set_add(&s, '\n', '\n');
+            negate = TRUE;
+            fold = FALSE;
+            does_closure = TRUE;
+            break;
+        case MC_CLOSURE:
+            if (!does_closure) goto litcase;
+            pr->item[pr->nitem - 1].closure = TRUE;
+            does_closure = FALSE;
+            mj++;
+            continue;
+        case MC_ESC:
+            if (*p != '\0') pchr = pat_getc(&p);
+            /* Falls through */
+        default:
+litcase:
+            set_add(&s, pchr, pchr);
+            does_closure = (pchr != '\n');
+            break;
+        }
+        set_normalize(&s);
+        if (fold) set_fold(&s);
+        if (negate) set_negate(&s);
+        pr->item[pr->nitem].closure = FALSE;
+        pr->item[pr->nitem].nrange = s.n;
+        pr->item[pr->nitem].range = s.r;
+        pr->nitem++;
+        mj++;
+    }
+    return TRUE;
+}
+
+/* ------------------------------------------------------------ */
+/* Compiling */
+
+/* The character class of c (which is < 0 for the end of the text) */
+static int rx_class(struct regex *rx, int c) {
+    int lo, hi;
+
+    if (c < 0) return rx->eosclass;
+    if (c < 128) return rx->aclass[c];
+    if (rx->nocase) c = utf8proc_tolower(c);
+    lo = 0;                         /* Find how many cuts are <= c */
+    hi = rx->ncut;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (rx->cut[mid] <= (unicode_t)c) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int cut_cmp(const void *a, const void *b) {
+    unicode_t ua = *(const unicode_t *)a, ub = *(const unicode_t *)b;
+    return (ua > ub) - (ua < ub);
+}
+
+/* Split the characters into classes at every range boundary. */
+static void rx_classes(struct regex *rx) {
+    struct rx_prog *pr = &rx->fwd;
+    int n = 2;
+
+    for (int i = 0; i < pr->nitem; i++) n += 2 * pr->item[i].nrange;
+    rx->cut = Xmalloc(n * sizeof(unicode_t));
+    n = 0;
+    rx->cut[n++] = '\n';            /* Newline always gets a class */
+    rx->cut[n++] = '\n' + 1;
+    for (int i = 0; i < pr->nitem; i++) {
+        for (int j = 0; j < pr->item[i].nrange; j++) {
+            rx->cut[n++] = pr->item[i].range[j].lo;
+            if (pr->item[i].range[j].hi < MAX_UTF8_CHAR)
+                rx->cut[n++] = pr->item[i].range[j].hi + 1;
+        }
+    }
+    qsort(rx->cut, n, sizeof(unicode_t), cut_cmp);
+    rx->ncut = 0;
+    for (int i = 0; i < n; i++)
+        if (rx->ncut == 0 || rx->cut[rx->ncut - 1] != rx->cut[i])
+            rx->cut[rx->ncut++] = rx->cut[i];
+
+    rx->eosclass = rx->ncut + 1;
+    rx->nclass = rx->ncut + 2;
+    for (int c = 0; c < 128; c++) {
+        int fc = (rx->nocase && c >= 'A' && c <= 'Z')? c ^ DIFCASE: c;
+        int k = 0;
+        while (k < rx->ncut && rx->cut[k] <= (unicode_t)fc) k++;
+        rx->aclass[c] = k;
+    }
+    rx->nlclass = rx->aclass['\n'];
+}
+
+/* Which classes each item matches */
+static void rx_accept(struct regex *rx, struct rx_prog *pr) {
+    pr->accept = Xmalloc(pr->nitem * rx->nclass + 1);
+    for (int i = 0; i < pr->nitem; i++) {
+        char *acc = pr->accept + i * rx->nclass;
+        for (int k = 0; k <= rx->ncut; k++)
+            acc[k] = set_has(pr->item + i, (k == 0)? 0: rx->cut[k - 1]);
+        acc[rx->eosclass] = FALSE;
+    }
+}
+
+static void rx_freedfa(struct rx_dfa *d) {
+    if (d == NULL) return;
+    for (int i = 0; i < d->nstate; i++) {
+        free(d->state[i]->next);
+        free(d->state[i]);
+    }
+    free(d);
+}
+
+void rx_free(struct regex *rx) {
+    if (rx == NULL) return;
+    for (int i = 0; i < rx->fwd.nitem; i++) free(rx->fwd.item[i].range);
+    free(rx->fwd.item);
+    free(rx->rev.item);
+    free(rx->fwd.accept);
+    free(rx->rev.accept);
+    rx_freedfa(rx->fwd.first);
+    rx_freedfa(rx->fwd.longest);
+    rx_freedfa(rx->rev.first);
+    rx_freedfa(rx->rev.longest);
+    free(rx->cut);
+    free(rx->pat);
+    free(rx);
+}
+
+/*
+ * rx_compile -- Compile a MAGIC pattern, folding case if nocase is set.
+ *      Returns NULL (having said why) if the pattern is bad.
+ */
+struct regex *rx_compile(char *pat, int nocase) {
+    struct regex *rx = Xmalloc(sizeof(struct regex));
+
+    memset(rx, 0, sizeof(struct regex));
+    rx->pat = strdup(pat);
+    rx->nocase = nocase;
+    if (!rx_parse(rx)) {
+        rx_free(rx);
+        return NULL;
+    }
+
+/* A closure never matches a newline */
+    for (int i = 0; i < rx->fwd.nitem; i++) {
+        if (!rx->fwd.item[i].closure) continue;
+        struct rx_set s = { rx->fwd.item[i].nrange, rx->fwd.item[i].nrange,
+             rx->fwd.item[i].range };
+        set_remove(&s, '\n');
+        rx->fwd.item[i].nrange = s.n;
+        rx->fwd.item[i].range = s.r;
+    }
+
+/* The reverse program has the items the other way round and swaps the
+ * anchors. The ranges are shared.
+ */
+    rx->rev.nitem = rx->fwd.nitem;
+    rx->rev.item = Xmalloc((rx->rev.nitem + 1) * sizeof(struct rx_item));
+    for (int i = 0; i < rx->rev.nitem; i++)
+        rx->rev.item[i] = rx->fwd.item[rx->fwd.nitem - 1 - i];
+    rx->rev.anch_start = rx->fwd.anch_end;
+    rx->rev.anch_end = rx->fwd.anch_start;
+
+    rx_classes(rx);
+    rx_accept(rx, &rx->fwd);
+    rx_accept(rx, &rx->rev);
+    return rx;
+}
+
+/*
+ * rx_same -- Was rx compiled from this pattern in this way?
+ */
+int rx_same(struct regex *rx, char *pat, int nocase) {
+    return rx != NULL && rx->nocase == nocase && strcmp(rx->pat, pat) == 0;
+}
+
+/* ------------------------------------------------------------ */
+/* The lazy DFA */
+
+/* Add NFA state p, and everything we can get to from it without
+ * consuming a character, to the list (in order of preference).
+ */
+static void rx_add(struct rx_prog *pr, short *list, int *n, char *seen,
+     int p) {
+    for (;;) {
+        if (seen[p]) return;
+        seen[p] = TRUE;
+        list[(*n)++] = p;
+        if (p == pr->nitem || !pr->item[p].closure) return;
+        p++;                        /* Closure can match nothing too */
+    }
+}
+
+static struct rx_dfa *rx_newdfa(int longest) {
+    struct rx_dfa *d = Xmalloc(sizeof(struct rx_dfa));
+
+    d->longest = longest;
+    d->nstate = 0;
+    for (int i = 0; i < RX_HASH; i++) d->hash[i] = -1;
+    return d;
+}
+
+/* Throw away all of the states */
+static void rx_flush(struct rx_dfa *d) {
+    for (int i = 0; i < d->nstate; i++) {
+        free(d->state[i]->next);
+        free(d->state[i]);
+    }
+    d->nstate = 0;
+    for (int i = 0; i < RX_HASH; i++) d->hash[i] = -1;
+}
+
+/* Find (or make) the DFA state for a list of NFA states.
+ * This is where a leftmost-first DFA drops anything after a match.
+ */
+static int rx_state(struct regex *rx, struct rx_prog *pr, struct rx_dfa *d,
+     short *list, int n, int flags) {
+    unsigned int h;
+    struct rx_state *s;
+
+    for (int i = 0; i < n; i++) {
+        if (list[i] != pr->nitem || pr->anch_end) continue;
+        flags |= RXS_MATCH;
+        if (d->longest) {           /* Keep the rest, lose the match */
+            memmove(list + i, list + i + 1, (n - i - 1) * sizeof(short));
+            n--;
+        }
+        else {                      /* Lose the rest too */
+            n = i;
+            flags &= ~RXS_START;
+        }
+        break;
+    }
+
+    h = flags;
+    for (int i = 0; i < n; i++) h = h * 31 + list[i];
+    h %= RX_HASH;
+    for (int si = d->hash[h]; si >= 0; si = d->state[si]->hnext) {
+        s = d->state[si];
+        if (s->flags == flags && s->nlist == n &&
+             memcmp(s->list, list, n * sizeof(short)) == 0)
+            return si;
+    }
+
+    if (d->nstate >= RX_MAXSTATE) rx_flush(d);
+    s = Xmalloc(sizeof(struct rx_state) + n * sizeof(short));
+    s->flags = flags;
+    s->nlist = n;
+    memcpy(s->list, list, n * sizeof(short));
+    s->next = Xmalloc(rx->nclass * sizeof(int));
+    for (int k = 0; k < rx->nclass; k++) s->next[k] = -1;
+    s->hnext = d->hash[h];
+    d->hash[h] = d->nstate;
+    d->state[d->nstate] = s;
+    return d->nstate++;
+}
+
+/* The state to start in. "at_eol" says whether we're at a line end
+ * (for the start anchor).
+ */
+static int rx_start(struct regex *rx, struct rx_prog *pr, struct rx_dfa *d,
+     int at_eol) {
+    short list[NPAT + 1];
+    char seen[NPAT + 1];
+    int n = 0;
+
+    memset(seen, 0, pr->nitem + 1);
+    if (!pr->anch_start || at_eol) rx_add(pr, list, &n, seen, 0);
+    return rx_state(rx, pr, d, list, n, d->longest? 0: RXS_START);
+}
+
+/* Work out the transition from state si on a character of class k.
+ * The result is the new state << 1, with the bottom bit set if a match
+ * (which had to be at a line end) ended just before the character.
+ * If "nostart" is set no new match may start after the character, and
+ * the result isn't remembered.
+ */
+static int rx_step(struct regex *rx, struct rx_prog *pr, struct rx_dfa *d,
+     int si, int k, int nostart) {
+    struct rx_state *s = d->state[si];
+    short list[NPAT + 1];
+    char seen[NPAT + 1];
+    int n = 0, hit = 0, flags = 0;
+    int at_eol = (k == rx->nlclass || k == rx->eosclass);
+    int nsi, flushes;
+
+    memset(seen, 0, pr->nitem + 1);
+    for (int i = 0; i < s->nlist; i++) {
+        int p = s->list[i];
+        if (p == pr->nitem) {       /* A match, if at a line end */
+            if (at_eol) {
+                hit = 1;
+                if (!d->longest) goto done;
+            }
+            continue;
+        }
+        if (pr->accept[p * rx->nclass + k])
+            rx_add(pr, list, &n, seen, pr->item[p].closure? p: p + 1);
+    }
+    if ((s->flags & RXS_START) && !nostart) {
+        flags = RXS_START;
+        if (!pr->anch_start || k == rx->nlclass)
+            rx_add(pr, list, &n, seen, 0);
+    }
+done:
+    flushes = d->nstate;
+    nsi = rx_state(rx, pr, d, list, n, flags);
+    if (!nostart && d->nstate >= flushes)   /* si is still valid */
+        s->next[k] = nsi << 1 | hit;
+    return nsi << 1 | hit;
+}
+
+/* ------------------------------------------------------------ */
+/* Searching */
+
+struct rx_pos {
+    struct line *lp;
+    int off;
+};
+
+/* Get the character at p (before p, going backwards) and move over it.
+ * Returns -1 at the end of the buffer.
+ */
+static inline int rx_getc(struct rx_pos *p, int dir) {
+    unicode_t c;
+
+    if (dir == FORWARD) {
+        if (p->lp == curbp->b_linep) return -1;
+        if (p->off == llength(p->lp)) {
+            p->lp = lforw(p->lp);
+            p->off = 0;
+            return '\n';
+        }
+        c = ch_as_uc(lgetc(p->lp, p->off));
+        if (c < 0x80) p->off++;
+        else p->off += utf8_to_unicode(p->lp->l_text, p->off,
+             llength(p->lp), &c);
+        return c;
+    }
+    if (p->off == 0) {
+        if (lback(p->lp) == curbp->b_linep) return -1;
+        p->lp = lback(p->lp);
+        p->off = llength(p->lp);
+        return '\n';
+    }
+    c = ch_as_uc(lgetc(p->lp, p->off - 1));
+    if (c < 0x80) p->off--;
+    else {
+        int off = prev_utf8_offset(p->lp->l_text, p->off, FALSE);
+        utf8_to_unicode(p->lp->l_text, off, p->off, &c);
+        p->off = off;
+    }
+    return c;
+}
+
+/* Run a DFA from *pos in direction dir, going no further than limit (if
+ * that is given). If there is a match leave *pos at its end and return
+ * TRUE.
+ */
+static int rx_run(struct regex *rx, struct rx_prog *pr, struct rx_dfa *d,
+     int dir, struct rx_pos *pos, struct rx_pos *limit) {
+    struct rx_pos p = *pos, found, prev;
+    struct rx_state *s;
+    int si, t, c, k, stop, nostart;
+    int matched = FALSE;
+    int at_eol;
+
+    if (dir == FORWARD) at_eol = (p.off == 0);
+    else                at_eol = (p.off == llength(p.lp));
+    si = rx_start(rx, pr, d, at_eol);
+    if (d->state[si]->flags & RXS_MATCH) {
+        found = p;
+        matched = TRUE;
+    }
+    for (;;) {
+        stop = (limit != NULL && p.lp == limit->lp && p.off == limit->off);
+        prev = p;
+        c = rx_getc(&p, dir);
+        k = rx_class(rx, c);
+
+/* amatch() won't start a match at the very end of the buffer */
+        nostart = !d->longest && boundry(p.lp, p.off, dir);
+        t = d->state[si]->next[k];
+        if (t < 0 || nostart) t = rx_step(rx, pr, d, si, k, nostart);
+        if (t & 1) {
+            found = prev;
+            matched = TRUE;
+        }
+        if (c < 0 || stop) break;
+        si = t >> 1;
+        s = d->state[si];
+        if (s->flags & RXS_MATCH) {
+            found = p;
+            matched = TRUE;
+        }
+        if (s->nlist == 0 && !(s->flags & RXS_START)) break;
+    }
+    if (matched) *pos = found;
+    return matched;
+}
+
+/*
+ * rx_search -- Search from plp/poff in direction dir.
+ *      If there is a match return TRUE with plp/poff set to the end of
+ *      it nearest to where we started, elp/eoff to its other end and
+ *      len to its length in bytes.
+ *      So these are set as mcscanner() would set matchline/matchoff and
+ *      its scan pointers.
+ */
+int rx_search(struct regex *rx, int dir, struct line **plp, int *poff,
+     struct line **elp, int *eoff, int *len) {
+    struct rx_prog *pr, *back;
+    struct rx_pos dot, nearp, farp, from, to;
+
+    dot.lp = *plp;
+    dot.off = *poff;
+    if (boundry(dot.lp, dot.off, dir)) return FALSE;
+
+    if (dir == FORWARD) {
+        pr = &rx->fwd;
+        back = &rx->rev;
+    }
+    else {
+        pr = &rx->rev;
+        back = &rx->fwd;
+    }
+    if (pr->first == NULL) pr->first = rx_newdfa(FALSE);
+    if (back->longest == NULL) back->longest = rx_newdfa(TRUE);
+
+/* Find where the match ends, then go back to find where it starts */
+    farp = dot;
+    if (!rx_run(rx, pr, pr->first, dir, &farp, NULL)) return FALSE;
+    nearp = farp;
+    rx_run(rx, back, back->longest, dir ^ REVERSE, &nearp, &dot);
+
+    *plp = nearp.lp;
+    *poff = nearp.off;
+    *elp = farp.lp;
+    *eoff = farp.off;
+
+    if (dir == FORWARD) {
+        from = nearp;
+        to = farp;
+    }
+    else {
+        from = farp;
+        to = nearp;
+    }
+    *len = 0;
+    for (; from.lp != to.lp; from.lp = lforw(from.lp), from.off = 0)
+        *len += llength(from.lp) - from.off + 1;
+    *len += to.off - from.off;
+    return TRUE;
+}
@@ -61,15 +61,20 @@ int copyregion(int f, int n) {
     thisflag |= CFKILL;
     linep = region.r_linep;         /* Current line.        */
     loffs = region.r_offset;        /* Current offset.      */
-    while (region.r_size--) {
+    while (region.r_size > 0) {
         if (loffs == llength(linep)) {  /* End of line. */
             if ((s = kinsert('\n')) != TRUE) return s;
             linep = lforw(linep);
             loffs = 0;
+            region.r_size--;
         }
-        else {                      /* Middle of line.      */
-            if ((s = kinsert(lgetc(linep, loffs))) != TRUE) return s;
-            ++loffs;
+        else {                      /* Rest of line (or region) */
+            long chunk = llength(linep) - loffs;
+            if (chunk > region.r_size) chunk = region.r_size;
+            if ((s = kinsert_block(linep->l_text + loffs, chunk)) != TRUE)
+                return s;
+            loffs += chunk;
+            region.r_size -= chunk;
         }
     }
     mlwrite_one(MLbkt("region copied"));
@@ -131,9 +136,20 @@ static int casechange_region(int newcase) { /* The handling function */
         int b_end = region.r_size + b_offs;
         if (b_end > llength(linep)) b_end = llength(linep);
         int this_blen = b_end - b_offs;
+/* Nothing to recase on this line (and utf8_recase() would take a zero
+ * length as a request to use strlen(), which our text isn't set up for).
+ */
+        if (this_blen == 0) {
+            region.r_size--;
+            b_offs = 0;
+            continue;
+        }
+        lown(linep);                        /* We'll alter it in place */
+        ltouch(curbp, linep);
         utf8_recase(newcase, linep->l_text+b_offs, this_blen, &mstr);
         int replen = mstr.utf8c;            /* Less code when copied.. */
         char *repstr = mstr.str;            /* ...to simple local vars */
+        undo_replace(linep, b_offs, this_blen, replen);
         if (replen == this_blen) {          /* Easy - just overwrite */
             memcpy(linep->l_text+b_offs, repstr, replen);
             free(repstr);
@@ -156,7 +172,7 @@ static int casechange_region(int newcase) { /* The handling function */
             }
             else {
 /* Need to allocate a new line structure to replace the current one... */
-                struct line *newl = lalloc(llength(linep) + b_more);
+                struct line *newl = lalloc(curbp, llength(linep) + b_more);
 /* Copy in and leading text on this line... */
                 if (b_offs) memcpy(newl->l_text, linep->l_text, b_offs);
 /* Copy in the replacement text */
@@ -169,12 +185,13 @@ static int casechange_region(int newcase) { /* The handling function */
                 lback(lforw(linep)) = newl;
                 lforw(newl) = lforw(linep);
                 lback(newl) = lback(linep);
+                lindex_replace(curbp, linep, newl);
 /* If mark or dot were on this old line then we need to move them to
  * the new one
  */
                 if (curwp->w_markp == linep) curwp->w_markp = newl;
                 if (curwp->w_dotp == linep)  curwp->w_dotp = newl;
-                free(linep);
+                lrelease(linep);
                 linep = newl;
             }
             MarkDotFixup(b_more);
@@ -353,6 +370,9 @@ int narrow(int f, int n) {
         bp->b_linep->l_bp->l_fp = (struct line *)NULL;
         bp->b_linep->l_bp = bp->b_botline->l_bp;
     }
+    lindex_drop(bp);                /* Line numbers have all changed */
+    undo_clear(bp);                 /* ...as have their positions */
+    proc_free(bp);                  /* ...and which lines are in it */
 
 /* Let all the proper windows be updated */
     wp = wheadp;
@@ -410,6 +430,9 @@ int widen(int f, int n) {
         bp->b_linep->l_bp = lp;
         bp->b_botline = (struct line *)NULL;
     }
+    lindex_drop(bp);                /* Line numbers have all changed */
+    undo_clear(bp);                 /* ...as have their positions */
+    proc_free(bp);                  /* ...and which lines are in it */
 
 /* Let all the proper windows be updated */
     wp = wheadp;
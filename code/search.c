@@ -71,6 +71,7 @@
  * There is also a navigable set of search and replace string buffers.
  */
 #include <stdio.h>
+#include <string.h>
 #include <ctype.h>
 
 #include "estruct.h"
@@ -93,6 +94,7 @@ static short int rmagical;
 static struct magic mcpat[NPAT]; /* The magic pattern. */
 static struct magic tapcm[NPAT]; /* The reversed magic pattern. */
 static struct magic_replacement rmcpat[NPAT]; /* Replacement magic array. */
+static struct regex *rxpat;     /* Compiled form of pat, for mcscanner() */
 
 /* Search ring buffer code...
  */
@@ -580,6 +582,8 @@ void mcclear(void) {
         mcptr++;
     }
     mcpat[0].mc_type = tapcm[0].mc_type = MCNIL;
+    rx_free(rxpat);
+    rxpat = NULL;
 }
 
 /*
@@ -891,6 +895,41 @@ int mcscanner(struct magic *mcpatrn, int direct, int beg_or_end) {
     curline = curwp->w_dotp;
     curoff = curwp->w_doto;
 
+/* Unless told otherwise we use the compiled pattern (see regex.c), which
+ * finds the same match as the amatch() loop below, but in linear time.
+ * It is compiled from pat when first needed, and again if pat or the
+ * EXACT mode has changed.
+ */
+    if (magic_dfa) {
+        int nocase = (curwp->w_bufp->b_mode & MDEXACT) == 0;
+        if (!rx_same(rxpat, pat, nocase)) {
+            rx_free(rxpat);
+            rxpat = rx_compile(pat, nocase);
+        }
+    }
+    if (magic_dfa && rxpat != NULL) {
+        struct line *endline;
+        int endoff, len;
+
+        if (!boundry(curline, curoff, direct)) matchlen = 0;
+        if (!rx_search(rxpat, direct, &curline, &curoff,
+             &endline, &endoff, &len))
+            return FALSE;
+        matchline = curline;
+        matchoff = curoff;
+        matchlen = len;
+        if (beg_or_end == PTEND) {
+            curwp->w_dotp = endline;
+            curwp->w_doto = endoff;
+        }
+        else {
+            curwp->w_dotp = matchline;
+            curwp->w_doto = matchoff;
+        }
+        curwp->w_flag |= WFMOVE;
+        return TRUE;
+    }
+
 /* Scan each character until we hit the head link record. */
 
     while (!boundry(curline, curoff, direct)) {
@@ -996,6 +1035,168 @@ static int fbound(int jump, struct line **pcurline, int *pcuroff, int dir) {
     return FALSE;
 }
 
+/*
+ * litprep -- Set up a literal pattern (in forward order, with no newline
+ *      in it) for litfwd()/litback().
+ *      Unless "exact" the pattern and the text are compared with their
+ *      case folded as eq() does it, so the skip tables are built on the
+ *      folded bytes and then spread back over each raw byte.
+ */
+void litprep(struct litpat *lt, const char *patrn, int exact) {
+    int fskip[256], bskip[256];
+    int plen, i;
+
+    lt->lp_exact = exact;
+    for (i = 0; i < 256; i++)
+        lt->lp_fold[i] = (!exact && islower(i))? i ^ DIFCASE: i;
+    plen = lt->lp_len = strlen(patrn);
+    for (i = 0; i < plen; i++)
+        lt->lp_pat[i] = lt->lp_fold[(unsigned char)patrn[i]];
+
+/* The skip for a byte is how far we can move the window when it is at
+ * the end (forwards) or start (backwards) of the window.
+ */
+    for (i = 0; i < 256; i++) fskip[i] = bskip[i] = plen;
+    for (i = 0; i < plen - 1; i++) fskip[lt->lp_pat[i]] = plen - 1 - i;
+    for (i = plen - 1; i > 0; i--) bskip[lt->lp_pat[i]] = i;
+    for (i = 0; i < 256; i++) {
+        lt->lp_fskip[i] = fskip[lt->lp_fold[i]];
+        lt->lp_bskip[i] = bskip[lt->lp_fold[i]];
+    }
+}
+
+/* Does "s" match the first "n" bytes of "p" (which is already folded)? */
+static int litcmp(const struct litpat *lt, const unsigned char *s,
+     const unsigned char *p, int n) {
+    if (lt->lp_exact) return !memcmp(s, p, n);
+    while (n--) if (lt->lp_fold[*s++] != *p++) return FALSE;
+    return TRUE;
+}
+
+/*
+ * litfwd -- Boyer-Moore-Horspool search of "text" (of length "len") for
+ *      the first match of "lt" starting at or after "from".
+ *      Returns its offset, or -1.
+ */
+int litfwd(const struct litpat *lt, const char *text, int len, int from) {
+    const unsigned char *tp = (const unsigned char *)text;
+    const unsigned char *mp;
+    int plen = lt->lp_len;
+    int lastc = lt->lp_pat[plen - 1];
+    int i;
+
+    if (plen == 1 && lt->lp_exact) {
+        if (from >= len) return -1;
+        mp = memchr(tp + from, lastc, len - from);
+        return (mp == NULL)? -1: mp - tp;
+    }
+    for (i = from; i <= len - plen; ) {
+        int c = tp[i + plen - 1];
+        if (lt->lp_fold[c] == lastc && litcmp(lt, tp + i, lt->lp_pat, plen - 1))
+            return i;
+        i += lt->lp_fskip[c];
+    }
+    return -1;
+}
+
+/*
+ * litback -- As litfwd(), but for the last match ending at or before "to".
+ *      Returns the offset of its start, or -1.
+ */
+int litback(const struct litpat *lt, const char *text, int to) {
+    const unsigned char *tp = (const unsigned char *)text;
+    const unsigned char *mp;
+    int plen = lt->lp_len;
+    int firstc = lt->lp_pat[0];
+    int i;
+
+    if (plen == 1 && lt->lp_exact) {
+        if (to <= 0) return -1;
+        mp = memrchr(tp, firstc, to);
+        return (mp == NULL)? -1: mp - tp;
+    }
+    for (i = to - plen; i >= 0; ) {
+        int c = tp[i];
+        if (lt->lp_fold[c] == firstc &&
+             litcmp(lt, tp + i + 1, lt->lp_pat + 1, plen - 1))
+            return i;
+        i -= lt->lp_bskip[c];
+    }
+    return -1;
+}
+
+/*
+ * litfound -- Leave "." and matchline/matchoff where scanner() would for
+ *      a match of length "plen" starting at "off" in line "lp".
+ *      "beg_or_end" is as toggled by scanner().
+ */
+void litfound(struct line *lp, int off, int plen, int direct,
+     int beg_or_end) {
+    matchline = lp;
+    curwp->w_dotp = lp;
+    if (direct == FORWARD) {
+        matchoff = off;
+        curwp->w_doto = (beg_or_end == PTEND)? off + plen: off;
+    }
+    else {
+        matchoff = off + plen;
+        curwp->w_doto = (beg_or_end == PTEND)? off: off + plen;
+    }
+    curwp->w_flag |= WFMOVE;
+}
+
+/*
+ * litscan -- The scanner() fast path for a literal pattern which has no
+ *      newline in it, so any match must be within one line.
+ *      We can then run a Boyer-Moore-Horspool search over each line's text
+ *      as a block of bytes (with a skip table set up once per call),
+ *      rather than going a character at a time through nextch()/eq().
+ *      Leaves "." and matchline/matchoff where scanner() would.
+ *      "patrn" is the pattern as given to scanner() (so reversed for a
+ *      REVERSE search) and "beg_or_end" has already been toggled.
+ */
+static int litscan(const char *patrn, int direct, int beg_or_end) {
+    char fpat[NPAT];                /* Pattern in forward order */
+    struct litpat lt;
+    struct line *curline;
+    int plen, curoff, off, i;
+
+    plen = strlen(patrn);
+    for (i = 0; i < plen; i++)
+        fpat[i] = (direct == FORWARD)? patrn[i]: patrn[plen - 1 - i];
+    fpat[plen] = '\0';
+    litprep(&lt, fpat, (curwp->w_bufp->b_mode & MDEXACT) != 0);
+
+    curline = curwp->w_dotp;
+    curoff = curwp->w_doto;
+    if (direct == FORWARD) {
+        while (curline != curbp->b_linep) {
+            off = litfwd(&lt, curline->l_text, llength(curline), curoff);
+            if (off >= 0) {
+                litfound(curline, off, plen, direct, beg_or_end);
+                return TRUE;
+            }
+            curline = lforw(curline);
+            curoff = 0;
+        }
+        return FALSE;
+    }
+
+/* Reverse. A match must end at or before "." (curoff). */
+    for (;;) {
+        if (curline != curbp->b_linep) {
+            off = litback(&lt, curline->l_text, curoff);
+            if (off >= 0) {
+                litfound(curline, off, plen, direct, beg_or_end);
+                return TRUE;
+            }
+        }
+        curline = lback(curline);
+        if (curline == curbp->b_linep) return FALSE;
+        curoff = llength(curline);
+    }
+}
+
 /*
  * scanner -- Search for a pattern in either direction.  If found,
  *      reset the "." to be at the start or just after the match string,
@@ -1018,6 +1219,10 @@ int scanner(const char *patrn, int direct, int beg_or_end) {
 
     beg_or_end ^= direct;
 
+/* A literal pattern within a line can use the fast path */
+    if (!strchr(patrn, '\n'))
+        return litscan(patrn, direct, beg_or_end);
+
 /* Set up local pointers to global ".". */
 
     curline = curwp->w_dotp;
@@ -1103,6 +1308,7 @@ static void savematch(void) {
 
 static int forwscanner(int n) { /* Common to forwsearch()/forwhunt() */
     int status;
+    int first = TRUE;
 
 /* Search for the pattern for as long as n is positive (n == 0 will go
  * through once, which is just fine).
@@ -1120,9 +1326,10 @@ static int forwscanner(int n) { /* Common to forwsearch()/forwhunt() */
         }
         if ((magical && curwp->w_bufp->b_mode & MDMAGIC) != 0)
             status = mcscanner(mcpat, FORWARD, PTEND);
-        else
+        else if (!first || !parsearch(pat, FORWARD, PTEND, &status))
             status = scanner(pat, FORWARD, PTEND);
-    } while ((--n > 0) && status);
+        first = FALSE;
+    } while ((--n > 0) && status == TRUE);
     return status;
 }
 
@@ -1153,7 +1360,7 @@ int forwhunt(int f, int n) {
 
 /* Complain if not there - we already have the saved match... */
 
-    if (status != TRUE) mlwrite_one("Not found");
+    if (status == FALSE) mlwrite_one("Not found");
 
     return status;
 }
@@ -1186,7 +1393,7 @@ int forwsearch(int f, int n) {
 
         if (status == TRUE)
             savematch();
-        else
+        else if (status == FALSE)
             mlwrite_one("Not found");
     }
     return status;
@@ -1194,6 +1401,7 @@ int forwsearch(int f, int n) {
 
 static int backscanner(int n) { /* Common to backsearch()/backwhunt() */
     int status;
+    int first = TRUE;
 
 /* Search for the pattern for as long as n is positive (n == 0 will go
  * through once, which is just fine).
@@ -1201,9 +1409,10 @@ static int backscanner(int n) { /* Common to backsearch()/backwhunt() */
     do {
         if ((magical && curwp->w_bufp->b_mode & MDMAGIC) != 0)
             status = mcscanner(tapcm, REVERSE, PTBEG);
-        else
+        else if (!first || !parsearch(pat, REVERSE, PTBEG, &status))
             status = scanner(tap, REVERSE, PTBEG);
-    } while ((--n > 0) && status);
+        first = FALSE;
+    } while ((--n > 0) && status == TRUE);
     return status;
 }
 
@@ -1238,7 +1447,7 @@ int backhunt(int f, int n) {
 
 /* Complain if not there - we already have the saved match... */
 
-    if (status != TRUE) mlwrite_one("Not found");
+    if (status == FALSE) mlwrite_one("Not found");
 
     return status;
 }
@@ -1270,12 +1479,123 @@ int backsearch(int f, int n) {
 
 /* Save away the match, or complain if not there. */
 
-        if (status == TRUE) savematch();
-        else                mlwrite_one("Not found");
+        if (status == TRUE)       savematch();
+        else if (status == FALSE) mlwrite_one("Not found");
     }
     return status;
 }
 
+/*
+ * occur -- List every line of the current buffer which has a match for
+ *      a search string in it, with its line number, in the "/Occur"
+ *      buffer (which is then popped up). occur-goto in that buffer then
+ *      takes you to the line listed on the line you are on.
+ *      This is done in one pass down the buffer. A literal pattern with no
+ *      newline in it is just looked for in each line's text by litfwd().
+ *      Anything else is found by scanner()/mcscanner() from the start of
+ *      each line after the last one listed.
+ */
+static const char occur_buffer[] = "/Occur";
+static char occur_bname[NBUFN];         /* Buffer that is listed */
+
+int occur(int f, int n) {
+    UNUSED(f); UNUSED(n);
+    struct litpat lt;
+    struct buffer *obp;
+    struct line *lp, *olp;
+    struct line *odotp;
+    char num[16];
+    int odoto, status, lineno, nlines, nnum, magic, literal;
+
+    if (strcmp(curbp->b_bname, occur_buffer) == 0) {
+        mlwrite_one("Can't list occurrences in the occur list");
+        return FALSE;
+    }
+    if ((status = readpattern("Occur", pat, TRUE)) != TRUE) return status;
+    magic = magical && (curbp->b_mode & MDMAGIC) != 0;
+    literal = !magic && strchr(pat, '\n') == NULL;
+    if (literal) litprep(&lt, pat, (curbp->b_mode & MDEXACT) != 0);
+
+    if ((obp = bfind(occur_buffer, TRUE, 0)) == NULL) return FALSE;
+    obp->b_flag &= ~BFCHG;              /* Don't complain!      */
+    if ((status = bclear(obp)) != TRUE) return status;
+    strcpy(occur_bname, curbp->b_bname);
+
+/* The scanners move "." as they go, so we put it back afterwards */
+    odotp = curwp->w_dotp;
+    odoto = curwp->w_doto;
+    nlines = 0;
+    lineno = 1;
+    for (lp = lforw(curbp->b_linep); lp != curbp->b_linep;
+         lp = lforw(lp), lineno++) {
+        if (literal) {
+            if (litfwd(&lt, lp->l_text, llength(lp), 0) < 0) continue;
+        }
+        else {
+            curwp->w_dotp = lp;
+            curwp->w_doto = 0;
+            if (magic) status = mcscanner(mcpat, FORWARD, PTBEG);
+            else       status = scanner(pat, FORWARD, PTBEG);
+            if (status != TRUE) break;
+            for (; lp != curwp->w_dotp; lp = lforw(lp)) lineno++;
+        }
+        nnum = sprintf(num, "%7d: ", lineno);
+        if ((olp = lalloc(obp, nnum + llength(lp))) == NULL) break;
+        memcpy(olp->l_text, num, nnum);
+        memcpy(olp->l_text + nnum, lp->l_text, llength(lp));
+        lappend(obp, olp);
+        nlines++;
+    }
+    curwp->w_dotp = odotp;
+    curwp->w_doto = odoto;
+
+    if (nlines == 0) {
+        mlwrite_one("Not found");
+        return FALSE;
+    }
+    obp->b_mode |= MDVIEW;
+    obp->b_flag &= ~BFCHG;
+    mlwrite(MLbkt("%d lines"), nlines);
+    return showbuffer(obp);
+}
+
+/*
+ * occur-goto -- In the occur list, go to the line listed on the current
+ *      line. Its buffer is shown in another window if one already has it,
+ *      otherwise in this one.
+ */
+int occur_goto(int f, int n) {
+    UNUSED(f); UNUSED(n);
+    struct buffer *bp;
+    struct window *wp;
+    struct line *lp;
+    int i, lineno;
+
+    lp = curwp->w_dotp;
+    if (strcmp(curbp->b_bname, occur_buffer) != 0 || lp == curbp->b_linep) {
+        mlwrite_one("Not on a line of the occur list");
+        return FALSE;
+    }
+    for (i = 0; i < llength(lp) && lgetc(lp, i) == ' '; i++);
+    for (lineno = 0; i < llength(lp) && isdigit(lgetc(lp, i)); i++)
+        lineno = 10*lineno + lgetc(lp, i) - '0';
+    if ((bp = bfind(occur_bname, FALSE, 0)) == NULL) {
+        mlwrite("No such buffer: %s", occur_bname);
+        return FALSE;
+    }
+    for (wp = wheadp; wp != NULL; wp = wp->w_wndp)
+        if (wp->w_bufp == bp) break;
+    if (wp != NULL) {
+        curwp = wp;
+        curbp = bp;
+        cknewwindow();
+        upmode();
+    }
+    else if (swbuffer(bp, 0) != TRUE)
+        return FALSE;
+    return gotoline(TRUE, lineno);
+}
+
 /* Entry point for isearch.
  * This needs to set-up the patterns for the search to work.
  */
@@ -1381,6 +1701,131 @@ static int delins(int dlength, char *instr, int use_meta) {
     return status;
 }
 
+/*
+ * Copy the "len" bytes of text at "src" to "dst", replacing the "plen"
+ * bytes at each of the "nm" offsets in "offs" with "rep".
+ * The offsets are in order and the matches don't overlap. If "rep" is no
+ * longer than "plen" this may be done in place (dst == src), as we never
+ * write beyond where we have yet to read.
+ */
+static void repl_copy(char *dst, const char *src, int len, const int *offs,
+     int nm, int plen, const char *rep, int rlen) {
+    int prev = 0;
+
+    for (int i = 0; i < nm; i++) {
+        memmove(dst, src + prev, offs[i] - prev);
+        dst += offs[i] - prev;
+        memcpy(dst, rep, rlen);
+        dst += rlen;
+        prev = offs[i] + plen;
+    }
+    memmove(dst, src + prev, len - prev);
+}
+
+/*
+ * Where offset "o" in a line ends up after the replacements of repl_copy()
+ * have been made in it, given that the one-at-a-time ldelete()/linstr()
+ * would leave anything within (or at the end of) a match at its start.
+ */
+static int repl_newoff(int o, const int *offs, int nm, int plen, int delta) {
+    int i;
+
+    for (i = 0; i < nm && o > offs[i]; i++)
+        if (o <= offs[i] + plen) return offs[i] + i*delta;
+    return o + i*delta;
+}
+
+/*
+ * repl_all -- Replace the rest of the matches for a literal pattern from
+ *      "." on, when neither it nor its (literal) replacement has a newline
+ *      in it and we don't need to ask about each one.
+ *      All of the matches in a line are found first, then the line is
+ *      rebuilt once with all of them replaced and the windows fixed up,
+ *      rather than going through ldelete() and linstr() (each of which
+ *      goes through the windows and may reallocate the line) for every
+ *      match. Everything is left where that would have left it.
+ *      "max" is the most to replace (-1 for no limit).
+ *      Returns the number replaced.
+ */
+static int repl_all(int max) {
+    struct litpat lt;
+    struct line *lp, *nlp;
+    struct line *lastlp = NULL;
+    struct window *wp;
+    int *offs = NULL;
+    int nalloc = 0;
+    int plen, rlen, delta, len, newlen, from, off, nm;
+    int total = 0, lastoff = 0;
+
+    plen = strlen(pat);
+    rlen = strlen(rpat);
+    delta = rlen - plen;
+    litprep(&lt, pat, (curbp->b_mode & MDEXACT) != 0);
+
+    lp = curwp->w_dotp;
+    from = curwp->w_doto;
+    for (; lp != curbp->b_linep && total != max; lp = lforw(lp), from = 0) {
+        len = llength(lp);
+        nm = 0;
+        off = from;
+        while ((max < 0 || total + nm < max) &&
+             (off = litfwd(&lt, lp->l_text, len, off)) >= 0) {
+            if (nm == nalloc) {
+                nalloc = nalloc? 2*nalloc: 64;
+                offs = Xrealloc(offs, nalloc*sizeof(int));
+            }
+            offs[nm++] = off;
+            off += plen;
+        }
+        if (nm == 0) continue;
+        if (total == 0) lchange(WFHARD);
+
+/* Rebuild the line, in place if it is ours and isn't growing */
+        newlen = len + nm*delta;
+        undo_replace(lp, offs[0], len - offs[0], newlen - offs[0]);
+        if (delta <= 0 && lp->l_size != 0) {
+            nlp = lp;
+            repl_copy(lp->l_text, lp->l_text, len, offs, nm, plen, rpat, rlen);
+            lp->l_used = newlen;
+            ltouch(curbp, lp);
+        }
+        else {
+            if ((nlp = lalloc(curbp, newlen)) == NULL) break;
+            repl_copy(nlp->l_text, lp->l_text, len, offs, nm, plen, rpat, rlen);
+            lp->l_bp->l_fp = nlp;
+            nlp->l_fp = lp->l_fp;
+            lp->l_fp->l_bp = nlp;
+            nlp->l_bp = lp->l_bp;
+            lindex_replace(curbp, lp, nlp);
+        }
+        for (wp = wheadp; wp != NULL; wp = wp->w_wndp) {
+            if (wp->w_linep == lp) wp->w_linep = nlp;
+            if (wp->w_dotp == lp) {
+                wp->w_dotp = nlp;
+                wp->w_doto = repl_newoff(wp->w_doto, offs, nm, plen, delta);
+            }
+            if (wp->w_markp == lp) {
+                wp->w_markp = nlp;
+                wp->w_marko = repl_newoff(wp->w_marko, offs, nm, plen, delta);
+            }
+        }
+        if (nlp != lp) lrelease(lp);
+        total += nm;
+        lastlp = lp = nlp;
+        lastoff = offs[nm - 1] + (nm - 1)*delta;
+    }
+    free(offs);
+
+/* Leave "." just after the last replacement, as linstr() would */
+    if (lastlp != NULL) {
+        curwp->w_dotp = matchline = lastlp;
+        matchoff = lastoff;
+        curwp->w_doto = lastoff + rlen;
+        curwp->w_flag |= WFMOVE;
+    }
+    return total;
+}
+
 /*
  * replaces -- Search for a string and replace it with another
  *      string.  Query might be enabled (according to kind).
@@ -1396,6 +1841,7 @@ static int replaces(int kind, int f, int n) {
     int nummatch;           /* number of found matches */
     int nlflag;             /* last char of search string a <NL>? */
     int nlrepl;             /* was a replace done on the last line? */
+    int batch;              /* can use repl_all()? */
     int c;                  /* input char for query - tgetc() returns unicode */
     char tpat[NPAT];        /* temporary to hold search pattern */
     struct line *origline;  /* original "." position */
@@ -1431,6 +1877,13 @@ static int replaces(int kind, int f, int n) {
     nlflag = (pat[matchlen - 1] == '\n');
     nlrepl = FALSE;
 
+/* A literal replacement within lines can be done a line at a time, once
+ * we don't need to ask about each one.
+ */
+    batch = (magical == FALSE || (curbp->b_mode & MDMAGIC) == 0) &&
+         (rmagical == FALSE || (curbp->b_mode & MDMAGIC) == 0) &&
+         strchr(pat, '\n') == NULL && strchr(rpat, '\n') == NULL;
+
     if (kind) {
 /* Build query replace question string. */
         strcpy(tpat, "Replace '");
@@ -1455,6 +1908,10 @@ static int replaces(int kind, int f, int n) {
 
     while ((f == FALSE || n > nummatch) &&
            (nlflag == FALSE || nlrepl == FALSE)) {
+        if (!kind && batch) {
+            numsub += repl_all((f == FALSE)? -1: n - nummatch);
+            break;
+        }
 
 /* Search for the pattern. If we search with a regular expression,
  * matchlen is reset to the true length of the matched string.
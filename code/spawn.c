@@ -323,9 +323,11 @@ int filter_buffer(int f, int n) {
     bp->b_flag &= ~BFCHG;
 
 /* Report any failure, then continue to tidy up... */
+    if (s == TRUE) undo_replace_start(bp);  /* Keep the old text for undo */
     if (s != TRUE || ((s = readin(fltout, FALSE)) == FALSE)) {
         mlwrite_one(MLbkt("Execution failed"));
     }
+    undo_replace_end(bp);
 
 /* Reset file name */
     strcpy(bp->b_fname, tmpnam);    /* restore name */
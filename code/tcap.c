@@ -62,6 +62,13 @@ static char tcapbuf[TCAPSLEN];
 static char *UP, PC, *CM, *CE, *CL, *SO, *SE;
 
 static char *TI, *TE;
+
+/* Bracketed paste mode (xterm, and most terminals since). Pasted text
+ * then arrives between ESC [ 200 ~ and ESC [ 201 ~ (see bracketed_paste()).
+ * Terminals without it ignore these.
+ */
+#define BPON    "\033[?2004h"
+#define BPOFF   "\033[?2004l"
 #if USE_BROKEN_OPTIMIZATION
 static int term_init_ok = 0;
 #endif
@@ -196,6 +203,7 @@ static void tcapopen(void) {
 
 static void tcapclose(void) {
     putpad(tgoto(CM, 0, term.t_nrow));
+    putpad(BPOFF);
     putpad(TE);
     ttflush();
     ttclose();
@@ -203,6 +211,7 @@ static void tcapclose(void) {
 
 static void tcapkopen(void) {
     putpad(TI);
+    putpad(BPON);
     ttflush();
     ttrow = 999;
     ttcol = 999;
@@ -0,0 +1,526 @@
+/*      undo.c
+ *
+ * Undo and redo.
+ *
+ * Each buffer may have a log of the changes made to it, recorded by the
+ * line.c primitives (and the few places that alter a line in place) as
+ * they happen. Nothing is copied from the buffer other than text which
+ * is deleted, so typing costs a few bytes per command, not a copy of
+ * anything.
+ *
+ * A position is kept as a line number and offset, along with its offset
+ * into the text of the buffer taken as a stream in which every line ends
+ * with a newline. A record is then either
+ *  o an insert, of so many bytes of that stream at a position,
+ *  o a delete, with the text which was there, or
+ *  o a swap, which holds the whole of the text of the buffer as it was
+ *    before a filter-buffer replaced it (the lines themselves, just
+ *    taken out of the buffer, see ltext_take()).
+ * Records for adjacent inserts (or deletes, forwards or backwards) in the
+ * same group are merged, as are the groups for a run of typed characters
+ * (up to UNDO_TYPED of them), so that an undo goes back over a sensible
+ * amount and the log stays small.
+ *
+ * Each command that the main loop runs starts a new group, and undo takes
+ * back one group at a time, putting the records it makes for doing so on
+ * the redo list (and redo does the reverse). Any other change clears the
+ * redo list.
+ *
+ * $undo_budget limits the memory that one buffer's log may use. Once it
+ * is over that the oldest groups are dropped, and if a single command is
+ * too big for it then the whole log is discarded (and nothing more is
+ * recorded for that command).
+ * Internal buffers have no log, and anything which rebuilds a buffer's
+ * lines wholesale (reading a file, narrowing...) throws it away.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "estruct.h"
+#include "edef.h"
+#include "efunc.h"
+#include "line.h"
+
+#define UNDO_TYPED  20          /* Typed characters merged into one group */
+
+#define UR_INSERT   1
+#define UR_DELETE   2
+#define UR_SWAP     3
+
+struct undo_rec {
+    long ur_group;              /* Command this was part of */
+    int ur_type;
+    int ur_line;                /* Where it was: line number (from 1)... */
+    int ur_off;                 /* ...offset in that line... */
+    long ur_pos;                /* ...and offset in the whole text */
+    long ur_len;                /* Bytes inserted or deleted */
+    size_t ur_text;             /* Deleted text, in ul_text */
+    struct ltext *ur_saved;     /* Text for a swap */
+};
+
+struct undo_list {
+    struct undo_rec *ul_rec;    /* Oldest first */
+    int ul_nrec;
+    int ul_arec;
+    char *ul_text;              /* Text of the deletes, in the same order */
+    size_t ul_ntext;
+    size_t ul_atext;
+    size_t ul_held;             /* Memory of the text held by swaps */
+};
+
+struct undo_log {
+    struct undo_list ug_undo;
+    struct undo_list ug_redo;
+    long ug_discard;            /* Group being left unrecorded */
+};
+
+#define UNDO 1
+#define REDO 2
+
+static long undo_group = 0;     /* Current group */
+static long typed_group = -1;   /* Last group of typed characters... */
+static int typed_count;         /* ...and how many there are in it */
+static int undoing = 0;         /* UNDO or REDO while applying records */
+
+/* State kept over an insert or delete while it happens */
+static int ins_depth;
+static struct undo_log *ins_log;
+static struct undo_rec ins_at;
+static long ins_size;
+static struct undo_log *del_log;
+static int del_new;
+
+/*
+ * Empty an undo list.
+ */
+static void list_free(struct undo_list *ul) {
+    int i;
+
+    for (i = 0; i < ul->ul_nrec; i++)
+        if (ul->ul_rec[i].ur_saved) ltext_free(ul->ul_rec[i].ur_saved);
+    free(ul->ul_rec);
+    free(ul->ul_text);
+    memset(ul, 0, sizeof(struct undo_list));
+}
+
+static size_t list_size(struct undo_list *ul) {
+    return ul->ul_nrec*sizeof(struct undo_rec) + ul->ul_ntext + ul->ul_held;
+}
+
+/*
+ * Throw away the log of buffer "bp".
+ */
+void undo_clear(struct buffer *bp) {
+    struct undo_log *lg = bp->b_undo;
+
+    if (lg == NULL) return;
+    list_free(&lg->ug_undo);
+    list_free(&lg->ug_redo);
+    free(lg);
+    bp->b_undo = NULL;
+    if (ins_log == lg) ins_log = NULL;
+    if (del_log == lg) del_log = NULL;
+}
+
+/*
+ * The log to record a change to buffer "bp" in, or NULL if it is not
+ * to be recorded.
+ */
+static struct undo_log *undo_log_for(struct buffer *bp) {
+    struct undo_log *lg;
+
+    if ((bp->b_flag & BFINVS) || (bp->b_mode & MDVIEW)) return NULL;
+    if (undo_budget <= 0) {     /* Anything there is now out of date */
+        undo_clear(bp);
+        return NULL;
+    }
+    if ((lg = bp->b_undo) == NULL) {
+        lg = (struct undo_log *)Xmalloc(sizeof(struct undo_log));
+        memset(lg, 0, sizeof(struct undo_log));
+        lg->ug_discard = -1;
+        bp->b_undo = lg;
+    }
+    if (lg->ug_discard == undo_group) return NULL;
+    return lg;
+}
+
+/*
+ * The list that new records go on. A change that isn't an undo or redo
+ * means that there is nothing left to redo.
+ */
+static struct undo_list *target(struct undo_log *lg) {
+    if (undoing == UNDO) return &lg->ug_redo;
+    if (!undoing && lg->ug_redo.ul_nrec) list_free(&lg->ug_redo);
+    return &lg->ug_undo;
+}
+
+static struct undo_rec *top_rec(struct undo_list *ul) {
+    return ul->ul_nrec? &ul->ul_rec[ul->ul_nrec - 1]: NULL;
+}
+
+static struct undo_rec *new_rec(struct undo_list *ul, int type,
+     struct undo_rec *at) {
+    struct undo_rec *rp;
+
+    if (ul->ul_nrec == ul->ul_arec) {
+        ul->ul_arec = ul->ul_arec? 2*ul->ul_arec: 16;
+        ul->ul_rec = Xrealloc(ul->ul_rec,
+             ul->ul_arec*sizeof(struct undo_rec));
+    }
+    rp = &ul->ul_rec[ul->ul_nrec++];
+    rp->ur_group = undo_group;
+    rp->ur_type = type;
+    rp->ur_line = at->ur_line;
+    rp->ur_off = at->ur_off;
+    rp->ur_pos = at->ur_pos;
+    rp->ur_len = 0;
+    rp->ur_text = ul->ul_ntext;
+    rp->ur_saved = NULL;
+    return rp;
+}
+
+static void add_text(struct undo_list *ul, const char *text, size_t len) {
+    if (ul->ul_ntext + len > ul->ul_atext) {
+        if (ul->ul_atext == 0) ul->ul_atext = 256;
+        while (ul->ul_ntext + len > ul->ul_atext) ul->ul_atext *= 2;
+        ul->ul_text = Xrealloc(ul->ul_text, ul->ul_atext);
+    }
+    memcpy(ul->ul_text + ul->ul_ntext, text, len);
+    ul->ul_ntext += len;
+}
+
+/*
+ * Where offset "off" in line "lp" of the current buffer is.
+ */
+static void undo_where(struct line *lp, int off, struct undo_rec *at) {
+    at->ur_line = lindex_lineno(curbp, lp);
+    at->ur_off = off;
+    at->ur_pos = lindex_bytes(curbp, lp) + at->ur_line - 1 + off;
+}
+
+/*
+ * The size of the current buffer as a stream of text.
+ */
+static long text_size(void) {
+    return lindex_nbytes(curbp) + lindex_nlines(curbp);
+}
+
+/*
+ * Keep the log within $undo_budget, dropping the oldest groups (down to
+ * 3/4 of it, so that this isn't done for every change) but never the
+ * current one (nor any while an undo is taking groups off the list).
+ * If that isn't enough, drop the lot.
+ * Returns FALSE if the log was discarded.
+ */
+static int undo_check(struct undo_log *lg) {
+    struct undo_list *ul = &lg->ug_undo;
+    size_t size, keep;
+    long group;
+    int i, j;
+
+    size = list_size(ul) + list_size(&lg->ug_redo);
+    if (size <= (size_t)undo_budget) return TRUE;
+
+    keep = (size_t)undo_budget/4*3;
+    for (i = 0; undoing != UNDO && i < ul->ul_nrec && size > keep; i = j) {
+        group = ul->ul_rec[i].ur_group;
+        if (group == undo_group) break;
+        for (j = i; j < ul->ul_nrec && ul->ul_rec[j].ur_group == group; j++) {
+            size -= sizeof(struct undo_rec);
+            if (ul->ul_rec[j].ur_type == UR_DELETE)
+                size -= ul->ul_rec[j].ur_len;
+            if (ul->ul_rec[j].ur_saved) {
+                size -= ltext_size(ul->ul_rec[j].ur_saved);
+                ul->ul_held -= ltext_size(ul->ul_rec[j].ur_saved);
+                ltext_free(ul->ul_rec[j].ur_saved);
+            }
+        }
+    }
+    if (i > 0) {
+        size_t skip = (i < ul->ul_nrec)? ul->ul_rec[i].ur_text: ul->ul_ntext;
+        memmove(ul->ul_text, ul->ul_text + skip, ul->ul_ntext - skip);
+        ul->ul_ntext -= skip;
+        memmove(ul->ul_rec, ul->ul_rec + i,
+             (ul->ul_nrec - i)*sizeof(struct undo_rec));
+        ul->ul_nrec -= i;
+        for (j = 0; j < ul->ul_nrec; j++) ul->ul_rec[j].ur_text -= skip;
+    }
+    if (size <= (size_t)undo_budget) return TRUE;
+
+    list_free(&lg->ug_undo);
+    list_free(&lg->ug_redo);
+    lg->ug_discard = undo_group;
+    mlwrite_one(MLbkt("Undo information discarded"));
+    return FALSE;
+}
+
+/*
+ * Record an insert of "len" bytes at "at", merging it with the last
+ * record if that was an insert (in this group) which this one is within
+ * or just after.
+ */
+static void rec_insert(struct undo_log *lg, struct undo_rec *at, long len) {
+    struct undo_list *ul = target(lg);
+    struct undo_rec *rp = top_rec(ul);
+
+    if (rp && rp->ur_group == undo_group && rp->ur_type == UR_INSERT &&
+         at->ur_pos >= rp->ur_pos && at->ur_pos <= rp->ur_pos + rp->ur_len)
+        rp->ur_len += len;
+    else
+        new_rec(ul, UR_INSERT, at)->ur_len = len;
+    undo_check(lg);
+}
+
+/*
+ * The start of a new command.
+ */
+void undo_boundary(void) {
+    undo_group++;
+}
+
+/*
+ * A character is about to be typed in (self-inserted). If the last
+ * command did that too, and changed nothing else, the two share a group.
+ */
+void undo_typed(void) {
+    struct undo_rec *rp;
+
+    rp = curbp->b_undo? top_rec(&curbp->b_undo->ug_undo): NULL;
+    if (typed_group == undo_group - 1 && typed_count < UNDO_TYPED &&
+         (rp == NULL || rp->ur_group != undo_group)) {
+        undo_group--;
+        typed_count++;
+    }
+    else {
+        typed_group = undo_group;
+        typed_count = 1;
+    }
+}
+
+/*
+ * Text is about to be inserted at "." (by linsert_byte(), lnewline()...).
+ * These may call each other, so only the outermost one counts.
+ * What was inserted is worked out at the end from how much the buffer
+ * grew by, which allows for lnewline()'s rules at the end of the buffer.
+ */
+void undo_ins_start(void) {
+    if (ins_depth++) return;
+    if ((ins_log = undo_log_for(curbp)) == NULL) return;
+    undo_where(curwp->w_dotp, curwp->w_doto, &ins_at);
+    ins_size = text_size();
+}
+
+void undo_ins_end(void) {
+    long len;
+
+    if (--ins_depth || ins_log == NULL) return;
+    len = text_size() - ins_size;
+    if (len > 0) rec_insert(ins_log, &ins_at, len);
+    ins_log = NULL;
+}
+
+/*
+ * Text is about to be deleted at "." (by ldelete()). It is handed over
+ * with undo_delete() as it goes (it always starts at the same place).
+ * This carries on from the last record if that was a delete (in this
+ * group) at the same place, or goes in front of it if it ended here.
+ */
+void undo_del_start(void) {
+    struct undo_list *ul;
+    struct undo_rec *rp, at;
+
+    if ((del_log = undo_log_for(curbp)) == NULL) return;
+    undo_where(curwp->w_dotp, curwp->w_doto, &at);
+    ul = target(del_log);
+    rp = top_rec(ul);
+    del_new = !(rp && rp->ur_group == undo_group &&
+         rp->ur_type == UR_DELETE && rp->ur_pos == at.ur_pos);
+    if (del_new) new_rec(ul, UR_DELETE, &at);
+}
+
+void undo_delete(const char *text, int len) {
+    struct undo_list *ul;
+
+    if (del_log == NULL) return;
+    ul = target(del_log);
+    add_text(ul, text, len);
+    top_rec(ul)->ur_len += len;
+    if (!undo_check(del_log)) del_log = NULL;
+}
+
+void undo_del_end(void) {
+    struct undo_list *ul;
+    struct undo_rec *rp, *pp;
+    char *tmp;
+
+    if (del_log == NULL) return;
+    ul = target(del_log);
+    rp = top_rec(ul);
+    if (rp->ur_len == 0) {
+        if (del_new) ul->ul_nrec--;
+    }
+    else if (del_new && ul->ul_nrec > 1) {
+        pp = rp - 1;
+        if (pp->ur_group == undo_group && pp->ur_type == UR_DELETE &&
+             rp->ur_pos + rp->ur_len == pp->ur_pos) {
+            tmp = Xmalloc(rp->ur_len);
+            memcpy(tmp, ul->ul_text + rp->ur_text, rp->ur_len);
+            memmove(ul->ul_text + pp->ur_text + rp->ur_len,
+                 ul->ul_text + pp->ur_text, pp->ur_len);
+            memcpy(ul->ul_text + pp->ur_text, tmp, rp->ur_len);
+            free(tmp);
+            pp->ur_line = rp->ur_line;
+            pp->ur_off = rp->ur_off;
+            pp->ur_pos = rp->ur_pos;
+            pp->ur_len += rp->ur_len;
+            ul->ul_nrec--;
+        }
+    }
+    del_log = NULL;
+}
+
+/*
+ * The "oldlen" bytes at offset "off" in line "lp" of the current buffer
+ * are about to be replaced, in place, by "newlen" others.
+ */
+void undo_replace(struct line *lp, int off, int oldlen, int newlen) {
+    struct undo_log *lg;
+    struct undo_list *ul;
+    struct undo_rec *rp, at;
+
+    if ((lg = undo_log_for(curbp)) == NULL) return;
+    undo_where(lp, off, &at);
+    if (oldlen) {
+        ul = target(lg);
+        rp = new_rec(ul, UR_DELETE, &at);
+        add_text(ul, lp->l_text + off, oldlen);
+        rp->ur_len = oldlen;
+        if (!undo_check(lg)) return;
+    }
+    if (newlen) rec_insert(lg, &at, newlen);
+}
+
+/*
+ * The whole text of buffer "bp" is about to be replaced (by reading in
+ * the output of a filter), so rather than record its deletion keep the
+ * lines themselves. The log is put to one side while the buffer is
+ * cleared and read into, then restored with the old text on the end.
+ */
+static struct ltext *repl_text;
+static struct undo_log *repl_log;
+
+void undo_replace_start(struct buffer *bp) {
+    repl_text = NULL;
+    if ((bp->b_flag & BFNAROW) || undo_log_for(bp) == NULL) return;
+    target(bp->b_undo);
+    repl_log = bp->b_undo;
+    bp->b_undo = NULL;
+    repl_text = ltext_take(bp);
+}
+
+void undo_replace_end(struct buffer *bp) {
+    struct undo_list *ul;
+    struct undo_rec at;
+
+    if (repl_text == NULL) return;
+    undo_clear(bp);
+    bp->b_undo = repl_log;
+    ul = target(repl_log);
+    at.ur_line = 1;
+    at.ur_off = 0;
+    at.ur_pos = 0;
+    new_rec(ul, UR_SWAP, &at)->ur_saved = repl_text;
+    ul->ul_held += ltext_size(repl_text);
+    repl_text = NULL;
+    undo_check(repl_log);
+}
+
+/*
+ * Move "." to line "line", offset "off" of the current buffer.
+ */
+static void undo_goto(int line, int off) {
+    struct line *lp = lindex_goto(curbp, line);
+
+    curwp->w_dotp = lp;
+    curwp->w_doto = (off < llength(lp))? off: llength(lp);
+    curwp->w_flag |= WFMOVE;
+}
+
+/*
+ * Take back the last "n" groups on the undo (or redo) list.
+ */
+static int undo_apply(int which, int n) {
+    struct undo_log *lg;
+    struct undo_list *ul = NULL;
+    struct undo_rec *rp, rec;
+    long group;
+    int status = TRUE;
+
+    if (curbp->b_mode & MDVIEW) /* don't allow this command if  */
+        return rdonly();        /* we are in read only mode     */
+    if (undo_budget <= 0) undo_clear(curbp);
+    if ((lg = curbp->b_undo) != NULL)
+        ul = (which == UNDO)? &lg->ug_undo: &lg->ug_redo;
+    if (lg == NULL || ul->ul_nrec == 0) {
+        mlwrite_one((which == UNDO)? MLbkt("Nothing to undo"):
+             MLbkt("Nothing to redo"));
+        return FALSE;
+    }
+
+    undoing = which;
+    while (n-- > 0 && status == TRUE && ul->ul_nrec) {
+        group = top_rec(ul)->ur_group;
+        undo_group++;
+        while (status == TRUE && (rp = top_rec(ul)) != NULL &&
+             rp->ur_group == group) {
+            rec = *rp;
+            ul->ul_nrec--;
+            switch (rec.ur_type) {
+            case UR_INSERT:
+                undo_goto(rec.ur_line, rec.ur_off);
+                status = ldelete(rec.ur_len, FALSE);
+                break;
+            case UR_DELETE:     /* Text stays put until the next add */
+                ul->ul_ntext = rec.ur_text;
+                undo_goto(rec.ur_line, rec.ur_off);
+                status = linsert_literal(ul->ul_text + rec.ur_text,
+                     rec.ur_len);
+                undo_goto(rec.ur_line, rec.ur_off);
+                break;
+            case UR_SWAP:
+                ul->ul_held -= ltext_size(rec.ur_saved);
+                ltext_swap(curbp, rec.ur_saved);
+                lchange(WFHARD | WFMODE);
+                struct undo_list *other = target(lg);
+                new_rec(other, UR_SWAP, &rec)->ur_saved = rec.ur_saved;
+                other->ul_held += ltext_size(rec.ur_saved);
+                undo_check(lg);
+                break;
+            }
+        }
+    }
+    undoing = 0;
+    return status;
+}
+
+/*
+ * Undo the last command (or the last "n"). A negative argument redoes.
+ * Bound to ^X-U
+ */
+int undo(int f, int n) {
+    UNUSED(f);
+    if (n < 0) return undo_apply(REDO, -n);
+    return undo_apply(UNDO, n);
+}
+
+/*
+ * Redo what the last undo (or "n" of them) took back.
+ * Bound to ^X-Y
+ */
+int redo(int f, int n) {
+    UNUSED(f);
+    if (n < 0) return undo_apply(UNDO, -n);
+    return undo_apply(REDO, n);
+}
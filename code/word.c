@@ -350,10 +350,8 @@ int delbword(int f, int n) {
     long size;
 
 /* GGR - variables for kill-ring fix-up */
-    int    i, status, ku;
-    char   *sp;             /* pointer into string to insert */
-    struct kill *kp;        /* pointer into kill buffer */
-    struct kill *op;
+    int    status;
+    struct kill ok;         /* the kill buffer so far */
 
 /* Don't allow this command if we are in read only mode */
     if (curbp->b_mode & MDVIEW) return rdonly();
@@ -393,28 +391,15 @@ int delbword(int f, int n) {
  * This means that we have to fiddle with the kill ring buffers.
  */
 bckdel:
-    if ((kp = kbufh[0]) != NULL) {
-        kbufh[0] = kbufp = NULL;
-        ku = kused[0];
-        kused[0] = KBLOCK;
-    }
+    ok = kbuf[0];
+    kbuf[0].d_text = NULL;
+    kbuf[0].d_used = kbuf[0].d_size = 0;
 
     status = ldelete(size, TRUE);
 
     /* fudge back the rest of the kill ring */
-    while (kp != NULL) {
-        if (kp->d_next == NULL)
-                i = ku;
-        else
-                i = KBLOCK;
-        sp = kp->d_chunk;
-        while (i--) {
-            kinsert(*sp++);
-        }
-        op = kp;
-        kp = kp->d_next;
-        free(op);           /* kinsert() Xmallocs, so we free */
-    }
+    if (ok.d_used) kinsert_block(ok.d_text, ok.d_used);
+    free(ok.d_text);
     return(status);
 }
 
@@ -503,28 +488,51 @@ int killpara(int f, int n) {
 }
 
 
+/*
+ * Count the words in bytes "start" to "end" of line "lp".
+ * A word is a run of letters and digits.
+ * Since a newline can't be part of a word the counts for separate lines
+ * (or parts of them) can simply be added together, which is what lets
+ * lindex_chunk() cache them.
+ */
+long count_words(struct line *lp, int start, int end) {
+    long nwords = 0;
+    int lastword = FALSE;
+
+    for (int offset = start; offset < end; offset++) {
+        int ch = lgetc(lp, offset);
+        int wordflag = ((isletter(ch)) || (ch >= '0' && ch <= '9'));
+        if (wordflag == TRUE && lastword == FALSE) ++nwords;
+        lastword = wordflag;
+    }
+    return nwords;
+}
+
 /*
  *      wordcount:      count the # of words in the marked region,
  *                      along with average word sizes, # of chars, etc,
  *                      and report on them.
+ * Whole chunks of lines (see lindex.c) within the region have their
+ * word counts cached, so we only need to look at the text of lines at
+ * the ends of the region (and of any that have changed).
  *
  * int f, n;            ignored numeric arguments
  */
 int wordcount(int f, int n) {
     UNUSED(f); UNUSED(n);
     struct line *lp;        /* current line to scan */
+    struct line *nextlp;    /* line after a chunk */
     int offset;             /* current char to scan */
     int orig_offset;        /* offset in line at start */
     long size;              /* size of region left to count */
-    int ch;                 /* current character to scan */
-    int wordflag;           /* are we in a word now? */
-    int lastword;           /* were we just in a word? */
     long nwords;            /* total # of words */
     long nchars;            /* total number of chars */
     int nlines;             /* total number of lines in region */
     int avgch;              /* average number of chars/word */
     int status;             /* status return code */
     struct region region;   /* region to look at */
+    int clines;             /* Counts for a chunk */
+    long cbytes, cwords;
 
 /* Make sure we have a region to count */
     if ((status = getregion(&region)) != TRUE) return status;
@@ -533,27 +541,32 @@ int wordcount(int f, int n) {
     orig_offset = offset;
     size = region.r_size;
 /* Count up things */
-    lastword = FALSE;
-    nchars = 0L;
+    nchars = size;
     nwords = 0L;
     nlines = 0;
-    while (size--) {
-/* Get the current character... */
-        if (offset == llength(lp)) {    /* end of line */
-            ch = '\n';
-            lp = lforw(lp);
-            offset = 0;
-            ++nlines;
+    while (size > 0) {
+/* At the start of a chunk that is all in the region we can use its counts */
+        if (offset == 0) {
+            nextlp = lindex_chunk(curbp, lp, &clines, &cbytes, &cwords);
+            if (nextlp != NULL && cbytes + clines <= size) {
+                nwords += cwords;
+                nlines += clines;
+                size -= cbytes + clines;
+                lp = nextlp;
+                continue;
+            }
         }
-        else {
-            ch = lgetc(lp, offset);
-            ++offset;
+/* Otherwise count this line (to the end of the region) */
+        if (llength(lp) - offset >= size) {
+            nwords += count_words(lp, offset, offset + size);
+            offset += size;
+            break;
         }
-/* ...and tabulate it */
-        wordflag = ((isletter(ch)) || (ch >= '0' && ch <= '9'));
-        if (wordflag == TRUE && lastword == FALSE) ++nwords;
-        lastword = wordflag;
-        ++nchars;
+        nwords += count_words(lp, offset, llength(lp));
+        size -= llength(lp) - offset + 1;   /* +1 for the newline */
+        lp = lforw(lp);
+        offset = 0;
+        ++nlines;
     }
 /* GGR - Increment line count if offset is now more than at the start
  * So line1 col3 -> line2 col55 is 2 lines,. not 1